@@ -0,0 +1,106 @@
+#include "aho_corasick.h"
+#include <cctype>
+#include <algorithm>
+#include <deque>
+#include <iterator>
+
+namespace {
+struct Node {
+    explicit Node(uint32_t classes) : next(classes, 0) {}
+    std::vector<uint32_t> next;   // Trie edges by byte class, 0 = none (0 is the root)
+    uint32_t fail = 0;
+    std::vector<uint32_t> ids;
+};
+}
+
+void AhoCorasick::add(const std::string& literal, uint32_t id) {
+    if (literal.empty()) return;
+    pending.emplace_back(literal, id);
+}
+
+void AhoCorasick::clear() {
+    pending.clear();
+    literalCount = 0;
+    classCount = 1;
+    std::fill(std::begin(byteClass), std::end(byteClass), 0);
+    delta.clear();
+    outputStart.clear();
+    outputs.clear();
+}
+
+void AhoCorasick::build() {
+    literalCount = pending.size();
+    delta.clear();
+    outputStart.clear();
+    outputs.clear();
+    if (pending.empty()) return;
+
+    // Byte classes: one per (folded) byte used by a literal, 0 for the rest.
+    // Input bytes are folded through the same table.
+    std::fill(std::begin(byteClass), std::end(byteClass), 0);
+    classCount = 1;
+    uint8_t folded[256];
+    for (int b = 0; b < 256; ++b) folded[b] = static_cast<uint8_t>(std::tolower(b));
+    for (const auto& entry : pending) {
+        for (char c : entry.first) {
+            uint8_t f = folded[static_cast<uint8_t>(c)];
+            if (!byteClass[f]) byteClass[f] = static_cast<uint8_t>(classCount++);
+        }
+    }
+    for (int b = 0; b < 256; ++b) byteClass[b] = byteClass[folded[b]];
+
+    // Trie.
+    std::vector<Node> nodes;
+    nodes.emplace_back(classCount);
+    for (const auto& entry : pending) {
+        uint32_t state = 0;
+        for (char c : entry.first) {
+            uint8_t cls = byteClass[static_cast<uint8_t>(c)];
+            if (!nodes[state].next[cls]) {
+                nodes[state].next[cls] = static_cast<uint32_t>(nodes.size());
+                nodes.emplace_back(classCount);
+            }
+            state = nodes[state].next[cls];
+        }
+        nodes[state].ids.push_back(entry.second);
+    }
+
+    // Breadth-first: fail links, then missing edges filled in from the fail
+    // state, which turns the trie into a DFA. A state's outputs include its
+    // fail state's (already complete, being shallower).
+    size_t n = nodes.size();
+    delta.assign(n * classCount, 0);
+    std::vector<std::vector<uint32_t>> out(n);
+    std::deque<uint32_t> queue;
+    for (uint32_t cls = 0; cls < classCount; ++cls) {
+        uint32_t child = nodes[0].next[cls];
+        delta[cls] = child;
+        if (child) queue.push_back(child);
+    }
+    out[0] = nodes[0].ids;
+    while (!queue.empty()) {
+        uint32_t state = queue.front();
+        queue.pop_front();
+        Node& node = nodes[state];
+        out[state] = node.ids;
+        const std::vector<uint32_t>& inherited = out[node.fail];
+        out[state].insert(out[state].end(), inherited.begin(), inherited.end());
+        for (uint32_t cls = 0; cls < classCount; ++cls) {
+            uint32_t child = node.next[cls];
+            if (child) {
+                nodes[child].fail = state ? delta[node.fail * classCount + cls] : 0;
+                delta[state * classCount + cls] = child;
+                queue.push_back(child);
+            } else {
+                delta[state * classCount + cls] = delta[node.fail * classCount + cls];
+            }
+        }
+    }
+
+    outputStart.reserve(n + 1);
+    for (size_t s = 0; s < n; ++s) {
+        outputStart.push_back(static_cast<uint32_t>(outputs.size()));
+        outputs.insert(outputs.end(), out[s].begin(), out[s].end());
+    }
+    outputStart.push_back(static_cast<uint32_t>(outputs.size()));
+}
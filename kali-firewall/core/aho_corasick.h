@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Aho-Corasick automaton over case-folded bytes: finds every occurrence of
+// a set of literals in one pass over the input, whatever their number.
+// Literals are added lower-cased (see requiredLiterals()) and the input is
+// folded with the same table, so matching ignores ASCII case; callers that
+// need exact case confirm the hit afterwards.
+//
+// The automaton is a full DFA over byte classes (bytes that appear in no
+// literal share one class), so a step is two table reads.
+class AhoCorasick {
+public:
+    // Adds `literal`, reported as `id` by scan(). Call build() afterwards.
+    void add(const std::string& literal, uint32_t id);
+    void build();
+    void clear();
+
+    bool empty() const { return literalCount == 0; }
+    size_t stateCount() const { return outputStart.empty() ? 0 : outputStart.size() - 1; }
+
+    // Calls onMatch(id) for the id of every literal occurring in
+    // [data, data + len), once per occurrence. onMatch returns false to stop.
+    template <typename F>
+    void scan(const uint8_t* data, size_t len, F&& onMatch) const {
+        if (literalCount == 0) return;
+        uint32_t state = 0;
+        for (size_t i = 0; i < len; ++i) {
+            state = delta[state * classCount + byteClass[data[i]]];
+            for (uint32_t o = outputStart[state]; o < outputStart[state + 1]; ++o) {
+                if (!onMatch(outputs[o])) return;
+            }
+        }
+    }
+
+private:
+    std::vector<std::pair<std::string, uint32_t>> pending;
+    size_t literalCount = 0;
+
+    uint8_t byteClass[256] = {};
+    uint32_t classCount = 1;
+    std::vector<uint32_t> delta;         // state * classCount + class -> state
+    std::vector<uint32_t> outputStart;   // Per state (plus one), into `outputs`
+    std::vector<uint32_t> outputs;       // Ids ending at each state, including via fail links
+};
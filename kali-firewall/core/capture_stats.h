@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QMetaType>
+#include <QtGlobal>
+
+// Snapshot of the capture counters summed over all queue workers. Emitted by
+// PacketCapture at a fixed rate, independent of the packet rate.
+struct CaptureStats {
+    quint64 packets = 0;
+    quint64 bytes = 0;
+    quint64 blocked = 0;
+    quint64 blockedByRule = 0;
+    quint64 blockedByDpi = 0;
+    quint64 verdictSyscallsSaved = 0;
+    quint64 gsoPackets = 0;          // Queued as one unsegmented GSO packet
+    quint64 heldPackets = 0;         // Held while their flow waited on the user
+
+    // Overload: ENOBUFS seen by the workers, plus the kernel's own counters
+    // from /proc/net/netfilter/nfnetlink_queue for our queues.
+    quint64 enobufsEvents = 0;
+    quint64 kernelQueueDropped = 0;  // Queue was at max length
+    quint64 kernelUserDropped = 0;   // Netlink socket buffer was full
+    quint64 kernelBacklog = 0;       // Packets currently waiting for a verdict
+
+    // Rates over the last snapshot interval
+    quint64 packetsPerSec = 0;
+    quint64 bytesPerSec = 0;
+    quint64 syscallsSavedPerSec = 0;
+
+    // Flow verdict cache of the rule engine, summed over the workers
+    quint64 flowCacheLookups = 0;
+    quint64 flowCacheHits = 0;
+    quint64 flowCacheEvictions = 0;
+    quint64 flowCacheOccupancy = 0;
+    quint64 flowCacheCapacity = 0;
+
+    // TCP stream reassembly of the DPI engine
+    quint64 streamFlows = 0;
+    quint64 streamBufferedBytes = 0;
+    quint64 streamGapsSkipped = 0;
+    quint64 streamOverflowDrops = 0;
+
+    // Signature dispatch of the DPI engine: how many signatures a packet is
+    // matched against once scopes have been applied
+    quint64 dpiPackets = 0;
+    quint64 dpiCandidates = 0;
+    quint64 dpiSignatures = 0;
+    quint64 dpiSignatureGroups = 0;
+    double dpiCandidatesPerPacket = 0;   // Over the last snapshot interval
+
+    quint64 logRecordsDropped = 0;
+    int memoryKB = 0;
+};
+Q_DECLARE_METATYPE(CaptureStats)
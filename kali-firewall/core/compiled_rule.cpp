@@ -0,0 +1,126 @@
+#include "compiled_rule.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <netinet/in.h>
+
+namespace {
+std::string lower(const std::string& s) {
+    std::string out(s);
+    std::transform(out.begin(), out.end(), out.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return out;
+}
+
+bool isAny(const std::string& s) {
+    return s.empty() || s == "*" || lower(s) == "any";
+}
+
+bool parseNumber(const std::string& s, unsigned long maxValue, unsigned long& value) {
+    if (s.empty() || s.size() > 10) return false;
+    for (char c : s) {
+        if (!std::isdigit(static_cast<unsigned char>(c))) return false;
+    }
+    value = std::strtoul(s.c_str(), nullptr, 10);
+    return value <= maxValue;
+}
+}
+
+bool parseAddressPrefix(const std::string& text, uint8_t& family, uint8_t& prefix,
+                        uint32_t net[4], uint32_t mask[4]) {
+    std::string addrText = text;
+    std::string prefixText;
+    size_t slash = text.find('/');
+    if (slash != std::string::npos) {
+        addrText = text.substr(0, slash);
+        prefixText = text.substr(slash + 1);
+    }
+
+    IpAddr addr;
+    if (!IpAddr::parse(addrText, addr)) return false;
+    unsigned long bits = addr.family == AF_INET ? 32 : 128;
+    if (!prefixText.empty() && !parseNumber(prefixText, bits, bits)) return false;
+
+    family = addr.family;
+    prefix = static_cast<uint8_t>(bits);
+    uint32_t words[4];
+    std::memcpy(words, addr.bytes, sizeof(words));
+    for (int i = 0; i < 4; ++i) {
+        int wordBits = std::min(32, std::max(0, static_cast<int>(bits) - i * 32));
+        mask[i] = wordBits == 0 ? 0 : htonl(0xffffffffu << (32 - wordBits));
+        net[i] = words[i] & mask[i];
+    }
+    return true;
+}
+
+bool parsePortRange(const std::string& text, uint16_t& lo, uint16_t& hi) {
+    // Port 0 is what the rule editor writes for "any port".
+    if (isAny(text) || text == "0") {
+        lo = 0;
+        hi = 0xffff;
+        return true;
+    }
+    unsigned long a, b;
+    size_t dash = text.find('-');
+    if (dash == std::string::npos) {
+        if (!parseNumber(text, 0xffff, a)) return false;
+        b = a;
+    } else if (!parseNumber(text.substr(0, dash), 0xffff, a) ||
+               !parseNumber(text.substr(dash + 1), 0xffff, b) || a > b) {
+        return false;
+    }
+    lo = static_cast<uint16_t>(a);
+    hi = static_cast<uint16_t>(b);
+    return true;
+}
+
+bool parseProtocol(const std::string& text, int16_t& protocol) {
+    if (isAny(text) || lower(text) == "ip") {
+        protocol = -1;
+        return true;
+    }
+    static const struct { const char* name; int16_t number; } names[] = {
+        {"tcp", IPPROTO_TCP}, {"udp", IPPROTO_UDP}, {"icmp", IPPROTO_ICMP},
+        {"icmpv6", IPPROTO_ICMPV6}, {"ipv6-icmp", IPPROTO_ICMPV6}, {"sctp", IPPROTO_SCTP},
+        {"gre", IPPROTO_GRE}, {"esp", IPPROTO_ESP}, {"ah", IPPROTO_AH},
+    };
+    std::string name = lower(text);
+    for (const auto& n : names) {
+        if (name == n.name) {
+            protocol = n.number;
+            return true;
+        }
+    }
+    unsigned long value;
+    if (!parseNumber(text, 255, value)) return false;
+    protocol = static_cast<int16_t>(value);
+    return true;
+}
+
+RuleVerdict parseVerdict(const std::string& action) {
+    std::string a = lower(action);
+    if (a == "block" || a == "drop" || a == "deny" || a == "reject")
+        return RuleVerdict::Block;
+    return RuleVerdict::Allow;
+}
+
+bool compileRule(const RuleText& text, CompiledRule& out) {
+    out = CompiledRule();
+    bool ok = true;
+
+    uint8_t srcFamily = 0, dstFamily = 0;
+    if (!isAny(text.srcIp))
+        ok &= parseAddressPrefix(text.srcIp, srcFamily, out.srcPrefix, out.srcNet, out.srcMask);
+    if (!isAny(text.dstIp))
+        ok &= parseAddressPrefix(text.dstIp, dstFamily, out.dstPrefix, out.dstNet, out.dstMask);
+    // An IPv4 source with an IPv6 destination can never match anything.
+    if (srcFamily && dstFamily && srcFamily != dstFamily) ok = false;
+    out.family = srcFamily ? srcFamily : dstFamily;
+
+    ok &= parsePortRange(text.srcPort, out.srcPortLo, out.srcPortHi);
+    ok &= parsePortRange(text.dstPort, out.dstPortLo, out.dstPortHi);
+    ok &= parseProtocol(text.protocol, out.protocol);
+    out.verdict = parseVerdict(text.action);
+    out.valid = ok;
+    return ok;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "packet_meta.h"
+
+enum class RuleVerdict : uint8_t {
+    Allow,
+    Block
+};
+
+// Text form of a rule as stored in the rules JSON (and in RuleEngine's Rule).
+struct RuleText {
+    std::string srcIp;    // "*", "" or "any"; an address; or address/prefix (IPv4 or IPv6)
+    std::string dstIp;
+    std::string srcPort;  // "*", "", "any" or "0"; a port; or "lo-hi"
+    std::string dstPort;
+    std::string protocol; // "*", "" or "any"; a name (tcp, udp, icmp, icmpv6, ...) or a number
+    std::string action;   // allow/accept/pass, or block/drop/deny/reject
+};
+
+// Integer form of a rule: masked networks, port ranges, a protocol number and
+// a verdict. Matching is a handful of compares on the PacketMeta fields.
+struct CompiledRule {
+    uint8_t family = 0;        // AF_INET / AF_INET6 when an address is given, 0 = either
+    uint8_t srcPrefix = 0;     // Prefix lengths; 0 = any address
+    uint8_t dstPrefix = 0;
+    uint32_t srcNet[4] = {};   // Network byte order, already masked
+    uint32_t srcMask[4] = {};
+    uint32_t dstNet[4] = {};
+    uint32_t dstMask[4] = {};
+    uint16_t srcPortLo = 0, srcPortHi = 0xffff;
+    uint16_t dstPortLo = 0, dstPortHi = 0xffff;
+    int16_t protocol = -1;     // IPPROTO_*, -1 = any
+    RuleVerdict verdict = RuleVerdict::Allow;
+    bool valid = true;         // False if a field did not parse; such a rule never matches
+
+    bool matches(const PacketMeta& pkt) const {
+        if (!valid) return false;
+        if (protocol >= 0 && pkt.protocol != protocol) return false;
+        if (pkt.srcPort < srcPortLo || pkt.srcPort > srcPortHi) return false;
+        if (pkt.dstPort < dstPortLo || pkt.dstPort > dstPortHi) return false;
+        if (family && pkt.src.family != family) return false;
+        return (srcPrefix == 0 || maskedEquals(pkt.src, srcNet, srcMask, srcPrefix))
+            && (dstPrefix == 0 || maskedEquals(pkt.dst, dstNet, dstMask, dstPrefix));
+    }
+
+private:
+    static bool maskedEquals(const IpAddr& addr, const uint32_t* net, const uint32_t* mask, uint8_t prefix) {
+        uint32_t words[4];
+        std::memcpy(words, addr.bytes, sizeof(words));
+        int n = (prefix + 31) / 32;
+        for (int i = 0; i < n; ++i) {
+            if ((words[i] & mask[i]) != net[i]) return false;
+        }
+        return true;
+    }
+};
+
+// Compiles `text` into `out`. Returns false (and leaves out.valid false) if
+// any field fails to parse.
+bool compileRule(const RuleText& text, CompiledRule& out);
+
+// Field parsers, also used to turn GUI text into PacketMeta values.
+bool parseAddressPrefix(const std::string& text, uint8_t& family, uint8_t& prefix,
+                        uint32_t net[4], uint32_t mask[4]);
+bool parsePortRange(const std::string& text, uint16_t& lo, uint16_t& hi);
+bool parseProtocol(const std::string& text, int16_t& protocol);
+RuleVerdict parseVerdict(const std::string& action);
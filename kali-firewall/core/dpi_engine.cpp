@@ -1,17 +1,71 @@
 #include "dpi_engine.h"
+#include "regex_literals.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <netinet/in.h>
 #include <iostream> // For error logging (replace with your logger if needed)
 
-DPIEngine::DPIEngine() = default;
+namespace {
+constexpr size_t DEFAULT_INSPECTION_DEPTH = 2048;
+constexpr size_t MAX_INSPECTION_DEPTH = 0xffff;
+
+uint64_t nextInstanceId() {
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+}
+
+void bump(std::atomic<uint64_t>& counter, uint64_t by = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+uint64_t monotonicMs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool inPorts(const DPIScope& scope, uint16_t port) {
+    for (const auto& range : scope.ports) {
+        if (port >= range.first && port <= range.second) return true;
+    }
+    return false;
+}
+
+// Sorted union of sorted index lists.
+void mergeInto(std::vector<uint32_t>& out, const std::vector<uint32_t>& more) {
+    std::vector<uint32_t> merged;
+    merged.reserve(out.size() + more.size());
+    std::set_union(out.begin(), out.end(), more.begin(), more.end(), std::back_inserter(merged));
+    out.swap(merged);
+}
+}
+
+DPIEngine::DPIEngine()
+    : depth(DEFAULT_INSPECTION_DEPTH), streamReassembly(false), instanceId(nextInstanceId()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    publish({});
+}
 DPIEngine::~DPIEngine() = default;
 
 std::regex DPIEngine::make_regex(const std::string& pattern, bool case_insensitive) {
     return std::regex(pattern, case_insensitive ? std::regex::icase : std::regex::ECMAScript);
 }
 
-bool DPIEngine::addSignature(const std::string& name, const std::string& regex_str, DPIResult result, bool case_insensitive) {
+bool DPIEngine::addSignature(const std::string& name, const std::string& regex_str, DPIResult result, bool case_insensitive,
+                             const DPIScope& scope) {
+    if (scope.direction != DPIDirection::Any && scope.ports.empty()) {
+        std::cerr << "DPIEngine: Signature '" << name << "' has a direction but no ports" << std::endl;
+        return false;
+    }
+    for (const auto& range : scope.ports) {
+        if (range.first > range.second) {
+            std::cerr << "DPIEngine: Invalid port range for signature '" << name << "'" << std::endl;
+            return false;
+        }
+    }
     std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Signature> signatures = snapshot()->signatures;
     // Prevent duplicate names
     auto it = std::find_if(signatures.begin(), signatures.end(),
         [&](const Signature& s) { return s.name == name; });
@@ -23,8 +77,11 @@ bool DPIEngine::addSignature(const std::string& name, const std::string& regex_s
         sig.regex_str = regex_str;
         sig.result = result;
         sig.case_insensitive = case_insensitive;
+        sig.scope = scope;
         sig.pattern = make_regex(regex_str, case_insensitive);
+        sig.literals = requiredLiterals(regex_str);
         signatures.push_back(std::move(sig));
+        publish(std::move(signatures));
         return true;
     } catch (const std::regex_error& e) {
         std::cerr << "DPIEngine: Invalid regex for signature '" << name << "': " << e.what() << std::endl;
@@ -34,42 +91,414 @@ bool DPIEngine::addSignature(const std::string& name, const std::string& regex_s
 
 bool DPIEngine::removeSignature(const std::string& name) {
     std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Signature> signatures = snapshot()->signatures;
     auto it = std::remove_if(signatures.begin(), signatures.end(),
         [&](const Signature& s) { return s.name == name; });
     if (it == signatures.end()) return false;
     signatures.erase(it, signatures.end());
+    publish(std::move(signatures));
     return true;
 }
 
-std::vector<DPIEngine::SignatureInfo> DPIEngine::listSignatures() {
+void DPIEngine::setCombinedDfa(bool enabled) {
     std::lock_guard<std::mutex> lock(mutex_);
+    if (combinedDfa == enabled) return;
+    combinedDfa = enabled;
+    publish(snapshot()->signatures);
+}
+
+size_t DPIEngine::dfaSignatureCount() const {
+    return snapshot()->all->dfa.patterns();
+}
+
+DPIDispatchStats DPIEngine::dispatchStats() const {
+    SignatureSetPtr set = snapshot();
+    DPIDispatchStats stats;
+    {
+        std::lock_guard<std::mutex> lock(shardMutex);
+        for (const auto& shard : shards) {
+            stats.packets += shard->packets.load(std::memory_order_relaxed);
+            stats.candidates += shard->candidates.load(std::memory_order_relaxed);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(set->groupMutex);
+        stats.groups = 1 + set->groups.size();
+    }
+    stats.signatures = set->signatures.size();
+    return stats;
+}
+
+void DPIEngine::publish(std::vector<Signature> signatures) {
+    auto next = std::make_shared<SignatureSet>();
+    next->signatures = std::move(signatures);
+    std::vector<Signature>& sigs = next->signatures;
+
+    // Whether a signature fits the DFA depends only on its pattern; decide
+    // it once here, and every group built from this set follows it.
+    std::vector<uint32_t> all(sigs.size());
+    for (size_t i = 0; i < sigs.size(); ++i) {
+        all[i] = static_cast<uint32_t>(i);
+        sigs[i].inDfa = combinedDfa && SignatureDfa::supports(sigs[i].regex_str, sigs[i].case_insensitive);
+    }
+    next->all = buildGroup(sigs, all);
+
+    // Bucket 0 takes the protocols no scope names, each named protocol gets its own.
+    std::vector<uint8_t> protocols = {0};
+    for (const Signature& sig : sigs) {
+        uint8_t p = sig.scope.protocol;
+        if (p != 0 && next->bucketOf[p] == 0) {
+            next->bucketOf[p] = static_cast<uint8_t>(protocols.size());
+            protocols.push_back(p);
+        }
+    }
+    next->buckets.assign(protocols.size(), ProtocolBucket());
+    for (size_t b = 0; b < next->buckets.size(); ++b) {
+        ProtocolBucket& bucket = next->buckets[b];
+        std::vector<uint32_t> scoped;
+        bucket.bounds = {0};
+        for (uint32_t i : all) {
+            const DPIScope& scope = sigs[i].scope;
+            if (scope.protocol != 0 && scope.protocol != protocols[b]) continue;
+            bucket.anyPort.push_back(i);
+            if (scope.ports.empty()) {
+                bucket.portless.push_back(i);
+                continue;
+            }
+            scoped.push_back(i);
+            for (const auto& range : scope.ports) {
+                bucket.bounds.push_back(range.first);
+                if (range.second < 0xffff) bucket.bounds.push_back(static_cast<uint16_t>(range.second + 1));
+            }
+        }
+        std::sort(bucket.bounds.begin(), bucket.bounds.end());
+        bucket.bounds.erase(std::unique(bucket.bounds.begin(), bucket.bounds.end()), bucket.bounds.end());
+        // Every port of a class is in the same ranges, so its first port speaks for it.
+        bucket.toServer.assign(bucket.bounds.size(), {});
+        bucket.toClient.assign(bucket.bounds.size(), {});
+        for (size_t c = 0; c < bucket.bounds.size(); ++c) {
+            for (uint32_t i : scoped) {
+                const DPIScope& scope = sigs[i].scope;
+                if (!inPorts(scope, bucket.bounds[c])) continue;
+                if (scope.direction != DPIDirection::ToClient) bucket.toServer[c].push_back(i);
+                if (scope.direction != DPIDirection::ToServer) bucket.toClient[c].push_back(i);
+            }
+        }
+    }
+    SignatureSetPtr published(std::move(next));
+    std::atomic_store(&signatureSet, published);
+}
+
+std::shared_ptr<const DPIEngine::SignatureGroup> DPIEngine::buildGroup(const std::vector<Signature>& signatures,
+                                                                       std::vector<uint32_t> members) {
+    auto group = std::make_shared<SignatureGroup>();
+    group->members = std::move(members);
+    for (uint32_t i : group->members) {
+        const Signature& sig = signatures[i];
+        if (sig.inDfa) {
+            group->dfa.add(sig.regex_str, sig.case_insensitive, i);
+            continue;
+        }
+        if (sig.literals.empty()) ++group->unfilteredCount;
+        for (const std::string& literal : sig.literals)
+            group->prefilter.add(literal, i);
+    }
+    group->dfa.build();
+    group->prefilter.build();
+    return group;
+}
+
+DPIEngine::ThreadShard* DPIEngine::localShard() {
+    // Almost always a single entry: one engine per process.
+    thread_local std::vector<std::pair<uint64_t, ThreadShard*>> cache;
+    for (const auto& entry : cache) {
+        if (entry.first == instanceId) return entry.second;
+    }
+    std::lock_guard<std::mutex> lock(shardMutex);
+    shards.emplace_back(new ThreadShard);
+    cache.emplace_back(instanceId, shards.back().get());
+    return shards.back().get();
+}
+
+void DPIEngine::rebindShard(ThreadShard& shard, const SignatureSetPtr& set) {
+    shard.set = set;
+    shard.groups.clear();
+    shard.groups.push_back(std::unique_ptr<ScanGroup>(new ScanGroup{set->all, set->all->dfa}));
+    shard.groupOf.clear();
+    shard.candidate.assign(set->signatures.size(), 0);
+    shard.marked.clear();
+    shard.marked.reserve(set->signatures.size());
+}
+
+DPIEngine::ScanGroup& DPIEngine::dispatch(ThreadShard& shard, const PacketMeta& meta) {
+    const SignatureSet& set = *shard.set;
+    size_t b = set.bucketOf[meta.protocol];
+    const ProtocolBucket& bucket = set.buckets[b];
+    size_t classes = bucket.bounds.size();
+    auto classOf = [&](uint16_t port) {
+        return static_cast<size_t>(std::upper_bound(bucket.bounds.begin(), bucket.bounds.end(), port)
+                                   - bucket.bounds.begin() - 1);
+    };
+    // Class `classes` stands for "port unknown".
+    size_t src = meta.fragment ? classes : classOf(meta.srcPort);
+    size_t dst = meta.fragment ? classes : classOf(meta.dstPort);
+    uint64_t key = (static_cast<uint64_t>(b) << 40) | (static_cast<uint64_t>(src) << 20) | dst;
+
+    auto it = shard.groupOf.find(key);
+    if (it != shard.groupOf.end()) return *shard.groups[it->second];
+
+    std::shared_ptr<const SignatureGroup> shared;
+    {
+        // Rare: only the first packet of each class pair on each thread gets here.
+        std::lock_guard<std::mutex> lock(set.groupMutex);
+        auto found = set.groupOf.find(key);
+        if (found != set.groupOf.end()) {
+            shared = found->second;
+        } else {
+            std::vector<uint32_t> members;
+            if (meta.fragment) {
+                members = bucket.anyPort;
+            } else {
+                members = bucket.portless;
+                mergeInto(members, bucket.toServer[dst]);
+                mergeInto(members, bucket.toClient[src]);
+            }
+            if (members.size() == set.signatures.size()) {
+                shared = set.all;
+            } else {
+                for (const auto& group : set.groups) {
+                    if (group->members == members) shared = group;
+                }
+                if (!shared) {
+                    // Too many scope combinations in use: start over. Streams
+                    // scanned by a dropped group resume as if after a gap.
+                    if (set.groups.size() + 1 >= MAX_SIGNATURE_GROUPS) {
+                        set.groups.clear();
+                        set.groupOf.clear();
+                    }
+                    shared = buildGroup(set.signatures, std::move(members));
+                    set.groups.push_back(shared);
+                }
+            }
+            set.groupOf.emplace(key, shared);
+        }
+    }
+
+    uint32_t index = 0; // groups[0] scans set.all
+    if (shared != set.all) {
+        for (size_t g = 1; g < shard.groups.size() && !index; ++g) {
+            if (shard.groups[g]->shared == shared) index = static_cast<uint32_t>(g);
+        }
+        if (!index) {
+            if (shard.groups.size() >= MAX_SIGNATURE_GROUPS) {
+                shard.groups.resize(1);
+                shard.groupOf.clear();
+            }
+            index = static_cast<uint32_t>(shard.groups.size());
+            shard.groups.push_back(std::unique_ptr<ScanGroup>(new ScanGroup{shared, shared->dfa}));
+        }
+    }
+    shard.groupOf.emplace(key, index);
+    return *shard.groups[index];
+}
+
+std::vector<DPIEngine::SignatureInfo> DPIEngine::listSignatures() {
+    SignatureSetPtr set = snapshot();
     std::vector<SignatureInfo> infos;
-    for (const auto& sig : signatures) {
-        infos.push_back(SignatureInfo{sig.name, sig.regex_str, sig.result, sig.case_insensitive});
+    for (const auto& sig : set->signatures) {
+        infos.push_back(SignatureInfo{sig.name, sig.regex_str, sig.result, sig.case_insensitive, sig.scope});
     }
     return infos;
 }
 
+void DPIEngine::setInspectionDepth(size_t newDepth) {
+    depth = std::min(std::max<size_t>(newDepth, 1), MAX_INSPECTION_DEPTH);
+}
+
+size_t DPIEngine::inspectionDepth() const {
+    return depth;
+}
+
+size_t DPIEngine::requiredCopyRange() const {
+    if (snapshot()->signatures.empty()) return 0;
+    return streamReassembly ? MAX_INSPECTION_DEPTH : depth.load();
+}
+
+void DPIEngine::setStreamReassembly(bool enabled, const ReassemblyLimits& limits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReassemblyLimits share = limits;
+    share.maxFlows = std::max<size_t>(limits.maxFlows / STREAM_SHARDS, 1);
+    share.globalBytes = limits.globalBytes / STREAM_SHARDS;
+    streamReassembly = enabled;
+    for (StreamShard& slice : streamShards) {
+        std::lock_guard<std::mutex> sliceLock(slice.mutex);
+        slice.reassembler.setLimits(share);
+        if (!enabled) slice.reassembler.clear();
+    }
+}
+
+bool DPIEngine::streamReassemblyEnabled() const {
+    return streamReassembly;
+}
+
+ReassemblyStats DPIEngine::streamStats() const {
+    ReassemblyStats total;
+    for (const StreamShard& slice : streamShards) {
+        std::lock_guard<std::mutex> lock(slice.mutex);
+        ReassemblyStats s = slice.reassembler.stats();
+        total.flows += s.flows;
+        total.bufferedBytes += s.bufferedBytes;
+        total.gapsSkipped += s.gapsSkipped;
+        total.overflowDrops += s.overflowDrops;
+        total.evictions += s.evictions;
+        total.lateFills += s.lateFills;
+    }
+    return total;
+}
+
 DPIResult DPIEngine::inspect(const uint8_t* data, size_t len, std::string& matchedSig) {
-    std::string payload(reinterpret_cast<const char*>(data), len);
-    return testPayload(payload, &matchedSig);
+    // Anything past the inspection depth was not copied by the kernel anyway.
+    std::string_view payload(reinterpret_cast<const char*>(data), std::min(len, inspectionDepth()));
+    return inspect(payload, &matchedSig);
 }
 
 DPIResult DPIEngine::testPayload(const std::string& payload, std::string* matchedSig) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (const auto& sig : signatures) {
+    return inspect(std::string_view(payload), matchedSig);
+}
+
+DPIResult DPIEngine::inspect(std::string_view payload, std::string* matchedSig) {
+    SignatureSetPtr set = snapshot();
+    ThreadShard& shard = *localShard();
+    if (shard.set != set) rebindShard(shard, set);
+    size_t idx = firstMatch(shard, *shard.groups[0], payload);
+    if (idx < set->signatures.size()) {
+        if (matchedSig) *matchedSig = set->signatures[idx].name;
+        return set->signatures[idx].result;
+    }
+    if (matchedSig) *matchedSig = "";
+    return DPIResult::UNKNOWN;
+}
+
+size_t DPIEngine::firstMatch(ThreadShard& shard, ScanGroup& group, std::string_view payload) {
+    // First DFA signature that matches; regex signatures only matter before it.
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(payload.data());
+    size_t none = shard.set->signatures.size();
+    size_t first = std::min<size_t>(group.dfa.firstMatch(data, payload.size()), none);
+    size_t regex = firstRegexMatch(shard, group, payload, first);
+    return regex < none ? regex : first;
+}
+
+size_t DPIEngine::firstRegexMatch(ThreadShard& shard, ScanGroup& group, std::string_view text, size_t end,
+                                  bool atStart) {
+    const std::vector<Signature>& signatures = shard.set->signatures;
+    const SignatureGroup& shared = *group.shared;
+    if (shared.dfa.patterns() == shared.members.size()) return signatures.size(); // All in the DFA
+
+    for (uint32_t i : shard.marked) shard.candidate[i] = 0; // Left over from the previous payload
+    shard.marked.clear();
+    shared.prefilter.scan(reinterpret_cast<const uint8_t*>(text.data()), text.size(), [&shard](uint32_t i) {
+        if (!shard.candidate[i]) {
+            shard.candidate[i] = 1;
+            shard.marked.push_back(i);
+        }
+        return true;
+    });
+    // With no literal hit and every regex signature filtered, no regex can match.
+    if (shard.marked.empty() && shared.unfilteredCount == 0) return signatures.size();
+
+    for (uint32_t i : shared.members) {
+        if (i >= end) break;
+        const Signature& sig = signatures[i];
+        if (sig.inDfa || (!sig.literals.empty() && !shard.candidate[i])) continue;
         try {
-            if (std::regex_search(payload, sig.pattern)) {
-                if (matchedSig) *matchedSig = sig.name;
-                return sig.result;
-            }
+            if (std::regex_search(text.data(), text.data() + text.size(), sig.pattern,
+                                  atStart ? std::regex_constants::match_default : std::regex_constants::match_not_bol))
+                return i;
         } catch (const std::regex_error& e) {
             std::cerr << "DPIEngine: Regex error in signature '" << sig.name << "': " << e.what() << std::endl;
             continue;
         }
     }
-    if (matchedSig) *matchedSig = "";
-    return DPIResult::UNKNOWN;
+    return signatures.size();
+}
+
+DPIResult DPIEngine::scanChunk(ThreadShard& shard, ScanGroup& group, TcpReassembler::Stream& stream,
+                               const TcpReassembler::Chunk& chunk) {
+    const std::vector<Signature>& signatures = shard.set->signatures;
+    bool regexes = group.shared->dfa.patterns() < group.shared->members.size();
+    if (chunk.detached) {
+        // Late bytes for a hole, between the bytes around it: a scan of its
+        // own, from somewhere inside the stream; the stream's position stays.
+        SignatureDfa::Cursor cursor;
+        SignatureDfa::reset(cursor, true);
+        size_t first = std::min<size_t>(group.dfa.feed(cursor, chunk.data, chunk.len), signatures.size());
+        size_t regex = regexes ? firstRegexMatch(shard, group, std::string_view(reinterpret_cast<const char*>(chunk.data),
+                                                                                chunk.len), first, false)
+                               : signatures.size();
+        size_t idx = regex < signatures.size() ? regex : first;
+        return idx < signatures.size() ? signatures[idx].result : DPIResult::UNKNOWN;
+    }
+    if (chunk.afterGap) {
+        // Bytes are missing: whatever was partially matched cannot complete.
+        SignatureDfa::reset(stream.cursor, true);
+        stream.regexTail.clear();
+    }
+    bool atStart = stream.cursor.build == 0 && !stream.cursor.midStream;
+    size_t first = std::min<size_t>(group.dfa.feed(stream.cursor, chunk.data, chunk.len), signatures.size());
+    size_t regex = signatures.size();
+    if (regexes) {
+        // No carried state for std::regex: search the chunk together with
+        // the end of the previous one.
+        std::string& window = shard.streamWindow;
+        window.assign(stream.regexTail);
+        window.append(reinterpret_cast<const char*>(chunk.data), chunk.len);
+        regex = firstRegexMatch(shard, group, window, first, atStart);
+        size_t keep = std::min(window.size(), STREAM_REGEX_OVERLAP);
+        stream.regexTail.assign(window, window.size() - keep, keep);
+    }
+    size_t idx = regex < signatures.size() ? regex : first;
+    return idx < signatures.size() ? signatures[idx].result : DPIResult::UNKNOWN;
+}
+
+bool DPIEngine::inspectStream(ThreadShard& shard, const PacketMeta& meta, ScanGroup& group) {
+    FlowKey key = FlowKey::of(meta);
+    StreamShard& slice = streamShards[key.hash() % STREAM_SHARDS];
+    std::lock_guard<std::mutex> lock(slice.mutex);
+    TcpReassembler::Stream* stream = nullptr;
+    TcpReassembler::Result result = slice.reassembler.add(key, meta.tcpSeq, meta.tcpFlags, meta.payload,
+                                                          meta.payload ? meta.payloadLen : 0, monotonicMs(),
+                                                          stream, shard.streamChunks);
+    if (!stream) return false;
+    for (const TcpReassembler::Chunk& chunk : shard.streamChunks) {
+        if (stream->blocked) break;
+        if (scanChunk(shard, group, *stream, chunk) == DPIResult::Block) stream->blocked = true;
+    }
+    // Drops the segment that completed a match, and everything after it.
+    if (stream->blocked) return true;
+    return result == TcpReassembler::Result::Overflow;
+}
+
+bool DPIEngine::shouldBlock(const PacketMeta& meta) {
+    if (!meta.data || meta.len == 0) return false;
+    // Lock-free with respect to edits: this set stays valid while we hold it.
+    SignatureSetPtr set = snapshot();
+    if (set->signatures.empty()) return false;
+    ThreadShard& shard = *localShard();
+    if (shard.set != set)
+        rebindShard(shard, set); // Only after the signatures changed
+    ScanGroup& group = dispatch(shard, meta);
+    bump(shard.packets);
+    bump(shard.candidates, group.shared->members.size());
+    if (group.shared->members.empty()) return false;
+    // A TCP flow always lands in groups with the same members, so its
+    // stream is scanned by the same matchers throughout (unless the
+    // signatures change), whichever thread gets its segments.
+    if (streamReassembly.load(std::memory_order_relaxed) && meta.protocol == IPPROTO_TCP && !meta.fragment
+        && meta.tcpFlags)
+        return inspectStream(shard, meta, group);
+    size_t n = meta.gso ? meta.len : std::min(meta.len, depth.load(std::memory_order_relaxed));
+    size_t idx = firstMatch(shard, group, std::string_view(reinterpret_cast<const char*>(meta.data), n));
+    return idx < set->signatures.size() && set->signatures[idx].result == DPIResult::Block;
 }
 
 bool DPIEngine::shouldBlock(const std::string& src_ip,
@@ -80,6 +509,7 @@ bool DPIEngine::shouldBlock(const std::string& src_ip,
                             const unsigned char* payload,
                             int payload_len) {
     (void)src_ip; (void)dst_ip; (void)src_port; (void)dst_port; (void)protocol; // suppress unused warnings
+    if (!payload || payload_len <= 0) return false;
     std::string matched;
     DPIResult res = inspect(payload, payload_len, matched);
     return res == DPIResult::Block;
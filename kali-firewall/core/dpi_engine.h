@@ -1,9 +1,18 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <regex>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "aho_corasick.h"
+#include "packet_meta.h"
+#include "signature_dfa.h"
+#include "tcp_reassembler.h"
 
 enum class DPIResult {
     Allow,
@@ -19,6 +28,30 @@ enum class DPIResult {
     UNKNOWN
 };
 
+// How signatures were dispatched to packets (see DPIEngine::shouldBlock).
+struct DPIDispatchStats {
+    uint64_t packets = 0;      // Packets inspected
+    uint64_t candidates = 0;   // Signatures they were matched against, summed
+    size_t groups = 0;         // Signature groups currently built
+    size_t signatures = 0;
+};
+
+// Which side of a scoped signature's ports the payload must come from.
+enum class DPIDirection {
+    Any,        // Either port of the packet in `ports`
+    ToServer,   // Destination port in `ports` (client to server)
+    ToClient    // Source port in `ports` (server to client)
+};
+
+// Traffic a DPI signature applies to; the default applies everywhere.
+struct DPIScope {
+    uint8_t protocol = 0;                                 // IPPROTO_*; 0 = any
+    std::vector<std::pair<uint16_t, uint16_t>> ports;     // Inclusive ranges; empty = any port
+    DPIDirection direction = DPIDirection::Any;           // Needs `ports`
+
+    bool unscoped() const { return protocol == 0 && ports.empty(); }
+};
+
 class DPIEngine {
 public:
     struct SignatureInfo {
@@ -26,13 +59,16 @@ public:
         std::string regex_str;
         DPIResult result;
         bool case_insensitive;
+        DPIScope scope;
     };
 
     DPIEngine();
     ~DPIEngine();
 
-    // Add a new DPI signature. Returns false if name already exists or regex is invalid.
-    bool addSignature(const std::string& name, const std::string& regex_str, DPIResult result, bool case_insensitive);
+    // Add a new DPI signature. Returns false if name already exists, regex is
+    // invalid, or the scope has a direction without ports or a reversed range.
+    bool addSignature(const std::string& name, const std::string& regex_str, DPIResult result, bool case_insensitive,
+                      const DPIScope& scope = DPIScope());
 
     // Remove a signature by name. Returns true if removed.
     bool removeSignature(const std::string& name);
@@ -41,11 +77,59 @@ public:
     std::vector<SignatureInfo> listSignatures();
 
     // Inspect a payload and return the DPIResult. matchedSig will be set to the matching signature name.
+    // Only the first inspectionDepth() bytes are looked at.
     DPIResult inspect(const uint8_t* data, size_t len, std::string& matchedSig);
 
-    // Test a payload string directly (for GUI testing).
+    // Inspect `payload` in place, all of it: the bytes are scanned where they
+    // are (e.g. in the NFQUEUE receive buffer), nothing is copied. There is
+    // no packet to scope by, so every signature is tried.
+    DPIResult inspect(std::string_view payload, std::string* matchedSig = nullptr);
+
+    // Bytes of each packet (from the start of the IP header) that inspect() looks at.
+    void setInspectionDepth(size_t depth);
+    size_t inspectionDepth() const;
+
+    // Bytes the capture layer must copy to userspace for DPI: 0 when there are
+    // no signatures, the inspection depth otherwise (whole packets while
+    // stream reassembly is on).
+    size_t requiredCopyRange() const;
+
+    // Inspect TCP as reassembled streams instead of packet by packet (default
+    // off), so a signature split across segments still matches. Each
+    // direction's payload is scanned once, in order, with the DFA position
+    // carried from segment to segment; signatures outside the DFA re-search
+    // the last STREAM_REGEX_OVERLAP bytes along with each new segment. Once
+    // a blocking signature matches, the rest of the flow is dropped, and so
+    // is any out-of-order segment the limits leave no room to hold.
+    // limits.maxFlows and limits.globalBytes are shared out evenly over the
+    // reassembler shards.
+    static constexpr size_t STREAM_REGEX_OVERLAP = 256;
+    void setStreamReassembly(bool enabled, const ReassemblyLimits& limits = ReassemblyLimits());
+    bool streamReassemblyEnabled() const;
+    ReassemblyStats streamStats() const;
+
+    // Match the signatures SignatureDfa can compile with one combined DFA
+    // (default on); the others, and all of them when off, go through the
+    // literal prefilter and std::regex one by one.
+    void setCombinedDfa(bool enabled);
+    // Signatures currently matched by the combined DFA.
+    size_t dfaSignatureCount() const;
+
+    // Test a payload string directly (for GUI testing); inspect(std::string_view).
     DPIResult testPayload(const std::string& payload, std::string* matchedSig = nullptr);
 
+    // Should this packet be blocked? Inspects meta.data (the packet from the
+    // IP header on, like inspect()); returns early when there are no signatures.
+    // A GSO packet is inspected in full rather than to the inspection depth,
+    // matching what its segments would have got one by one. With stream
+    // reassembly on, TCP payload goes through the flow's stream instead.
+    // Only the signatures whose scope covers the packet's protocol and ports
+    // are tried; a non-first fragment, whose ports are unknown, gets all of
+    // its protocol's. Any number of threads may inspect at once; none of
+    // them waits for the others or for signature edits.
+    bool shouldBlock(const PacketMeta& meta);
+    DPIDispatchStats dispatchStats() const;
+
     // Example: Should this packet be blocked?
     bool shouldBlock(const std::string& src_ip,
                     const std::string& dst_ip,
@@ -61,11 +145,116 @@ private:
         std::string regex_str;
         DPIResult result;
         bool case_insensitive;
+        DPIScope scope;
         std::regex pattern;
+        std::vector<std::string> literals;   // requiredLiterals(); empty: run the regex on every payload
+        bool inDfa = false;                  // Matched by the group DFAs, not by `pattern`
     };
 
-    std::vector<Signature> signatures;
-    mutable std::mutex mutex_;
+    // Matchers for one set of signatures. The combined DFA finds the first
+    // of its signatures that matches in one pass. For the rest, one
+    // Aho-Corasick pass over the payload marks the signatures whose
+    // required literals occur, and only those (plus the ones without
+    // literals) are confirmed with std::regex. Never scanned itself: the
+    // DFA builds its states as it goes, so each thread scans a copy of it
+    // (ScanGroup) and shares the rest.
+    struct SignatureGroup {
+        std::vector<uint32_t> members;   // Signature indices, in list order
+        SignatureDfa dfa;
+        AhoCorasick prefilter;
+        size_t unfilteredCount = 0;      // Members outside the DFA without literals
+    };
+    struct ScanGroup {
+        std::shared_ptr<const SignatureGroup> shared;
+        SignatureDfa dfa;                // This thread's copy of shared->dfa
+    };
+
+    // Dispatch index, built with each signature set. A packet's protocol
+    // picks a bucket; within it the ports the scopes name cut the port space
+    // into classes, and (source class, destination class) picks the group of
+    // signatures that apply. Groups are built on first use and shared by
+    // every class pair with the same members.
+    static constexpr size_t MAX_SIGNATURE_GROUPS = 1024;   // Then all but `all` are rebuilt on demand
+    struct ProtocolBucket {
+        std::vector<uint16_t> bounds;                    // First port of each class; bounds[0] == 0
+        std::vector<uint32_t> portless;                  // Apply on any port
+        std::vector<uint32_t> anyPort;                   // All that apply to the protocol
+        std::vector<std::vector<uint32_t>> toServer;     // By class of the destination port
+        std::vector<std::vector<uint32_t>> toClient;     // By class of the source port
+    };
+
+    // One immutable, published version of the signature list. The packet
+    // path takes a reference with std::atomic_load and never waits for an
+    // edit; edits build the next set off to the side under mutex_ and swap
+    // it in with std::atomic_store (as RuleEngine does with its rules).
+    struct SignatureSet {
+        std::vector<Signature> signatures;
+        uint8_t bucketOf[256] = {};                      // By protocol; bucket 0: protocols no scope names
+        std::vector<ProtocolBucket> buckets;
+        std::shared_ptr<const SignatureGroup> all;       // Every signature
+        // The scoped groups, added by whichever thread needs one first.
+        mutable std::mutex groupMutex;
+        mutable std::vector<std::shared_ptr<const SignatureGroup>> groups;
+        mutable std::unordered_map<uint64_t, std::shared_ptr<const SignatureGroup>> groupOf;   // (bucket, source class, destination class)
+    };
+    using SignatureSetPtr = std::shared_ptr<const SignatureSet>;
+
+    // Per-thread scan state: DFA copies and scratch. Every thread that
+    // inspects gets its own shard, written only by that thread; the
+    // counters are relaxed atomics that dispatchStats() sums. A shard is
+    // bound to one signature set and starts over when it sees a newer one.
+    struct alignas(64) ThreadShard {
+        SignatureSetPtr set;
+        std::vector<std::unique_ptr<ScanGroup>> groups;  // groups[0]: set->all
+        std::unordered_map<uint64_t, uint32_t> groupOf;  // Dispatch key -> groups index
+        std::vector<uint8_t> candidate;                  // By signature index
+        std::vector<uint32_t> marked;                    // Indices set in `candidate`
+        std::vector<TcpReassembler::Chunk> streamChunks;
+        std::string streamWindow;                        // Overlap + chunk for the std::regex signatures
+        std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> candidates{0};
+    };
+
+    // TCP streams (setStreamReassembly), spread over STREAM_SHARDS
+    // reassemblers by flow hash, each with its own lock: a flow's stream
+    // is scanned under its shard's lock, whichever thread gets the segment,
+    // and threads only wait for one another on the same shard.
+    static constexpr size_t STREAM_SHARDS = 16;
+    struct alignas(64) StreamShard {
+        mutable std::mutex mutex;
+        TcpReassembler reassembler;
+    };
+
+    SignatureSetPtr signatureSet;
+    bool combinedDfa = true;             // Guarded by mutex_
+    std::atomic<size_t> depth;
+    std::atomic<bool> streamReassembly;
+    mutable std::mutex mutex_;           // Serializes edits only; the packet path never takes it
+    StreamShard streamShards[STREAM_SHARDS];
+
+    const uint64_t instanceId;           // Tells engines apart in the per-thread shard cache
+    mutable std::mutex shardMutex;       // The shard list
+    std::vector<std::unique_ptr<ThreadShard>> shards;
 
     static std::regex make_regex(const std::string& pattern, bool case_insensitive);
-};
\ No newline at end of file
+    SignatureSetPtr snapshot() const { return std::atomic_load(&signatureSet); }
+    // Builds the dispatch index and publishes. Caller holds mutex_.
+    void publish(std::vector<Signature> signatures);
+    static std::shared_ptr<const SignatureGroup> buildGroup(const std::vector<Signature>& signatures,
+                                                            std::vector<uint32_t> members);
+
+    ThreadShard* localShard();
+    static void rebindShard(ThreadShard& shard, const SignatureSetPtr& set);
+    // The rest work on the calling thread's shard, bound to the current set.
+    static ScanGroup& dispatch(ThreadShard& shard, const PacketMeta& meta);
+    // Index of the first signature matching `payload`, or signatures.size().
+    static size_t firstMatch(ThreadShard& shard, ScanGroup& group, std::string_view payload);
+    // Index of the first member below `end` outside the DFA whose regex
+    // matches `text`, or signatures.size(). "^" only matches at the start
+    // of `text` if `atStart` (it begins the stream).
+    static size_t firstRegexMatch(ThreadShard& shard, ScanGroup& group, std::string_view text, size_t end,
+                                  bool atStart = true);
+    bool inspectStream(ThreadShard& shard, const PacketMeta& meta, ScanGroup& group);
+    static DPIResult scanChunk(ThreadShard& shard, ScanGroup& group, TcpReassembler::Stream& stream,
+                               const TcpReassembler::Chunk& chunk);
+};
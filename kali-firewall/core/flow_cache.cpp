@@ -0,0 +1,49 @@
+#include "flow_cache.h"
+
+FlowCache::FlowCache(size_t capacity) {
+    if (capacity == 0) return;
+    size_t size = PROBE_LIMIT;
+    while (size < capacity) size <<= 1;
+    entries.reset(new Entry[size]);
+    mask = size - 1;
+}
+
+void FlowCache::insert(const FlowKey& key, size_t hash, uint64_t generation, int ruleIndex) {
+    if (!entries) return;
+    if (generation != liveGeneration) {
+        // Rules changed: every entry went stale at once.
+        liveGeneration = generation;
+        occupied.store(0, std::memory_order_relaxed);
+    }
+
+    Entry* slot = nullptr;
+    for (size_t i = 0; i < PROBE_LIMIT; ++i) {
+        Entry& e = entries[(hash + i) & mask];
+        if (e.generation != generation) {
+            slot = &e;
+            bump(occupied);
+            break;
+        }
+        if (e.key == key) { // Already cached for this generation; refresh
+            slot = &e;
+            break;
+        }
+    }
+    if (!slot) {
+        slot = &entries[(hash + victim++ % PROBE_LIMIT) & mask];
+        bump(evictions);
+    }
+    slot->key = key;
+    slot->generation = generation;
+    slot->ruleIndex = ruleIndex;
+}
+
+FlowCacheStats FlowCache::stats() const {
+    FlowCacheStats s;
+    s.lookups = lookups.load(std::memory_order_relaxed);
+    s.hits = hits.load(std::memory_order_relaxed);
+    s.evictions = evictions.load(std::memory_order_relaxed);
+    s.occupancy = occupied.load(std::memory_order_relaxed);
+    s.capacity = capacity();
+    return s;
+}
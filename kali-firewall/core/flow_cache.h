@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "flow_key.h"
+
+// Counters of one FlowCache, or of several added together.
+struct FlowCacheStats {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t evictions = 0;   // Live entries overwritten to make room
+    uint64_t occupancy = 0;   // Entries valid for the current generation
+    uint64_t capacity = 0;
+};
+
+// Fixed-size flow -> rule index cache in front of the classifier.
+//
+// Open addressing: a flow lives in one of PROBE_LIMIT consecutive slots after
+// its home slot; when all of them are taken a live entry is evicted. Every
+// entry is stamped with the rule-set generation it was classified under, so
+// bumping the generation invalidates the whole cache without touching it.
+//
+// Not thread-safe: meant to be owned by one thread. The counters are relaxed
+// atomics so another thread may read them while the owner works.
+class FlowCache {
+public:
+    static constexpr int MISS = -2;   // Distinct from RuleClassifier::NO_MATCH
+    static constexpr size_t PROBE_LIMIT = 4;
+
+    // `capacity` is rounded up to a power of two; 0 disables the cache.
+    explicit FlowCache(size_t capacity = 0);
+
+    // Rule index cached for `key` under `generation` (NO_MATCH included), or MISS.
+    int find(const FlowKey& key, size_t hash, uint64_t generation) {
+        if (!entries) return MISS;
+        bump(lookups);
+        for (size_t i = 0; i < PROBE_LIMIT; ++i) {
+            const Entry& e = entries[(hash + i) & mask];
+            if (e.generation == generation && e.key == key) {
+                bump(hits);
+                return e.ruleIndex;
+            }
+        }
+        return MISS;
+    }
+
+    void insert(const FlowKey& key, size_t hash, uint64_t generation, int ruleIndex);
+
+    size_t capacity() const { return entries ? mask + 1 : 0; }
+    FlowCacheStats stats() const;
+
+private:
+    struct Entry {
+        FlowKey key;
+        uint64_t generation = 0;   // 0: never used (generations start at 1)
+        int ruleIndex = MISS;
+    };
+
+    static void bump(std::atomic<uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<Entry[]> entries;
+    size_t mask = 0;
+    uint64_t liveGeneration = 0;   // Generation `occupied` counts for
+    unsigned victim = 0;           // Rotates the evicted probe slot
+
+    std::atomic<uint64_t> lookups{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> occupied{0};
+};
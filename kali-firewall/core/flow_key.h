@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "packet_meta.h"
+
+// Directional 5-tuple identifying a flow.
+struct FlowKey {
+    IpAddr src;
+    IpAddr dst;
+    uint16_t srcPort = 0;
+    uint16_t dstPort = 0;
+    uint8_t protocol = 0;
+
+    static FlowKey of(const PacketMeta& pkt) {
+        FlowKey k;
+        k.src = pkt.src;
+        k.dst = pkt.dst;
+        k.srcPort = pkt.srcPort;
+        k.dstPort = pkt.dstPort;
+        k.protocol = pkt.protocol;
+        return k;
+    }
+
+    bool operator==(const FlowKey& o) const {
+        return srcPort == o.srcPort && dstPort == o.dstPort && protocol == o.protocol
+            && src == o.src && dst == o.dst;
+    }
+    bool operator!=(const FlowKey& o) const { return !(*this == o); }
+
+    size_t hash() const {
+        uint64_t words[4];
+        std::memcpy(words, src.bytes, 16);
+        std::memcpy(words + 2, dst.bytes, 16);
+        uint64_t h = (static_cast<uint64_t>(srcPort) << 32) ^ (static_cast<uint64_t>(dstPort) << 16)
+                   ^ (static_cast<uint64_t>(protocol) << 8) ^ src.family;
+        for (uint64_t w : words) {
+            h ^= w;
+            h *= 0x9e3779b97f4a7c15ull;
+            h ^= h >> 32;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+
+struct FlowKeyHash {
+    size_t operator()(const FlowKey& k) const { return k.hash(); }
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+// Binary IPv4/IPv6 address in network byte order. IPv4 uses the first 4 bytes;
+// the rest stay zero so two addresses can be compared with memcmp.
+struct IpAddr {
+    uint8_t family = 0;     // AF_INET, AF_INET6, or 0 when unset
+    uint8_t bytes[16] = {};
+
+    static IpAddr v4(const void* addr) {
+        IpAddr a;
+        a.family = AF_INET;
+        std::memcpy(a.bytes, addr, 4);
+        return a;
+    }
+
+    static IpAddr v6(const void* addr) {
+        IpAddr a;
+        a.family = AF_INET6;
+        std::memcpy(a.bytes, addr, 16);
+        return a;
+    }
+
+    // Parses a dotted-quad or IPv6 literal. Returns false for anything else.
+    static bool parse(const std::string& text, IpAddr& out) {
+        IpAddr a;
+        if (inet_pton(AF_INET, text.c_str(), a.bytes) == 1) {
+            a.family = AF_INET;
+        } else if (inet_pton(AF_INET6, text.c_str(), a.bytes) == 1) {
+            a.family = AF_INET6;
+        } else {
+            return false;
+        }
+        out = a;
+        return true;
+    }
+
+    size_t length() const { return family == AF_INET6 ? 16 : 4; }
+
+    // Only for display and logging; never needed on the decision path.
+    std::string toString() const {
+        char buf[INET6_ADDRSTRLEN] = "";
+        if (family) inet_ntop(family, bytes, buf, sizeof(buf));
+        return buf;
+    }
+
+    bool operator==(const IpAddr& o) const {
+        return family == o.family && std::memcmp(bytes, o.bytes, sizeof(bytes)) == 0;
+    }
+    bool operator!=(const IpAddr& o) const { return !(*this == o); }
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+
+// Why a packet got its verdict; rendered to the `info` column by the log writer.
+enum class LogReason : uint8_t {
+    None,
+    RuleEngine,
+    DPIEngine
+};
+
+// Fixed-size binary log record. Producers fill it on the packet path without
+// touching the heap; all string formatting happens on the writer thread.
+struct LogRecord {
+    std::time_t timestamp;
+    uint8_t srcAddr[16];   // Network byte order, first 4 bytes used for AF_INET
+    uint8_t dstAddr[16];
+    uint16_t srcPort;
+    uint16_t dstPort;
+    uint8_t family;        // AF_INET / AF_INET6
+    uint8_t protocol;      // IPPROTO_*
+    bool blocked;
+    LogReason reason;
+};
+
+// What a producer does when its ring has no room for another record.
+enum class LogOverflowPolicy {
+    Drop,   // Discard the new record and count it
+    Sample  // Above 3/4 full keep only every Nth record, drop when completely full
+};
+
+// Single-producer/single-consumer ring of LogRecords. The producer is one
+// capture worker, the consumer is the Logger writer thread; neither blocks.
+class LogRing {
+public:
+    explicit LogRing(size_t capacityPow2)
+        : mask(capacityPow2 - 1), records(new LogRecord[capacityPow2]) {}
+
+    // Producer side. Returns false if the record was not queued.
+    bool push(const LogRecord& rec, LogOverflowPolicy policy, unsigned sampleEvery) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t used = h - tail.load(std::memory_order_acquire);
+        if (used > mask) {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        if (policy == LogOverflowPolicy::Sample && sampleEvery > 1 && used >= (mask + 1) / 4 * 3) {
+            if (++sampleCounter % sampleEvery != 0) {
+                sampled.store(sampled.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        records[h & mask] = rec;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Copies up to `max` records into `out`, returns the count.
+    size_t pop(LogRecord* out, size_t max) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t avail = head.load(std::memory_order_acquire) - t;
+        size_t n = avail < max ? avail : max;
+        for (size_t i = 0; i < n; ++i)
+            out[i] = records[(t + i) & mask];
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+    uint64_t sampledCount() const { return sampled.load(std::memory_order_relaxed); }
+
+    // Set by the producer when it goes away; the writer frees the ring once drained.
+    std::atomic<bool> retired{false};
+
+private:
+    const size_t mask;
+    std::unique_ptr<LogRecord[]> records;
+
+    alignas(64) std::atomic<size_t> head{0};   // Written by the producer
+    unsigned sampleCounter = 0;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> sampled{0};
+    alignas(64) std::atomic<size_t> tail{0};   // Written by the consumer
+};
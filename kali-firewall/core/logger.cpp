@@ -1,12 +1,36 @@
 #include "logger.h"
+#include "packet_parser.h"
 #include <iostream>
 #include <sstream>
+#include <chrono>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+namespace {
+constexpr int WRITER_INTERVAL_MS = 100; // Max time a record waits in its ring
+constexpr size_t WRITER_BATCH = 512;    // Records popped per ring per pass
+
+const char* reasonText(LogReason reason) {
+    switch (reason) {
+        case LogReason::RuleEngine: return "Blocked by RuleEngine";
+        case LogReason::DPIEngine: return "Blocked by DPIEngine";
+        default: return "";
+    }
+}
+}
 
 Logger::Logger()
-    : db(nullptr), initialized(false)
+    : db(nullptr), initialized(false), retiredDropped(0), retiredSampled(0),
+      policy(LogOverflowPolicy::Drop), sampleRate(16), echoStdout(true),
+      writerRunning(false), insertStmt(nullptr)
 {}
 
 Logger::~Logger() {
+    stopWriter();
+    if (insertStmt) {
+        sqlite3_finalize(insertStmt);
+        insertStmt = nullptr;
+    }
     if (db) {
         sqlite3_close(db);
         db = nullptr;
@@ -47,7 +71,16 @@ bool Logger::initDB(const std::string& db_path) {
         return false;
     }
 
+    const char* insertSQL =
+        "INSERT INTO logs (timestamp, src_ip, src_port, dst_ip, dst_port, protocol, action, info) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+    if (sqlite3_prepare_v2(db, insertSQL, -1, &insertStmt, nullptr) != SQLITE_OK) {
+        std::cerr << "[Logger] Failed to prepare insert: " << sqlite3_errmsg(db) << std::endl;
+        insertStmt = nullptr;
+    }
+
     initialized = true;
+    startWriter();
     return true;
 }
 
@@ -124,4 +157,161 @@ void Logger::clearLogs() {
         std::cerr << "[Logger] Failed to clear logs: " << errMsg << std::endl;
         sqlite3_free(errMsg);
     }
-}
\ No newline at end of file
+}
+
+// --- ASYNCHRONOUS PACKET LOG PIPELINE ---
+
+LogRing* Logger::createProducer(size_t capacity) {
+    size_t pow2 = 64;
+    while (pow2 < capacity) pow2 <<= 1;
+    std::lock_guard<std::mutex> lock(ringsMtx);
+    rings.push_back(std::make_unique<LogRing>(pow2));
+    return rings.back().get();
+}
+
+void Logger::releaseProducer(LogRing* ring) {
+    if (!ring) return;
+    // The writer drains whatever is left and frees the ring. Without a writer
+    // nothing would ever drain it, so free it right away.
+    if (writerRunning) {
+        ring->retired = true;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(ringsMtx);
+    for (auto it = rings.begin(); it != rings.end(); ++it) {
+        if (it->get() == ring) {
+            retiredDropped += ring->droppedCount();
+            retiredSampled += ring->sampledCount();
+            rings.erase(it);
+            break;
+        }
+    }
+}
+
+void Logger::setOverflowPolicy(LogOverflowPolicy newPolicy, unsigned sampleEvery) {
+    policy = newPolicy;
+    sampleRate = sampleEvery ? sampleEvery : 1;
+}
+
+uint64_t Logger::droppedRecords() {
+    std::lock_guard<std::mutex> lock(ringsMtx);
+    uint64_t total = retiredDropped;
+    for (const auto& ring : rings) total += ring->droppedCount();
+    return total;
+}
+
+uint64_t Logger::sampledRecords() {
+    std::lock_guard<std::mutex> lock(ringsMtx);
+    uint64_t total = retiredSampled;
+    for (const auto& ring : rings) total += ring->sampledCount();
+    return total;
+}
+
+void Logger::startWriter() {
+    if (writerRunning) return;
+    writerRunning = true;
+    writer = std::thread(&Logger::writerLoop, this);
+}
+
+void Logger::stopWriter() {
+    {
+        std::lock_guard<std::mutex> lock(writerMtx);
+        if (!writerRunning) return;
+        writerRunning = false;
+    }
+    writerCv.notify_all();
+    if (writer.joinable())
+        writer.join();
+}
+
+void Logger::writerLoop() {
+    std::vector<LogRecord> batch(WRITER_BATCH);
+    bool keepRunning = true;
+    while (keepRunning) {
+        {
+            std::unique_lock<std::mutex> lock(writerMtx);
+            writerCv.wait_for(lock, std::chrono::milliseconds(WRITER_INTERVAL_MS),
+                              [this] { return !writerRunning; });
+            keepRunning = writerRunning;
+        }
+
+        // Only this thread removes rings, so the pointers stay valid after unlocking.
+        std::vector<LogRing*> active;
+        {
+            std::lock_guard<std::mutex> lock(ringsMtx);
+            for (const auto& ring : rings) active.push_back(ring.get());
+        }
+        for (LogRing* ring : active) {
+            size_t n;
+            while ((n = ring->pop(batch.data(), batch.size())) > 0)
+                writeRecords(batch.data(), n);
+        }
+
+        std::lock_guard<std::mutex> lock(ringsMtx);
+        for (auto it = rings.begin(); it != rings.end();) {
+            LogRing* ring = it->get();
+            if (ring->retired && ring->empty()) {
+                retiredDropped += ring->droppedCount();
+                retiredSampled += ring->sampledCount();
+                it = rings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+void Logger::writeRecords(const LogRecord* recs, size_t count) {
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    char timebuf[32] = "";
+    std::time_t lastTime = -1;
+    std::ostringstream echo;
+    bool doEcho = echoStdout;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    bool toDB = initialized && db && insertStmt;
+    if (toDB) sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+
+    for (size_t i = 0; i < count; ++i) {
+        const LogRecord& rec = recs[i];
+        if (rec.timestamp != lastTime) {
+            struct tm tmBuf;
+            localtime_r(&rec.timestamp, &tmBuf);
+            std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &tmBuf);
+            lastTime = rec.timestamp;
+        }
+        src[0] = dst[0] = '\0';
+        if (rec.family) {
+            inet_ntop(rec.family, rec.srcAddr, src, sizeof(src));
+            inet_ntop(rec.family, rec.dstAddr, dst, sizeof(dst));
+        }
+        char protoBuf[8];
+        const char* protocol = protocolName(rec.protocol, protoBuf, sizeof(protoBuf));
+        const char* action = rec.blocked ? "block" : "allow";
+        const char* info = reasonText(rec.reason);
+
+        if (doEcho) {
+            echo << "[PACKET] " << src << ":" << rec.srcPort << " -> "
+                 << dst << ":" << rec.dstPort << " proto: " << protocol
+                 << " action: " << action << " info: " << info << '\n';
+        }
+
+        if (toDB) {
+            sqlite3_bind_text(insertStmt, 1, timebuf, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(insertStmt, 2, src, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(insertStmt, 3, rec.srcPort);
+            sqlite3_bind_text(insertStmt, 4, dst, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(insertStmt, 5, rec.dstPort);
+            sqlite3_bind_text(insertStmt, 6, protocol, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(insertStmt, 7, action, -1, SQLITE_STATIC);
+            sqlite3_bind_text(insertStmt, 8, info, -1, SQLITE_STATIC);
+            if (sqlite3_step(insertStmt) != SQLITE_DONE) {
+                std::cerr << "[Logger] Failed to insert log: " << sqlite3_errmsg(db) << std::endl;
+            }
+            sqlite3_reset(insertStmt);
+        }
+    }
+
+    if (toDB) sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (doEcho) std::cout << echo.str() << std::flush;
+}
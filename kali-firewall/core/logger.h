@@ -2,7 +2,12 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 #include <sqlite3.h>
+#include "log_ring.h"
 
 struct LogEntry {
     std::string timestamp;
@@ -31,8 +36,41 @@ public:
     std::vector<LogEntry> getLogs(int limit = 100, int offset = 0);
     void clearLogs();
 
+    // --- Asynchronous packet log pipeline ---
+    // Each capture worker gets its own ring; a writer thread started by
+    // initDB() drains all rings and writes the records in one transaction.
+    LogRing* createProducer(size_t capacity = 4096);
+    void releaseProducer(LogRing* ring);
+    void setOverflowPolicy(LogOverflowPolicy policy, unsigned sampleEvery = 16);
+    LogOverflowPolicy overflowPolicy() const { return policy; }
+    unsigned sampleEvery() const { return sampleRate; }
+    void setEchoToStdout(bool enabled) { echoStdout = enabled; }
+
+    // Records lost to full rings / skipped by sampling, over all producers.
+    uint64_t droppedRecords();
+    uint64_t sampledRecords();
+
 private:
+    void startWriter();
+    void stopWriter();
+    void writerLoop();
+    void writeRecords(const LogRecord* recs, size_t count);
+
     sqlite3* db;
     bool initialized;
     std::mutex mtx;
+
+    std::mutex ringsMtx;
+    std::vector<std::unique_ptr<LogRing>> rings;
+    uint64_t retiredDropped;
+    uint64_t retiredSampled;
+    std::atomic<LogOverflowPolicy> policy;
+    std::atomic<unsigned> sampleRate;
+    std::atomic<bool> echoStdout;
+
+    std::thread writer;
+    std::atomic<bool> writerRunning;
+    std::mutex writerMtx;
+    std::condition_variable writerCv;
+    sqlite3_stmt* insertStmt;
 };
\ No newline at end of file
@@ -0,0 +1,301 @@
+#include "nft_offload.h"
+#include "rule_engine.h"
+#include "dpi_engine.h"
+#include <QProcess>
+#include <QDebug>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <cstdio>
+#include <set>
+#include <vector>
+
+namespace {
+// One kernel-side match derived from a rule. A rule becomes several of these
+// when it spans both families or when protocols with and without ports have
+// to be told apart (the parser only reads TCP and UDP ports; everything else
+// is matched with ports 0).
+struct Element {
+    int family;          // AF_INET / AF_INET6
+    bool anyFamily;      // The rule gave no address; emitted once per family
+    bool ports;          // Keyed on sport . dport too (TCP/UDP only)
+    std::string src, dst, proto, sport, dport;
+    bool srcAny, dstAny, protoAny;
+};
+
+std::string address(int family, const uint32_t* net, uint8_t prefix) {
+    if (prefix == 0) return family == AF_INET ? "0.0.0.0/0" : "::/0";
+    char buf[INET6_ADDRSTRLEN];
+    inet_ntop(family, net, buf, sizeof(buf));
+    return std::string(buf) + "/" + std::to_string(prefix);
+}
+
+std::string portRange(uint16_t lo, uint16_t hi) {
+    return lo == hi ? std::to_string(lo) : std::to_string(lo) + "-" + std::to_string(hi);
+}
+
+void expand(const CompiledRule& r, std::vector<Element>& out) {
+    bool anyPorts = r.srcPortLo == 0 && r.srcPortHi == 0xffff && r.dstPortLo == 0 && r.dstPortHi == 0xffff;
+    // Packets without ports carry 0 in both fields.
+    bool portlessMatch = r.srcPortLo == 0 && r.dstPortLo == 0;
+
+    for (int family : {AF_INET, AF_INET6}) {
+        if (r.family && r.family != family) continue;
+        Element e;
+        e.family = family;
+        e.anyFamily = r.family == 0;
+        e.src = address(family, r.srcNet, r.srcPrefix);
+        e.dst = address(family, r.dstNet, r.dstPrefix);
+        e.srcAny = r.srcPrefix == 0;
+        e.dstAny = r.dstPrefix == 0;
+        e.sport = portRange(r.srcPortLo, r.srcPortHi);
+        e.dport = portRange(r.dstPortLo, r.dstPortHi);
+
+        auto add = [&](bool ports, const std::string& proto, bool protoAny) {
+            Element x = e;
+            x.ports = ports;
+            x.proto = proto;
+            x.protoAny = protoAny;
+            out.push_back(x);
+        };
+        if (anyPorts) {
+            add(false, r.protocol >= 0 ? std::to_string(r.protocol) : "0-255", r.protocol < 0);
+        } else if (r.protocol == IPPROTO_TCP || r.protocol == IPPROTO_UDP) {
+            add(true, std::to_string(r.protocol), false);
+        } else if (r.protocol >= 0) {
+            if (portlessMatch) add(false, std::to_string(r.protocol), false);
+        } else {
+            add(true, std::to_string(IPPROTO_TCP), false);
+            add(true, std::to_string(IPPROTO_UDP), false);
+            if (portlessMatch) {
+                // Every protocol but TCP (6) and UDP (17)
+                add(false, "0-5", false);
+                add(false, "7-16", false);
+                add(false, "18-255", false);
+            }
+        }
+    }
+}
+
+const char* familyKeyword(int family) {
+    return family == AF_INET ? "ip" : "ip6";
+}
+
+std::string lookupExpr(int family, bool ports) {
+    std::string f = familyKeyword(family);
+    std::string expr = f + " saddr . " + f + " daddr . meta l4proto";
+    if (ports) expr += " . th sport . th dport";
+    return expr;
+}
+
+std::string setType(int family, bool ports) {
+    std::string addr = family == AF_INET ? "ipv4_addr" : "ipv6_addr";
+    std::string type = addr + " . " + addr + " . inet_proto";
+    if (ports) type += " . inet_service . inet_service";
+    return type;
+}
+
+std::string elementKey(const Element& e) {
+    std::string key = e.src + " . " + e.dst + " . " + e.proto;
+    if (e.ports) key += " . " + e.sport + " . " + e.dport;
+    return key;
+}
+
+// Stand-alone match for the one-rule-per-line fallback; wildcards are left out.
+std::string elementMatch(const Element& e) {
+    std::string f = familyKeyword(e.family);
+    std::string m;
+    if (!e.srcAny) m += f + " saddr " + e.src + " ";
+    if (!e.dstAny) m += f + " daddr " + e.dst + " ";
+    // "0.0.0.0/0" still limits the rule to its family.
+    if (e.srcAny && e.dstAny && !e.anyFamily) m += std::string("meta nfproto ") + (e.family == AF_INET ? "ipv4 " : "ipv6 ");
+    if (!e.protoAny) m += "meta l4proto " + e.proto + " ";
+    if (e.ports) {
+        if (e.sport != "0-65535") m += "th sport " + e.sport + " ";
+        if (e.dport != "0-65535") m += "th dport " + e.dport + " ";
+    }
+    return m;
+}
+}
+
+NftOffload::NftOffload(RuleEngine* rules, DPIEngine* dpi, QObject* parent)
+    : QObject(parent), ruleEngine(rules), dpiEngine(dpi) {}
+
+NftOffload::~NftOffload() {
+    if (nft) {
+        nft->disconnect(this);
+        nft->kill();
+        nft->waitForFinished(1000);
+    }
+    if (enabled) removeTable();
+}
+
+void NftOffload::setEnabled(bool on) {
+    if (enabled == on) return;
+    enabled = on;
+    if (enabled)
+        sync();
+    else
+        removeTable();
+}
+
+void NftOffload::setFlowMarks(uint32_t allow, uint32_t mask) {
+    allowMark = allow;
+    markMask = mask;
+}
+
+std::string NftOffload::compile(const CompiledRule* rules, size_t count, const NftOffloadOptions& options,
+                                NftOffloadSummary* summary) {
+    NftOffloadSummary sum;
+    char markBuf[96];
+    std::snprintf(markBuf, sizeof(markBuf), "meta mark set meta mark and 0x%08x or 0x%x accept",
+                  ~options.markMask, options.allowMark & options.markMask);
+    auto verdictOf = [&](RuleVerdict v) -> std::string {
+        if (v == RuleVerdict::Block) return "drop";
+        return options.queueAllows ? "return" : markBuf;
+    };
+
+    std::string sets;
+    std::string chain;
+    // Non-first fragments have no ports for the parser; leave them to userspace.
+    chain += "        ip frag-off & 0x1fff != 0 return\n";
+
+    size_t i = 0;
+    int run = 0;
+    while (i < count) {
+        // A run: consecutive rules with the same verdict (invalid rules never
+        // match and are skipped). Inside it, which rule matches first does
+        // not change the outcome.
+        while (i < count && !rules[i].valid) ++i;
+        if (i == count) break;
+        RuleVerdict verdict = rules[i].verdict;
+        std::vector<Element> elements;
+        for (; i < count && (!rules[i].valid || rules[i].verdict == verdict); ++i) {
+            if (!rules[i].valid) continue;
+            size_t before = elements.size();
+            expand(rules[i], elements);
+            if (!options.useSets) {
+                std::set<std::string> lines;
+                for (size_t k = before; k < elements.size(); ++k) {
+                    std::string line = elementMatch(elements[k]) + verdictOf(verdict);
+                    if (lines.insert(line).second) chain += "        " + line + "\n";
+                }
+            }
+            ++sum.rules;
+        }
+        if (options.useSets) {
+            for (int family : {AF_INET, AF_INET6}) {
+                for (bool ports : {false, true}) {
+                    std::set<std::string> keys;
+                    for (const Element& e : elements) {
+                        if (e.family == family && e.ports == ports) keys.insert(elementKey(e));
+                    }
+                    if (keys.empty()) continue;
+                    std::string name = "r" + std::to_string(run) + (family == AF_INET ? "_v4" : "_v6") + (ports ? "p" : "");
+                    sets += "    set " + name + " {\n        type " + setType(family, ports) +
+                            "\n        flags interval\n        elements = {\n";
+                    size_t n = 0;
+                    for (const std::string& key : keys)
+                        sets += "            " + key + (++n < keys.size() ? ",\n" : "\n");
+                    sets += "        }\n    }\n";
+                    chain += "        " + lookupExpr(family, ports) + " @" + name + " " + verdictOf(verdict) + "\n";
+                    ++sum.sets;
+                    sum.elements += static_cast<int>(keys.size());
+                }
+            }
+        } else {
+            sum.elements += static_cast<int>(elements.size());
+        }
+        ++run;
+    }
+    if (options.defaultDrop) {
+        chain += "        drop\n";
+        sum.defaultDrop = true;
+    }
+
+    // Declaring and deleting first makes the replace work whether or not the
+    // table exists, all inside the one transaction.
+    std::string table = std::string("inet ") + TABLE;
+    std::string script = "table " + table + "\ndelete table " + table + "\n";
+    script += "table " + table + " {\n" + sets;
+    script += "    chain rules {\n" + chain + "    }\n";
+    // Ahead of the iptables filter chains (priority 0) that hold FW_FASTPATH and NFQUEUE.
+    script += "    chain input {\n        type filter hook input priority filter - 10; policy accept;\n"
+              "        jump rules\n    }\n";
+    script += "    chain output {\n        type filter hook output priority filter - 10; policy accept;\n"
+              "        jump rules\n    }\n";
+    script += "}\n";
+    if (summary) *summary = sum;
+    return script;
+}
+
+void NftOffload::sync() {
+    if (!enabled || !ruleEngine) return;
+    if (nft) {
+        syncPending = true;
+        return;
+    }
+    attemptRules = ruleEngine->compiledRules();
+    attemptOptions = NftOffloadOptions();
+    attemptOptions.queueAllows = dpiEngine && dpiEngine->requiredCopyRange() > 0;
+    attemptOptions.defaultDrop = !ruleEngine->isInteractiveMode();
+    attemptOptions.allowMark = allowMark;
+    attemptOptions.markMask = markMask;
+    attemptWithSets = true;
+    runNft(compile(attemptRules.constData(), static_cast<size_t>(attemptRules.size()), attemptOptions, &attemptSummary),
+           true);
+}
+
+void NftOffload::runNft(const std::string& script, bool withSets) {
+    attemptWithSets = withSets;
+    nft = new QProcess(this);
+    connect(nft, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [this](int exitCode, QProcess::ExitStatus status) {
+        onNftFinished(status == QProcess::NormalExit ? exitCode : -1);
+    });
+    connect(nft, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart) return; // finished() follows for the others
+        qWarning() << "[NftOffload] Could not run nft; all traffic stays queued";
+        nft->deleteLater();
+        nft = nullptr;
+        syncPending = false;
+        emit offloadChanged(0, attemptRules.size());
+    });
+    nft->start("nft", {"-f", "-"});
+    nft->write(script.data(), static_cast<qint64>(script.size()));
+    nft->closeWriteChannel();
+}
+
+void NftOffload::onNftFinished(int exitCode) {
+    QByteArray err = nft->readAllStandardError();
+    nft->deleteLater();
+    nft = nullptr;
+
+    if (exitCode == 0) {
+        qInfo() << "[NftOffload]" << attemptSummary.rules << "of" << attemptRules.size() << "rules offloaded in"
+                << attemptSummary.sets << "sets," << attemptSummary.elements << "elements";
+        emit offloadChanged(attemptSummary.rules, attemptRules.size());
+    } else if (attemptWithSets) {
+        // Most likely a kernel without concatenated interval sets or set
+        // elements it rejects as overlapping: try plain rules.
+        qWarning() << "[NftOffload] nft rejected the set ruleset, retrying with plain rules:" << err.trimmed();
+        NftOffloadOptions plain = attemptOptions;
+        plain.useSets = false;
+        runNft(compile(attemptRules.constData(), static_cast<size_t>(attemptRules.size()), plain, &attemptSummary),
+               false);
+        return;
+    } else {
+        qWarning() << "[NftOffload] nft failed, removing the offload table:" << err.trimmed();
+        removeTable();
+        emit offloadChanged(0, attemptRules.size());
+    }
+
+    if (syncPending) {
+        syncPending = false;
+        sync();
+    }
+}
+
+void NftOffload::removeTable() {
+    // Synchronous: callers rely on the kernel no longer deciding anything.
+    QProcess::execute("nft", {"delete", "table", "inet", TABLE});
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+#include <cstdint>
+#include <string>
+#include "compiled_rule.h"
+
+class QProcess;
+class RuleEngine;
+class DPIEngine;
+
+// What the offload compiler may hand to the kernel.
+struct NftOffloadOptions {
+    bool useSets = true;           // Group rules into interval sets; false: one nft rule per rule
+    bool queueAllows = false;      // Allowed traffic still needs userspace (DPI is active)
+    bool defaultDrop = false;      // No rule matched -> drop (false: queue, e.g. interactive mode)
+    uint32_t allowMark = 0x1;      // nfmark bits FW_FASTPATH accepts (see PacketCapture::setFlowMarking)
+    uint32_t markMask = 0x3;
+};
+
+struct NftOffloadSummary {
+    int rules = 0;        // Valid rules compiled into the kernel
+    int sets = 0;
+    int elements = 0;
+    bool defaultDrop = false;
+};
+
+// Mirrors RuleEngine's rule list into an nftables table so that packets the
+// rules decide on their own never reach the NFQUEUE.
+//
+// The rule list is cut into runs of consecutive rules with the same verdict.
+// Within a run order does not matter, so each run becomes one interval set
+// per family keyed by saddr . daddr . l4proto (. sport . dport), looked up
+// from one chain in list order: first match wins exactly as in RuleEngine.
+// Drops are final in the kernel. Accepts set the allow bits in the nfmark so
+// FW_FASTPATH (scripts/setup_iptables.sh) accepts the packet before the
+// NFQUEUE rule; while DPI is active they return instead and the packet is
+// queued as before. Unmatched packets are dropped unless in interactive mode.
+//
+// The whole table is replaced by one `nft -f -` run, which nftables applies
+// as a single netlink transaction. If that fails the table is deleted, so once
+// a sync has finished the kernel holds either exactly the current rules or
+// nothing (everything is queued, as without offload). Packets decided in the
+// kernel are not seen by RuleEngine::ruleStats().
+class NftOffload : public QObject {
+    Q_OBJECT
+public:
+    static constexpr const char* TABLE = "kali_firewall";   // In family inet
+
+    NftOffload(RuleEngine* rules, DPIEngine* dpi, QObject* parent = nullptr);
+    ~NftOffload();   // Deletes the table
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+    // Must match PacketCapture::setFlowMarking and FW_FASTPATH.
+    void setFlowMarks(uint32_t allowMark, uint32_t mask);
+
+    // The nft script replacing the table with `rules`.
+    static std::string compile(const CompiledRule* rules, size_t count, const NftOffloadOptions& options,
+                               NftOffloadSummary* summary = nullptr);
+
+public slots:
+    // Recompile from the rule engine and replace the table. Connect to
+    // everything that changes a decision: rule edits, the interactive mode
+    // toggle and DPI signature edits. Runs coalesce: a request made while
+    // nft is busy is applied once it has finished.
+    void sync();
+
+signals:
+    // After each attempt; `offloadedRules` is 0 if the table was removed.
+    void offloadChanged(int offloadedRules, int totalRules);
+
+private:
+    void runNft(const std::string& script, bool withSets);
+    void onNftFinished(int exitCode);
+    void removeTable();
+
+    RuleEngine* ruleEngine;
+    DPIEngine* dpiEngine;
+    bool enabled = false;
+    uint32_t allowMark = 0x1;
+    uint32_t markMask = 0x3;
+
+    QProcess* nft = nullptr;      // Running `nft -f -`, if any
+    bool syncPending = false;     // sync() was called while nft was running
+    bool attemptWithSets = true;
+    QVector<CompiledRule> attemptRules;
+    NftOffloadOptions attemptOptions;
+    NftOffloadSummary attemptSummary;
+};
@@ -2,111 +2,495 @@
 #include "rule_engine.h"
 #include "dpi_engine.h"
 #include "logger.h"
+#include "packet_parser.h"
+#include <QTimer>
+#include <QProcess>
+#include <QDebug>
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <atomic>
 #include <csignal>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <netinet/ip.h>
-#include <netinet/tcp.h>
-#include <netinet/udp.h>
 #include <ctime>
 #include <linux/netfilter.h> // For NF_DROP, NF_ACCEPT
 #include <sys/resource.h>    // For getrusage
+#include <pthread.h>         // For pthread_setaffinity_np
+#include <sched.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 namespace {
 constexpr size_t DEFAULT_BUF_SIZE = 0x10000; // 64KB
+constexpr uint32_t MAX_COPY_RANGE = 0xffff;
+// Netlink and NFQUEUE attribute headers in front of the packet copy; a receive
+// buffer must fit one message at the largest copy range or it gets truncated.
+constexpr size_t NFQ_MSG_OVERHEAD = 0x1000;
+constexpr int IDLE_POLL_MS = 200;            // How often an idle worker rechecks `running`
+constexpr int DEFAULT_STATS_INTERVAL_MS = 250;
+// Bound on packets held for interactive decisions; past it they are dropped
+// (TCP retransmits once the user has answered).
+constexpr size_t MAX_HELD_PER_FLOW = 64;
+constexpr size_t MAX_HELD_PER_WORKER = 1024;
+
+qint64 monotonicMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-static std::string protoName(uint8_t proto) {
-    switch (proto) {
-        case IPPROTO_TCP: return "TCP";
-        case IPPROTO_UDP: return "UDP";
-        case IPPROTO_ICMP: return "ICMP";
-        default: return std::to_string(proto);
-    }
+LogRecord logRecordOf(const PacketMeta& pkt, bool blocked, LogReason reason) {
+    LogRecord rec{};
+    rec.timestamp = std::time(nullptr);
+    rec.family = pkt.src.family;
+    std::memcpy(rec.srcAddr, pkt.src.bytes, sizeof(rec.srcAddr));
+    std::memcpy(rec.dstAddr, pkt.dst.bytes, sizeof(rec.dstAddr));
+    rec.protocol = pkt.protocol;
+    rec.srcPort = pkt.srcPort;
+    rec.dstPort = pkt.dstPort;
+    rec.blocked = blocked;
+    rec.reason = reason;
+    return rec;
+}
 }
 
 PacketCapture::PacketCapture()
-    : nfqHandle(nullptr), queueHandle(nullptr), fd(-1), running(false), ruleEngine(nullptr), dpiEngine(nullptr),
-      totalPackets(0), blockedPackets(0) {}
+    : running(false), batchSize(1), flushTimeoutMs(0), targetCopyRange(HEADER_COPY_RANGE),
+      dpiActive(false), flowMarking(false), allowMark(0x1), dropMark(0x2), markMask(0x3), connmarkMask(0xf), markLoopWarned(false),
+      queueMaxLen(0), socketRcvBuf(0), failOpen(false), gsoQueueing(false), flowMarkTimer(new QTimer(this)),
+      statsTimer(new QTimer(this)), lastStatsMs(0),
+      ruleEngine(nullptr), dpiEngine(nullptr)
+{
+    connect(statsTimer, &QTimer::timeout, this, &PacketCapture::publishStats);
+    statsTimer->start(DEFAULT_STATS_INTERVAL_MS);
+    flowMarkTimer->setSingleShot(true);
+    flowMarkTimer->setInterval(FLOW_MARK_CLEAR_DELAY_MS);
+    connect(flowMarkTimer, &QTimer::timeout, this, &PacketCapture::flushFlowMarks);
+}
 
 PacketCapture::~PacketCapture() {
     stop();
 }
 
 bool PacketCapture::init(uint16_t queue_num, size_t buf_size) {
+    return initQueues(queue_num, 1, buf_size, false);
+}
+
+bool PacketCapture::initQueues(uint16_t first_queue, uint16_t num_queues, size_t buf_size, bool pin_workers) {
     std::lock_guard<std::mutex> lock(mtx);
 
     if (running) {
         std::cerr << "[PacketCapture] Already running, stop first.\n";
         return false;
     }
-
-    nfqHandle = nfq_open();
-    if (!nfqHandle) {
-        std::cerr << "[PacketCapture] nfq_open() failed\n";
+    if (num_queues == 0) {
+        std::cerr << "[PacketCapture] At least one queue is required\n";
         return false;
     }
 
-    if (nfq_unbind_pf(nfqHandle, AF_INET) < 0) {
-        std::cerr << "[PacketCapture] nfq_unbind_pf() failed\n";
-        nfq_close(nfqHandle);
-        nfqHandle = nullptr;
+    for (auto& w : workers) closeQueue(*w);
+    workers.clear();
+
+    unsigned cpus = std::thread::hardware_concurrency();
+    for (uint16_t i = 0; i < num_queues; ++i) {
+        auto w = std::make_unique<QueueWorker>();
+        w->owner = this;
+        w->queueNum = static_cast<uint16_t>(first_queue + i);
+        w->cpu = (pin_workers && cpus > 0) ? static_cast<int>(i % cpus) : -1;
+        w->buffer.assign(std::max(buf_size ? buf_size : DEFAULT_BUF_SIZE,
+                                  MAX_COPY_RANGE + NFQ_MSG_OVERHEAD), 0);
+        if (!openQueue(*w)) {
+            for (auto& opened : workers) closeQueue(*opened);
+            workers.clear();
+            return false;
+        }
+        workers.push_back(std::move(w));
+    }
+    return true;
+}
+
+bool PacketCapture::openQueue(QueueWorker& w) {
+    w.nfqHandle = nfq_open();
+    if (!w.nfqHandle) {
+        std::cerr << "[PacketCapture] nfq_open() failed for queue " << w.queueNum << "\n";
         return false;
     }
 
-    if (nfq_bind_pf(nfqHandle, AF_INET) < 0) {
-        std::cerr << "[PacketCapture] nfq_bind_pf() failed\n";
-        nfq_close(nfqHandle);
-        nfqHandle = nullptr;
+    // Queue IPv4 and IPv6 alike; the parser handles both.
+    for (uint16_t family : {AF_INET, AF_INET6}) {
+        if (nfq_unbind_pf(w.nfqHandle, family) < 0) {
+            std::cerr << "[PacketCapture] nfq_unbind_pf(" << family << ") failed\n";
+            closeQueue(w);
+            return false;
+        }
+
+        if (nfq_bind_pf(w.nfqHandle, family) < 0) {
+            std::cerr << "[PacketCapture] nfq_bind_pf(" << family << ") failed\n";
+            closeQueue(w);
+            return false;
+        }
+    }
+
+    w.queueHandle = nfq_create_queue(w.nfqHandle, w.queueNum, &PacketCapture::internalCallback, &w);
+    if (!w.queueHandle) {
+        std::cerr << "[PacketCapture] nfq_create_queue() failed for queue " << w.queueNum << "\n";
+        closeQueue(w);
         return false;
     }
 
-    queueHandle = nfq_create_queue(nfqHandle, queue_num, &PacketCapture::internalCallback, this);
-    if (!queueHandle) {
-        std::cerr << "[PacketCapture] nfq_create_queue() failed\n";
-        nfq_close(nfqHandle);
-        nfqHandle = nullptr;
+    if (!applyCopyRange(w)) {
+        closeQueue(w);
         return false;
     }
 
-    if (nfq_set_mode(queueHandle, NFQNL_COPY_PACKET, 0xffff) < 0) {
-        std::cerr << "[PacketCapture] nfq_set_mode() failed\n";
-        nfq_destroy_queue(queueHandle);
-        queueHandle = nullptr;
-        nfq_close(nfqHandle);
-        nfqHandle = nullptr;
+    if (queueMaxLen && nfq_set_queue_maxlen(w.queueHandle, queueMaxLen) < 0) {
+        std::cerr << "[PacketCapture] nfq_set_queue_maxlen(" << queueMaxLen << ") failed for queue "
+                  << w.queueNum << "\n";
+    }
+    if (failOpen && nfq_set_queue_flags(w.queueHandle, NFQA_CFG_F_FAIL_OPEN, NFQA_CFG_F_FAIL_OPEN) < 0) {
+        std::cerr << "[PacketCapture] Kernel does not support fail-open for queue " << w.queueNum << "\n";
+    }
+    if (gsoQueueing && nfq_set_queue_flags(w.queueHandle, NFQA_CFG_F_GSO, NFQA_CFG_F_GSO) < 0) {
+        std::cerr << "[PacketCapture] Kernel does not support GSO queueing for queue " << w.queueNum << "\n";
+    }
+
+    w.fd = nfq_fd(w.nfqHandle);
+    if (socketRcvBuf > 0) {
+        // SO_RCVBUFFORCE (root) ignores net.core.rmem_max; fall back to SO_RCVBUF.
+        if (setsockopt(w.fd, SOL_SOCKET, SO_RCVBUFFORCE, &socketRcvBuf, sizeof(socketRcvBuf)) < 0 &&
+            setsockopt(w.fd, SOL_SOCKET, SO_RCVBUF, &socketRcvBuf, sizeof(socketRcvBuf)) < 0) {
+            std::cerr << "[PacketCapture] Could not set receive buffer for queue " << w.queueNum
+                      << ": " << strerror(errno) << "\n";
+        }
+    }
+    w.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w.wakeFd < 0) {
+        std::cerr << "[PacketCapture] eventfd() failed for queue " << w.queueNum
+                  << ": " << strerror(errno) << "\n";
+        closeQueue(w);
         return false;
     }
+    w.logRing = Logger::instance().createProducer();
+    return true;
+}
 
-    fd = nfq_fd(nfqHandle);
-    bufferSize = buf_size ? buf_size : DEFAULT_BUF_SIZE;
+void PacketCapture::closeQueue(QueueWorker& w) {
+    if (w.logRing) {
+        Logger::instance().releaseProducer(w.logRing);
+        w.logRing = nullptr;
+    }
+    if (w.queueHandle) {
+        nfq_destroy_queue(w.queueHandle);
+        w.queueHandle = nullptr;
+    }
+    if (w.nfqHandle) {
+        nfq_close(w.nfqHandle);
+        w.nfqHandle = nullptr;
+    }
+    if (w.wakeFd >= 0) {
+        close(w.wakeFd);
+        w.wakeFd = -1;
+    }
+    w.fd = -1;
+}
+
+void PacketCapture::refreshCopyRange() {
+    uint32_t range = HEADER_COPY_RANGE;
+    size_t dpiRange = dpiEngine ? dpiEngine->requiredCopyRange() : 0;
+    range = std::max<uint32_t>(range, static_cast<uint32_t>(dpiRange));
+    // A GSO packet holds many segments' worth of payload; copy all of it.
+    if (dpiRange > 0 && gsoQueueing) range = MAX_COPY_RANGE;
+    // Accepts are only final (and may be connmarked) while DPI has nothing to look for.
+    dpiActive = dpiRange > 0;
+    targetCopyRange = range;
+}
+
+bool PacketCapture::applyCopyRange(QueueWorker& w) {
+    uint32_t range = targetCopyRange.load();
+    w.appliedCopyRange = range; // Don't retry a rejected range on every loop iteration
+    if (nfq_set_mode(w.queueHandle, NFQNL_COPY_PACKET, range) < 0) {
+        std::cerr << "[PacketCapture] nfq_set_mode() failed for queue " << w.queueNum
+                  << " (range " << range << ")\n";
+        return false;
+    }
     return true;
 }
 
 void PacketCapture::start() {
     std::lock_guard<std::mutex> lock(mtx);
-    if (running || fd < 0) return;
+    if (running || workers.empty()) return;
     running = true;
-    captureThread = std::thread([this]() {
-        std::vector<char> buf(bufferSize, 0);
-        while (running) {
-            int rv = recv(fd, buf.data(), buf.size(), 0);
+    for (auto& w : workers) {
+        QueueWorker* worker = w.get();
+        worker->thread = std::thread([this, worker]() { captureLoop(*worker); });
+        if (worker->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(worker->cpu, &set);
+            if (pthread_setaffinity_np(worker->thread.native_handle(), sizeof(set), &set) != 0) {
+                std::cerr << "[PacketCapture] Could not pin queue " << worker->queueNum
+                          << " to CPU " << worker->cpu << std::endl;
+            }
+        }
+    }
+}
+
+void PacketCapture::setQueueLimits(uint32_t max_len, int socket_rcvbuf, bool fail_open) {
+    std::lock_guard<std::mutex> lock(mtx);
+    queueMaxLen = max_len;
+    socketRcvBuf = socket_rcvbuf;
+    failOpen = fail_open;
+}
+
+void PacketCapture::setGsoQueueing(bool enabled) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        gsoQueueing = enabled;
+    }
+    refreshCopyRange();
+}
+
+void PacketCapture::setFlowMarking(bool enabled, uint32_t allow_mark, uint32_t drop_mark, uint32_t mask,
+                                   unsigned reply_shift) {
+    uint32_t replyMask = reply_shift > 0 && reply_shift < 32 ? mask << reply_shift : 0;
+    allowMark = allow_mark & mask;
+    dropMark = drop_mark & mask;
+    markMask = mask;
+    connmarkMask = mask | replyMask;
+    // The reply bits must fit next to the original ones
+    bool directional = replyMask && (replyMask >> reply_shift) == mask && !(replyMask & mask);
+    flowMarking = enabled && mask && allowMark != dropMark && directional;
+}
+
+void PacketCapture::setRuleEngine(RuleEngine* re) {
+    ruleEngine = re;
+    markedRules = re ? re->getRules() : QList<Rule>();
+}
+
+void PacketCapture::ruleSetChanged() {
+    flowMarkTimer->start(); // Restarts the delay
+}
+
+void PacketCapture::signatureSetChanged() {
+    forceFlowMarkClear = true;
+    flowMarkTimer->start();
+}
+
+void PacketCapture::interactiveModeChanged() {
+    forceFlowMarkClear = true;
+    flowMarkTimer->start();
+}
+
+void PacketCapture::flushFlowMarks() {
+    bool changed = forceFlowMarkClear;
+    forceFlowMarkClear = false;
+    if (ruleEngine) {
+        QList<Rule> rules = ruleEngine->getRules();
+        if (rules != markedRules) {
+            markedRules = std::move(rules);
+            changed = true;
+        }
+    }
+    if (changed) clearFlowMarks();
+}
+
+void PacketCapture::clearFlowMarks() {
+    if (!flowMarking) return;
+    // In update mode conntrack zeroes the bits in the mask, then XORs in the value.
+    QStringList args = {"-U", "--mark", QString("0/0x%1").arg(connmarkMask.load(), 0, 16)};
+    QProcess* proc = new QProcess(this);
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [proc](int exitCode, QProcess::ExitStatus) {
+        // conntrack exits non-zero when the table is empty; only report real errors
+        QByteArray err = proc->readAllStandardError();
+        if (exitCode != 0 && !err.contains("0 flow entries"))
+            qWarning() << "[PacketCapture] conntrack -U failed:" << err.trimmed();
+        proc->deleteLater();
+    });
+    proc->start("conntrack", args);
+}
+
+void PacketCapture::setVerdictBatching(unsigned batch_size, int flush_timeout_ms) {
+    batchSize = batch_size ? batch_size : 1;
+    flushTimeoutMs = flush_timeout_ms > 0 ? flush_timeout_ms : 0;
+}
+
+void PacketCapture::captureLoop(QueueWorker& w) {
+    struct pollfd pfds[2] = { { w.fd, POLLIN, 0 }, { w.wakeFd, POLLIN, 0 } };
+    while (running) {
+        // Config messages must go out on the worker's own socket, so a new copy
+        // range is picked up here rather than applied from the GUI thread.
+        if (w.appliedCopyRange != targetCopyRange.load(std::memory_order_relaxed))
+            applyCopyRange(w);
+
+        int timeout = IDLE_POLL_MS;
+        if (w.batchCount) {
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - w.batchStart).count();
+            timeout = std::max(0, flushTimeoutMs - static_cast<int>(waited));
+        }
+
+        int pr = poll(pfds, 2, timeout);
+        if (pr < 0 && errno != EINTR) {
+            std::cerr << "[PacketCapture] poll() failed on queue " << w.queueNum
+                      << ": " << strerror(errno) << std::endl;
+            break;
+        }
+        if (pr > 0 && (pfds[1].revents & POLLIN)) {
+            uint64_t wakeups;
+            ssize_t n = read(w.wakeFd, &wakeups, sizeof(wakeups));
+            (void)n;
+            drainInbox(w);
+        }
+
+        // Drain everything already queued so back-to-back accepts share a batch.
+        bool failed = false;
+        while (pr > 0 && running) {
+            int rv = recv(w.fd, w.buffer.data(), w.buffer.size(), MSG_DONTWAIT);
             if (rv >= 0) {
-                int ret = nfq_handle_packet(nfqHandle, buf.data(), rv);
+                int ret = nfq_handle_packet(w.nfqHandle, w.buffer.data(), rv);
                 if (ret < 0) {
                     std::cerr << "[PacketCapture] nfq_handle_packet() error: " << ret << std::endl;
                 }
-            } else if (running) {
-                if (errno == EINTR) continue;
-                std::cerr << "[PacketCapture] recv() failed: " << strerror(errno) << std::endl;
-                break;
+                continue;
             }
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                // The socket buffer overflowed and the kernel dropped (or, with
+                // fail-open, accepted) the packets it could not deliver. Nothing
+                // is left waiting on us, so count it and keep going.
+                bump(w.counters.enobufs);
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "[PacketCapture] recv() failed on queue " << w.queueNum
+                          << ": " << strerror(errno) << std::endl;
+                failed = true;
+            }
+            break;
         }
-    });
+        if (failed) break;
+
+        if (w.batchCount) {
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - w.batchStart).count();
+            if (waited >= flushTimeoutMs) flushBatch(w);
+        }
+    }
+    flushBatch(w);
+
+    // Nobody is left to release them; drop like the default policy.
+    while (!w.held.empty())
+        releaseHeld(w, w.held.begin()->first, true);
+}
+
+bool PacketCapture::holdPacket(QueueWorker& w, const PacketMeta& pkt, uint32_t id) {
+    if (w.heldCount >= MAX_HELD_PER_WORKER) return false;
+    std::vector<QueueWorker::HeldPacket>& packets = w.held[FlowKey::of(pkt)];
+    if (packets.size() >= MAX_HELD_PER_FLOW) return false;
+    // Pending accepts have lower ids; get them out before batching pauses.
+    flushBatch(w);
+    packets.push_back({id, static_cast<uint32_t>(pkt.wireLen), logRecordOf(pkt, true, LogReason::RuleEngine)});
+    ++w.heldCount;
+    bump(w.counters.heldPackets);
+    return true;
+}
+
+void PacketCapture::drainInbox(QueueWorker& w) {
+    std::vector<std::pair<FlowKey, bool>> resolved;
+    {
+        std::lock_guard<std::mutex> lock(w.inboxMutex);
+        resolved.swap(w.inbox);
+    }
+    for (const auto& r : resolved)
+        releaseHeld(w, r.first, r.second);
+}
+
+void PacketCapture::releaseHeld(QueueWorker& w, const FlowKey& flow, bool drop) {
+    auto it = w.held.find(flow);
+    if (it == w.held.end()) return;
+    // The ids are interleaved with other flows' already-answered packets, so a
+    // batch verdict can't express them; send them back to back in one pass.
+    Logger& logger = Logger::instance();
+    for (QueueWorker::HeldPacket& p : it->second) {
+        if (!drop) {
+            // Allowed: back through the hook unmarked. The flow now matches the
+            // rule the user just added, so each packet comes back to the queue
+            // and gets DPI, its log record and its count like any other.
+            nfq_set_verdict(w.queueHandle, p.id, NF_REPEAT, 0, nullptr);
+            continue;
+        }
+        sendVerdict(w, p.id, true);
+        if (w.logRing) {
+            p.rec.timestamp = std::time(nullptr);
+            w.logRing->push(p.rec, logger.overflowPolicy(), logger.sampleEvery());
+        }
+        bump(w.counters.packets);
+        bump(w.counters.bytes, p.wireLen);
+        bump(w.counters.blockedByRule);
+    }
+    w.heldCount -= it->second.size();
+    w.held.erase(it);
+}
+
+void PacketCapture::releaseFlow(const FlowKey& flow, bool block) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto& w : workers) {
+        {
+            std::lock_guard<std::mutex> inboxLock(w->inboxMutex);
+            w->inbox.emplace_back(flow, block);
+        }
+        uint64_t one = 1;
+        ssize_t n = write(w->wakeFd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+int PacketCapture::sendVerdict(QueueWorker& w, uint32_t id, bool drop, uint32_t mark) {
+    if (drop) {
+        // Accepts queued before this packet must not be covered by a later batch
+        // verdict that would also accept it, so flush them first.
+        flushBatch(w);
+        if (mark)
+            return nfq_set_verdict2(w.queueHandle, id, NF_REPEAT, mark, 0, nullptr);
+        return nfq_set_verdict(w.queueHandle, id, NF_DROP, 0, nullptr);
+    }
+
+    uint32_t verdict = mark ? NF_REPEAT : NF_ACCEPT;
+    unsigned limit = batchSize.load(std::memory_order_relaxed);
+    if (limit <= 1 || w.heldCount) {
+        if (mark)
+            return nfq_set_verdict2(w.queueHandle, id, verdict, mark, 0, nullptr);
+        return nfq_set_verdict(w.queueHandle, id, verdict, 0, nullptr);
+    }
+
+    // A batch carries one verdict and one mark for all its packets.
+    if (w.batchCount && (w.batchVerdict != verdict || w.batchMark != mark)) flushBatch(w);
+    if (w.batchCount == 0) {
+        w.batchStart = std::chrono::steady_clock::now();
+        w.batchVerdict = verdict;
+        w.batchMark = mark;
+    }
+    w.batchLastId = id;
+    if (++w.batchCount >= limit) flushBatch(w);
+    return 0;
+}
+
+void PacketCapture::flushBatch(QueueWorker& w) {
+    if (w.batchCount == 0 || !w.queueHandle) return;
+    // Applies to every outstanding packet on this queue with id <= batchLastId.
+    int ret = w.batchMark
+        ? nfq_set_verdict_batch2(w.queueHandle, w.batchLastId, w.batchVerdict, w.batchMark)
+        : nfq_set_verdict_batch(w.queueHandle, w.batchLastId, w.batchVerdict);
+    if (ret < 0) {
+        std::cerr << "[PacketCapture] nfq_set_verdict_batch() failed on queue " << w.queueNum << std::endl;
+    } else {
+        bump(w.counters.verdictSyscallsSaved, w.batchCount - 1);
+    }
+    w.batchCount = 0;
 }
 
 void PacketCapture::stop() {
@@ -115,18 +499,106 @@ void PacketCapture::stop() {
         if (!running) return;
         running = false;
     }
-    if (captureThread.joinable())
-        captureThread.join();
+    for (auto& w : workers) {
+        if (w->thread.joinable())
+            w->thread.join();
+    }
+    for (auto& w : workers) {
+        addCounters(*w, retiredStats);
+        closeQueue(*w);
+    }
+    workers.clear();
+}
+
+void PacketCapture::setStatsInterval(int ms) {
+    statsTimer->start(ms > 0 ? ms : DEFAULT_STATS_INTERVAL_MS);
+}
+
+void PacketCapture::addCounters(const QueueWorker& w, CaptureStats& stats) const {
+    const WorkerCounters& c = w.counters;
+    stats.packets += c.packets.load(std::memory_order_relaxed);
+    stats.bytes += c.bytes.load(std::memory_order_relaxed);
+    stats.blockedByRule += c.blockedByRule.load(std::memory_order_relaxed);
+    stats.blockedByDpi += c.blockedByDpi.load(std::memory_order_relaxed);
+    stats.verdictSyscallsSaved += c.verdictSyscallsSaved.load(std::memory_order_relaxed);
+    stats.enobufsEvents += c.enobufs.load(std::memory_order_relaxed);
+    stats.gsoPackets += c.gsoPackets.load(std::memory_order_relaxed);
+    stats.heldPackets += c.heldPackets.load(std::memory_order_relaxed);
+}
+
+void PacketCapture::addKernelQueueStats(CaptureStats& stats) const {
+    std::ifstream in("/proc/net/netfilter/nfnetlink_queue");
+    std::string line;
+    while (std::getline(in, line)) {
+        // queue_num peer_portid queue_total copy_mode copy_range queue_dropped user_dropped id_sequence 1
+        unsigned queueNum = 0, portid = 0, total = 0, mode = 0, range = 0, dropped = 0, userDropped = 0;
+        if (std::sscanf(line.c_str(), "%u %u %u %u %u %u %u",
+                        &queueNum, &portid, &total, &mode, &range, &dropped, &userDropped) != 7)
+            continue;
+        for (const auto& w : workers) {
+            if (w->queueNum != queueNum) continue;
+            stats.kernelBacklog += total;
+            stats.kernelQueueDropped += dropped;
+            stats.kernelUserDropped += userDropped;
+            break;
+        }
+    }
+}
+
+CaptureStats PacketCapture::currentStats() const {
+    CaptureStats stats = retiredStats;
+    for (const auto& w : workers) addCounters(*w, stats);
+    stats.blocked = stats.blockedByRule + stats.blockedByDpi;
+    return stats;
+}
 
-    if (queueHandle) {
-        nfq_destroy_queue(queueHandle);
-        queueHandle = nullptr;
+// Runs on the GUI thread at the stats interval, so its cost (and the
+// Dashboard's) does not depend on the packet rate.
+void PacketCapture::publishStats() {
+    CaptureStats stats = currentStats();
+    qint64 now = monotonicMs();
+    qint64 elapsed = lastStatsMs ? now - lastStatsMs : 0;
+    if (elapsed > 0) {
+        auto rate = [elapsed](quint64 cur, quint64 prev) -> quint64 {
+            return cur >= prev ? (cur - prev) * 1000 / elapsed : 0;
+        };
+        stats.packetsPerSec = rate(stats.packets, lastStats.packets);
+        stats.bytesPerSec = rate(stats.bytes, lastStats.bytes);
+        stats.syscallsSavedPerSec = rate(stats.verdictSyscallsSaved, lastStats.verdictSyscallsSaved);
     }
-    if (nfqHandle) {
-        nfq_close(nfqHandle);
-        nfqHandle = nullptr;
+    addKernelQueueStats(stats);
+    if (ruleEngine) {
+        FlowCacheStats cache = ruleEngine->flowCacheStats();
+        stats.flowCacheLookups = cache.lookups;
+        stats.flowCacheHits = cache.hits;
+        stats.flowCacheEvictions = cache.evictions;
+        stats.flowCacheOccupancy = cache.occupancy;
+        stats.flowCacheCapacity = cache.capacity;
     }
-    fd = -1;
+    if (dpiEngine) {
+        ReassemblyStats streams = dpiEngine->streamStats();
+        stats.streamFlows = streams.flows;
+        stats.streamBufferedBytes = streams.bufferedBytes;
+        stats.streamGapsSkipped = streams.gapsSkipped;
+        stats.streamOverflowDrops = streams.overflowDrops;
+
+        DPIDispatchStats dispatch = dpiEngine->dispatchStats();
+        stats.dpiPackets = dispatch.packets;
+        stats.dpiCandidates = dispatch.candidates;
+        stats.dpiSignatures = dispatch.signatures;
+        stats.dpiSignatureGroups = dispatch.groups;
+        if (stats.dpiPackets > lastStats.dpiPackets && stats.dpiCandidates >= lastStats.dpiCandidates) {
+            stats.dpiCandidatesPerPacket = double(stats.dpiCandidates - lastStats.dpiCandidates)
+                                         / double(stats.dpiPackets - lastStats.dpiPackets);
+        }
+    }
+    stats.logRecordsDropped = Logger::instance().droppedRecords();
+    stats.memoryKB = getCurrentMemoryUsageKB();
+    lastStats = stats;
+    lastStatsMs = now;
+
+    emit statsSnapshot(stats);
+    emit statsUpdated(static_cast<int>(stats.packets), static_cast<int>(stats.blocked), stats.memoryKB);
 }
 
 int PacketCapture::getCurrentMemoryUsageKB() {
@@ -135,8 +607,9 @@ int PacketCapture::getCurrentMemoryUsageKB() {
     return usage.ru_maxrss;
 }
 
-int PacketCapture::internalCallback(struct nfq_q_handle* qh, struct nfgenmsg*, struct nfq_data* nfa, void* data) {
-    PacketCapture* self = static_cast<PacketCapture*>(data);
+int PacketCapture::internalCallback(struct nfq_q_handle*, struct nfgenmsg*, struct nfq_data* nfa, void* data) {
+    QueueWorker* worker = static_cast<QueueWorker*>(data);
+    PacketCapture* self = worker->owner;
 
     uint32_t id = 0;
     struct nfqnl_msg_packet_hdr* ph = nfq_get_msg_packet_hdr(nfa);
@@ -145,76 +618,71 @@ int PacketCapture::internalCallback(struct nfq_q_handle* qh, struct nfgenmsg*, s
     unsigned char* pktData = nullptr;
     int len = nfq_get_payload(nfa, &pktData);
 
-    std::string src_ip, dst_ip, protocol, info;
-    int src_port = 0, dst_port = 0;
-    std::string action = "allow"; // Default to allow
+    // Dual-stack parse straight from the queue buffer; nothing below allocates.
+    PacketMeta pkt;
+    if (len > 0 && pktData)
+        parsePacket(pktData, static_cast<size_t>(len), pkt);
+    pkt.inIfindex = nfq_get_indev(nfa);
+    pkt.outIfindex = nfq_get_outdev(nfa);
+    pkt.gso = (nfq_get_skbinfo(nfa) & NFQA_SKB_GSO) != 0;
 
-    if (len > 0 && pktData) {
-        struct iphdr* iph = (struct iphdr*)pktData;
-        char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &iph->saddr, src, sizeof(src));
-        inet_ntop(AF_INET, &iph->daddr, dst, sizeof(dst));
-        src_ip = src;
-        dst_ip = dst;
-        protocol = protoName(iph->protocol);
+    // --- RuleEngine and DPIEngine integration ---
+    bool shouldBlock = false;
+    LogReason reason = LogReason::None;
+    RuleDecision decision = self->ruleEngine ? self->ruleEngine->classify(pkt) : RuleDecision::Allow;
+    if (decision == RuleDecision::Pending) {
+        // Unknown flow in interactive mode: no verdict until the user answers
+        // (releaseFlow). Everything else keeps flowing meanwhile.
+        if (self->holdPacket(*worker, pkt, id))
+            return 0; // Counted and logged once released
+        decision = RuleDecision::Block; // Hold limits reached
+    }
+    if (decision == RuleDecision::Block) {
+        shouldBlock = true;
+        reason = LogReason::RuleEngine;
+    }
+    // DPI check only if not already blocked
+    else if (self->dpiEngine && self->dpiEngine->shouldBlock(pkt)) {
+        shouldBlock = true;
+        reason = LogReason::DPIEngine;
+    }
 
-        if (iph->protocol == IPPROTO_TCP && len >= (int)(iph->ihl*4 + sizeof(tcphdr))) {
-            struct tcphdr* tcph = (struct tcphdr*)(pktData + iph->ihl*4);
-            src_port = ntohs(tcph->source);
-            dst_port = ntohs(tcph->dest);
-        } else if (iph->protocol == IPPROTO_UDP && len >= (int)(iph->ihl*4 + sizeof(udphdr))) {
-            struct udphdr* udph = (struct udphdr*)(pktData + iph->ihl*4);
-            src_port = ntohs(udph->source);
-            dst_port = ntohs(udph->dest);
+    // Final verdicts carry their decision in the mark so the kernel can take
+    // over the rest of the flow (see setFlowMarking).
+    uint32_t verdictMark = 0;
+    if (self->flowMarking.load(std::memory_order_relaxed)) {
+        uint32_t mask = self->markMask.load(std::memory_order_relaxed);
+        uint32_t pktMark = nfq_get_nfmark(nfa);
+        if (pktMark & mask) {
+            // Already carried a decision and came back: the FW_FASTPATH rules
+            // are missing, and NF_REPEAT would loop forever. Plain verdict.
+            if (!self->markLoopWarned.exchange(true)) {
+                std::cerr << "[PacketCapture] Marked packet re-queued; is the FW_FASTPATH chain "
+                             "from setup_iptables.sh installed?" << std::endl;
+            }
+        } else if (shouldBlock) {
+            verdictMark = (pktMark & ~mask) | self->dropMark.load(std::memory_order_relaxed);
+        } else if (!self->dpiActive.load(std::memory_order_relaxed)) {
+            verdictMark = (pktMark & ~mask) | self->allowMark.load(std::memory_order_relaxed);
         }
     }
 
-    // --- RuleEngine and DPIEngine integration ---
-    bool shouldBlock = false;
-    if (self) {
-        if (self->ruleEngine && self->ruleEngine->shouldBlock(src_ip, dst_ip, src_port, dst_port, protocol, pktData, len)) {
-            shouldBlock = true;
-            info = "Blocked by RuleEngine";
-        }
-        // DPI check only if not already blocked
-        else if (self->dpiEngine && self->dpiEngine->shouldBlock(src_ip, dst_ip, src_port, dst_port, protocol, pktData, len)) {
-            shouldBlock = true;
-            info = "Blocked by DPIEngine";
-        }
-    }
-
-    action = shouldBlock ? "block" : "allow";
-
-    // Print to terminal for debug
-    std::cout << "[PACKET] " << src_ip << ":" << src_port << " -> "
-              << dst_ip << ":" << dst_port << " proto: " << protocol
-              << " action: " << action << " info: " << info << std::endl;
-
-    // Log to database (for LogViewer)
-    std::time_t now = std::time(nullptr);
-    char timebuf[32];
-    std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    Logger::instance().logEvent(
-        timebuf,
-        src_ip,
-        src_port,
-        dst_ip,
-        dst_port,
-        protocol,
-        action,
-        info
-    );
-
-    // --- Memory and stats update ---
-    if (self) {
-        self->totalPackets++;
-        if (shouldBlock) self->blockedPackets++;
-        emit self->statsUpdated(self->totalPackets, self->blockedPackets, self->getCurrentMemoryUsageKB());
-    }
-
-    if (shouldBlock) {
-        return nfq_set_verdict(qh, id, NF_DROP, 0, nullptr);
-    } else {
-        return nfq_set_verdict(qh, id, NF_ACCEPT, 0, nullptr);
+    // The verdict goes out before any logging or stats work.
+    int ret = self->sendVerdict(*worker, id, shouldBlock, verdictMark);
+
+    // Hand the record to the log writer thread (stdout + SQLite for LogViewer)
+    if (worker->logRing) {
+        Logger& logger = Logger::instance();
+        worker->logRing->push(logRecordOf(pkt, shouldBlock, reason), logger.overflowPolicy(), logger.sampleEvery());
     }
+
+    // --- Stats: plain per-worker counters, published by the stats timer ---
+    WorkerCounters& c = worker->counters;
+    bump(c.packets);
+    if (len > 0) bump(c.bytes, static_cast<uint64_t>(pkt.wireLen));
+    if (pkt.gso) bump(c.gsoPackets);
+    if (reason == LogReason::RuleEngine) bump(c.blockedByRule);
+    else if (reason == LogReason::DPIEngine) bump(c.blockedByDpi);
+
+    return ret;
 }
\ No newline at end of file
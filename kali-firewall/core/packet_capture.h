@@ -1,13 +1,22 @@
 #pragma once
 
 #include <QObject>
+#include <QList>
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <memory>
 #include <vector>
+#include <chrono>
+#include <unordered_map>
+#include <utility>
 #include <libnetfilter_queue/libnetfilter_queue.h>
+#include "capture_stats.h"
+#include "rule_engine.h"
+#include "flow_key.h"
+#include "log_ring.h"
 
-class RuleEngine;
+class QTimer;
 class DPIEngine;
 
 class PacketCapture : public QObject {
@@ -16,33 +25,206 @@ public:
     PacketCapture();
     ~PacketCapture();
 
+    // Bind a single queue (equivalent to initQueues(queue_num, 1, buf_size, false)).
     bool init(uint16_t queue_num = 0, size_t buf_size = 0x10000);
+
+    // Bind queues [first_queue, first_queue + num_queues) for use with
+    // iptables --queue-balance, which hashes each flow's addresses so both
+    // directions reach the same queue. Every queue gets its own nfq handle,
+    // receive buffer and worker thread; with pin_workers set, worker i is
+    // pinned to CPU i (modulo the number of online CPUs).
+    bool initQueues(uint16_t first_queue, uint16_t num_queues,
+                    size_t buf_size = 0x10000, bool pin_workers = true);
     void start();
     void stop();
 
-    void setRuleEngine(RuleEngine* re) { ruleEngine = re; }
+    void setRuleEngine(RuleEngine* re);
     void setDPIEngine(DPIEngine* de) { dpiEngine = de; }
 
+    // Bytes copied to userspace when only L3/L4 headers are needed.
+    static constexpr uint32_t HEADER_COPY_RANGE = 128;
+
+    // Recompute the copy range from the DPI engine (headers only when it has no
+    // signatures, its inspection depth otherwise). Safe to call while running;
+    // each worker re-applies the range on its own queue.
+    void refreshCopyRange();
+    uint32_t copyRange() const { return targetCopyRange; }
+
+    // Coalesce consecutive ACCEPT verdicts into one NFQNL_MSG_VERDICT_BATCH
+    // message. A DROP flushes the pending accepts and is then sent on its own.
+    // Pending accepts go out when the batch is full, or once the socket has
+    // been drained and the oldest one has waited flush_timeout_ms.
+    // batch_size <= 1 sends one verdict per packet.
+    void setVerdictBatching(unsigned batch_size, int flush_timeout_ms = 0);
+
+    // Kernel-side queue limits, applied by initQueues()/init().
+    // max_len: packets the kernel may hold per queue (0 keeps the kernel default).
+    // socket_rcvbuf: netlink receive buffer in bytes (0 keeps the system default).
+    // fail_open: accept instead of drop when a queue is full (NFQA_CFG_F_FAIL_OPEN).
+    void setQueueLimits(uint32_t max_len, int socket_rcvbuf = 0, bool fail_open = false);
+
+    // GSO-aware queueing (NFQA_CFG_F_GSO), applied by initQueues()/init().
+    // The kernel then queues a large send as one packet instead of segmenting
+    // it first, so bulk TCP costs one verdict per ~64 KB instead of per MSS.
+    // While DPI is active the copy range is raised to the maximum so such a
+    // packet reaches userspace whole and is inspected end to end.
+    void setGsoQueueing(bool enabled);
+
+    // Connmark fast path. Once a flow's verdict is final (any drop, or an
+    // accept while DPI has no signatures) the packet is re-injected with
+    // NF_REPEAT and allow_mark/drop_mark in its nfmark. The FW_FASTPATH chain
+    // from scripts/setup_iptables.sh saves those bits to the connmark and then
+    // accepts/drops the rest of the flow in the kernel.
+    // Verdicts are per direction (rules match source and destination), so the
+    // connmark keeps one decision per direction: the original direction's in
+    // `mask`, the reply direction's in `mask << reply_shift`. FW_FASTPATH
+    // moves a reply packet's bits up when saving them and only lets the
+    // packet's own direction decide it; an allowed request never lets the
+    // replies through on its own.
+    void setFlowMarking(bool enabled, uint32_t allow_mark = 0x1, uint32_t drop_mark = 0x2, uint32_t mask = 0x3,
+                        unsigned reply_shift = 2);
+
+    // Zero the decision bits (both directions) in every conntrack entry so
+    // established flows are re-evaluated (call after a rule change). Runs
+    // `conntrack -U` asynchronously.
+    void clearFlowMarks();
+
+    // clearFlowMarks() for edits, coalesced: a burst of them (a rule list
+    // being built up, an import) clears once, FLOW_MARK_CLEAR_DELAY_MS after
+    // the last. Connect to RuleEngine::rulesChanged,
+    // RuleEngine::interactiveModeChanged and DPImanager::signaturesChanged.
+    // When only rules changed and the list is the same as at the last clear
+    // (nothing that decides a verdict changed), there is nothing to clear;
+    // signature and mode changes always clear (the mode decides the verdict
+    // of flows no rule matches).
+    static constexpr int FLOW_MARK_CLEAR_DELAY_MS = 500;
+    void ruleSetChanged();
+    void signatureSetChanged();
+    void interactiveModeChanged();
+
+    size_t queueCount() const { return workers.size(); }
+
+    // How often statsSnapshot/statsUpdated are emitted (default 250 ms, 4 Hz).
+    void setStatsInterval(int ms);
+    CaptureStats currentStats() const;
+
+public slots:
+    // Verdict for the packets held while `flow` waited on an interactive
+    // decision (connect to RuleEngine::flowResolved). Handed to every worker;
+    // the one holding packets of the flow issues their verdicts. Allowed
+    // packets are re-queued (NF_REPEAT) to go through the rules and DPI.
+    void releaseFlow(const FlowKey& flow, bool block);
+
 signals:
     void statsUpdated(int totalPackets, int blockedPackets, int memoryUsageKB);
+    void statsSnapshot(const CaptureStats& stats);
+
+private slots:
+    void publishStats();
+    void flushFlowMarks();
 
 private:
+    // Per-worker counters. Only the owning worker writes them (relaxed
+    // load + store, no locked read-modify-write) and the stats timer reads
+    // them; the alignment keeps each worker's counters on its own cache line.
+    struct alignas(64) WorkerCounters {
+        std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> blockedByRule{0};
+        std::atomic<uint64_t> blockedByDpi{0};
+        std::atomic<uint64_t> verdictSyscallsSaved{0};
+        std::atomic<uint64_t> enobufs{0};
+        std::atomic<uint64_t> gsoPackets{0};
+        std::atomic<uint64_t> heldPackets{0};
+    };
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // One NFQUEUE and the thread that services it.
+    struct QueueWorker {
+        PacketCapture* owner = nullptr;
+        uint16_t queueNum = 0;
+        int cpu = -1;
+        struct nfq_handle* nfqHandle = nullptr;
+        struct nfq_q_handle* queueHandle = nullptr;
+        int fd = -1;
+        uint32_t appliedCopyRange = 0;
+        std::vector<char> buffer;
+        std::thread thread;
+        LogRing* logRing = nullptr;   // Owned by Logger
+
+        // Pending ACCEPT batch, touched only by the worker thread.
+        uint32_t batchLastId = 0;
+        uint32_t batchVerdict = 0;
+        uint32_t batchMark = 0;
+        unsigned batchCount = 0;
+        std::chrono::steady_clock::time_point batchStart;
+
+        // Packets of flows waiting on an interactive decision, by flow; touched
+        // only by the worker thread. While any are held verdicts go out one by
+        // one, since a batch verdict would also cover the held ids.
+        struct HeldPacket {
+            uint32_t id;
+            uint32_t wireLen;
+            LogRecord rec;   // Logged if the flow is dropped
+        };
+        std::unordered_map<FlowKey, std::vector<HeldPacket>, FlowKeyHash> held;
+        size_t heldCount = 0;
+
+        // Resolved flows posted by releaseFlow(); wakeFd (an eventfd) wakes poll().
+        std::mutex inboxMutex;
+        std::vector<std::pair<FlowKey, bool>> inbox;
+        int wakeFd = -1;
+
+        WorkerCounters counters;
+    };
+
     static int internalCallback(struct nfq_q_handle* qh, struct nfgenmsg*, struct nfq_data* nfa, void* data);
 
-    struct nfq_handle* nfqHandle;
-    struct nfq_q_handle* queueHandle;
-    int fd;
-    size_t bufferSize;
-    std::thread captureThread;
+    bool openQueue(QueueWorker& w);
+    void closeQueue(QueueWorker& w);
+    void captureLoop(QueueWorker& w);
+    void addCounters(const QueueWorker& w, CaptureStats& stats) const;
+    void addKernelQueueStats(CaptureStats& stats) const;
+    // A non-zero mark re-injects the packet with NF_REPEAT and that nfmark.
+    int sendVerdict(QueueWorker& w, uint32_t id, bool drop, uint32_t mark = 0);
+    void flushBatch(QueueWorker& w);
+    bool holdPacket(QueueWorker& w, const PacketMeta& pkt, uint32_t id);
+    void drainInbox(QueueWorker& w);
+    void releaseHeld(QueueWorker& w, const FlowKey& flow, bool drop);
+    bool applyCopyRange(QueueWorker& w);
+
+    std::vector<std::unique_ptr<QueueWorker>> workers;
     std::mutex mtx;
     std::atomic<bool> running;
+    std::atomic<unsigned> batchSize;
+    std::atomic<int> flushTimeoutMs;
+    std::atomic<uint32_t> targetCopyRange;
+    std::atomic<bool> dpiActive;
+    std::atomic<bool> flowMarking;
+    std::atomic<uint32_t> allowMark;
+    std::atomic<uint32_t> dropMark;
+    std::atomic<uint32_t> markMask;
+    std::atomic<uint32_t> connmarkMask;  // markMask for both directions
+    std::atomic<bool> markLoopWarned;
+    uint32_t queueMaxLen;
+    int socketRcvBuf;
+    bool failOpen;
+    std::atomic<bool> gsoQueueing;
+
+    QTimer* flowMarkTimer;
+    bool forceFlowMarkClear = false; // Signatures or mode changed since the last flushFlowMarks()
+    QList<Rule> markedRules;         // The rules the current connmarks were decided under
+
+    QTimer* statsTimer;
+    CaptureStats retiredStats;   // Totals of workers torn down by stop()
+    CaptureStats lastStats;
+    qint64 lastStatsMs;
 
     RuleEngine* ruleEngine;
     DPIEngine* dpiEngine;
 
-    std::atomic<int> totalPackets;
-    std::atomic<int> blockedPackets;
-
-    void captureLoop();
     int getCurrentMemoryUsageKB();
-};
\ No newline at end of file
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "ip_addr.h"
+
+// Everything the engines need to decide on one queued packet, in binary form.
+// Filled on the capture thread without touching the heap; `data` and
+// `payload` point into the NFQUEUE receive buffer and are only valid for the
+// duration of the callback. Text is produced lazily, when a log line or an
+// interactive prompt actually needs it.
+struct PacketMeta {
+    IpAddr src;
+    IpAddr dst;
+    uint8_t protocol = 0;     // Final upper-layer protocol (IPPROTO_*), after IPv6 extension headers
+    uint16_t srcPort = 0;     // Host byte order; 0 when not TCP/UDP or not a first fragment
+    uint16_t dstPort = 0;
+    uint32_t tcpSeq = 0;      // Host byte order; TCP with a full header only
+    uint8_t tcpFlags = 0;     // TH_FIN, TH_SYN, TH_RST, ...; 0 when not TCP
+    uint32_t inIfindex = 0;   // 0 when unknown (e.g. locally generated)
+    uint32_t outIfindex = 0;
+    uint16_t l4Offset = 0;    // Offset of the transport header from the start of the packet
+    bool fragment = false;    // Non-first fragment: there is no transport header to read
+    bool gso = false;         // Unsegmented GSO packet (NFQA_SKB_GSO); may be far above the MTU
+
+    // Length of the whole packet per its IP header. Larger than `len` when the
+    // copy range truncated it; falls back to `len` when the header carries 0
+    // (IPv4 GSO/BIG TCP packets above 64 KB, IPv6 jumbograms).
+    size_t wireLen = 0;
+
+    const uint8_t* data = nullptr;     // Whole packet, starting at the IP header
+    size_t len = 0;
+    const uint8_t* payload = nullptr;  // Transport payload (after the TCP/UDP header)
+    size_t payloadLen = 0;
+};
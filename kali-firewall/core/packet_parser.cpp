@@ -0,0 +1,120 @@
+#include "packet_parser.h"
+#include <cstdio>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+namespace {
+constexpr int MAX_EXT_HEADERS = 8; // Bound the walk on crafted packets
+
+// Reads the ports and sets the payload span from the transport header at l4Offset.
+void readTransport(const uint8_t* data, size_t len, PacketMeta& out) {
+    size_t off = out.l4Offset;
+    size_t payloadOff = off;
+    if (!out.fragment) {
+        if ((out.protocol == IPPROTO_TCP && len >= off + sizeof(tcphdr)) ||
+            (out.protocol == IPPROTO_UDP && len >= off + sizeof(udphdr))) {
+            // Source and destination port are the first two 16-bit fields of both headers.
+            out.srcPort = static_cast<uint16_t>((data[off] << 8) | data[off + 1]);
+            out.dstPort = static_cast<uint16_t>((data[off + 2] << 8) | data[off + 3]);
+            payloadOff = off + sizeof(udphdr);
+            if (out.protocol == IPPROTO_TCP) {
+                const tcphdr* th = reinterpret_cast<const tcphdr*>(data + off);
+                payloadOff = off + th->doff * 4u;
+                out.tcpSeq = ntohl(th->seq);
+                out.tcpFlags = data[off + 13];
+            }
+        }
+    }
+    if (payloadOff < len) {
+        out.payload = data + payloadOff;
+        out.payloadLen = len - payloadOff;
+    }
+}
+
+bool parseIPv4(const uint8_t* data, size_t len, PacketMeta& out) {
+    if (len < sizeof(iphdr)) return false;
+    const iphdr* iph = reinterpret_cast<const iphdr*>(data);
+    size_t ihl = iph->ihl * 4u;
+    if (ihl < sizeof(iphdr) || ihl > len) return false;
+
+    // tot_len is only used for accounting: GSO packets can exceed 64 KB and
+    // carry 0 here, and their checksums may still be partial (the kernel
+    // fills them in after the verdict), so neither is validated.
+    uint16_t totLen = ntohs(iph->tot_len);
+    out.wireLen = totLen ? totLen : len;
+
+    out.src = IpAddr::v4(&iph->saddr);
+    out.dst = IpAddr::v4(&iph->daddr);
+    out.protocol = iph->protocol;
+    out.l4Offset = static_cast<uint16_t>(ihl);
+    out.fragment = (ntohs(iph->frag_off) & IP_OFFMASK) != 0;
+    readTransport(data, len, out);
+    return true;
+}
+
+bool parseIPv6(const uint8_t* data, size_t len, PacketMeta& out) {
+    if (len < sizeof(ip6_hdr)) return false;
+    const ip6_hdr* ip6 = reinterpret_cast<const ip6_hdr*>(data);
+    uint16_t plen = ntohs(ip6->ip6_plen);
+    out.wireLen = plen ? sizeof(ip6_hdr) + plen : len;
+
+    out.src = IpAddr::v6(&ip6->ip6_src);
+    out.dst = IpAddr::v6(&ip6->ip6_dst);
+
+    uint8_t next = ip6->ip6_nxt;
+    size_t off = sizeof(ip6_hdr);
+    for (int i = 0; i < MAX_EXT_HEADERS; ++i) {
+        if (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING || next == IPPROTO_DSTOPTS) {
+            if (len < off + 2) break;
+            uint8_t hdrNext = data[off];
+            off += (data[off + 1] + 1u) * 8u;
+            next = hdrNext;
+        } else if (next == IPPROTO_FRAGMENT) {
+            if (len < off + sizeof(ip6_frag)) break;
+            const ip6_frag* frag = reinterpret_cast<const ip6_frag*>(data + off);
+            if ((frag->ip6f_offlg & IP6F_OFF_MASK) != 0) out.fragment = true;
+            next = frag->ip6f_nxt;
+            off += sizeof(ip6_frag);
+        } else if (next == IPPROTO_AH) {
+            if (len < off + 2) break;
+            uint8_t hdrNext = data[off];
+            off += (data[off + 1] + 2u) * 4u;
+            next = hdrNext;
+        } else {
+            break; // Upper-layer protocol, ESP or no-next-header
+        }
+    }
+
+    out.protocol = next;
+    out.l4Offset = static_cast<uint16_t>(off > len ? len : off);
+    if (off <= len) readTransport(data, len, out);
+    return true;
+}
+}
+
+bool parsePacket(const uint8_t* data, size_t len, PacketMeta& out) {
+    out = PacketMeta();
+    if (!data || len == 0) return false;
+    out.data = data;
+    out.len = len;
+    out.wireLen = len;
+    switch (data[0] >> 4) {
+        case 4: return parseIPv4(data, len, out);
+        case 6: return parseIPv6(data, len, out);
+        default: return false;
+    }
+}
+
+const char* protocolName(uint8_t protocol, char* buf, size_t bufLen) {
+    switch (protocol) {
+        case IPPROTO_TCP: return "TCP";
+        case IPPROTO_UDP: return "UDP";
+        case IPPROTO_ICMP: return "ICMP";
+        case IPPROTO_ICMPV6: return "ICMPv6";
+        default:
+            std::snprintf(buf, bufLen, "%u", protocol);
+            return buf;
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "packet_meta.h"
+
+// Parses an IPv4 or IPv6 packet as delivered by NFQUEUE (starting at the IP
+// header) into `out`, including the data and payload spans. IPv6 extension
+// headers (hop-by-hop, routing, fragment, destination options, AH) are walked
+// to reach the transport header. Interface indices are left to the caller.
+// Returns false if the data is too short or not IP at all.
+bool parsePacket(const uint8_t* data, size_t len, PacketMeta& out);
+
+// Short protocol name ("TCP", "UDP", "ICMP", "ICMPv6", or the number).
+const char* protocolName(uint8_t protocol, char* buf, size_t bufLen);
@@ -0,0 +1,390 @@
+#include "regex_literals.h"
+#include <algorithm>
+#include <cctype>
+#include <set>
+#include <vector>
+
+namespace {
+// Sets larger than this are given up on: they would select too much anyway.
+constexpr size_t MAX_SET = 64;
+// Largest class spelled out as single characters ("[Gg]", "[0-3]").
+constexpr size_t MAX_CLASS = 4;
+
+using StringSet = std::set<std::string>;
+
+// What is known about the strings a sub-expression matches.
+struct Info {
+    bool hasExact = false;  // `exact` is every string it can match
+    StringSet exact;
+    bool hasRequired = false;  // Every match contains one of `required`
+    StringSet required;
+};
+
+Info unknown() { return Info(); }
+
+Info exactly(StringSet strings) {
+    Info info;
+    info.hasExact = true;
+    info.exact = std::move(strings);
+    return info;
+}
+
+Info emptyString() { return exactly({std::string()}); }
+
+// `required` as far as it is known: the exact set counts when it has no empty string.
+bool requiredOf(const Info& info, StringSet& out) {
+    if (info.hasExact && !info.exact.count(std::string()) && info.exact.size() <= MAX_SET) {
+        out = info.exact;
+        return true;
+    }
+    if (info.hasRequired) {
+        out = info.required;
+        return true;
+    }
+    return false;
+}
+
+// Higher is more selective: the shortest literal counts most, then fewer literals.
+bool better(const StringSet& a, const StringSet& b) {
+    auto shortest = [](const StringSet& s) {
+        size_t n = SIZE_MAX;
+        for (const std::string& lit : s) n = std::min(n, lit.size());
+        return n;
+    };
+    size_t la = shortest(a), lb = shortest(b);
+    return la != lb ? la > lb : a.size() < b.size();
+}
+
+// Adds `candidate` to `best` if it is a usable and better filter.
+void offer(const StringSet& candidate, bool& haveBest, StringSet& best) {
+    if (candidate.empty() || candidate.count(std::string())) return;
+    if (!haveBest || better(candidate, best)) {
+        best = candidate;
+        haveBest = true;
+    }
+}
+
+// A sequence of items. Runs of items with exact sets are multiplied out
+// into longer literals ("a", "[bB]", "c" -> "abc", "abc"); each run, and
+// what each other item requires, is a candidate filter, and the most
+// selective one is kept.
+Info concat(const std::vector<Info>& items) {
+    StringSet run = {std::string()};
+    bool wholeExact = true;
+    bool haveBest = false;
+    StringSet best;
+    for (const Info& item : items) {
+        if (item.hasExact && run.size() * item.exact.size() <= MAX_SET) {
+            StringSet longer;
+            for (const std::string& x : run)
+                for (const std::string& y : item.exact) longer.insert(x + y);
+            run = std::move(longer);
+            continue;
+        }
+        wholeExact = false;
+        offer(run, haveBest, best);
+        StringSet required;
+        if (requiredOf(item, required)) offer(required, haveBest, best);
+        run = item.hasExact ? item.exact : StringSet{std::string()};
+    }
+
+    Info out;
+    if (wholeExact) {
+        out.hasExact = true;
+        out.exact = run;
+    } else {
+        offer(run, haveBest, best);
+        out.hasRequired = haveBest;
+        out.required = best;
+    }
+    return out;
+}
+
+Info alternate(const Info& a, const Info& b) {
+    Info out;
+    if (a.hasExact && b.hasExact && a.exact.size() + b.exact.size() <= MAX_SET) {
+        out.hasExact = true;
+        out.exact = a.exact;
+        out.exact.insert(b.exact.begin(), b.exact.end());
+    }
+    StringSet ra, rb;
+    if (requiredOf(a, ra) && requiredOf(b, rb) && ra.size() + rb.size() <= MAX_SET) {
+        out.hasRequired = true;
+        out.required = ra;
+        out.required.insert(rb.begin(), rb.end());
+    }
+    return out;
+}
+
+class Parser {
+public:
+    explicit Parser(const std::string& pattern) : p(pattern) {}
+
+    bool parse(Info& out) {
+        out = alternation();
+        return ok && pos == p.size();
+    }
+
+private:
+    const std::string& p;
+    size_t pos = 0;
+    bool ok = true;
+
+    bool more() const { return pos < p.size(); }
+
+    Info alternation() {
+        Info info = sequence();
+        while (ok && more() && p[pos] == '|') {
+            ++pos;
+            info = alternate(info, sequence());
+        }
+        return info;
+    }
+
+    Info sequence() {
+        std::vector<Info> items;
+        while (ok && more() && p[pos] != '|' && p[pos] != ')')
+            items.push_back(quantified());
+        return concat(items);
+    }
+
+    Info quantified() {
+        Info atom = this->atom();
+        while (ok && more()) {
+            size_t min = 0;
+            bool bounded = false;   // {n} with n == max: repeat is exact
+            size_t max = 0;
+            char c = p[pos];
+            if (c == '*') { min = 0; ++pos; }
+            else if (c == '+') { min = 1; ++pos; }
+            else if (c == '?') { min = 0; max = 1; bounded = true; ++pos; }
+            else if (c == '{' && braceQuantifier(min, max, bounded)) {}
+            else break;
+            if (more() && p[pos] == '?') ++pos; // Lazy: same strings
+
+            if (bounded && max == 1 && min == 0) {
+                // x? : x or nothing
+                if (atom.hasExact) {
+                    atom.exact.insert(std::string());
+                    atom.hasRequired = false;
+                } else {
+                    atom = unknown();
+                }
+            } else if (bounded && min == max && atom.hasExact && min > 0 && min <= 8) {
+                atom = concat(std::vector<Info>(min, atom));
+            } else if (min >= 1) {
+                // At least one copy: what the atom requires is still required.
+                StringSet required;
+                Info kept;
+                if (requiredOf(atom, required)) {
+                    kept.hasRequired = true;
+                    kept.required = required;
+                }
+                atom = kept;
+            } else {
+                atom = unknown();
+            }
+        }
+        return atom;
+    }
+
+    // {n}, {n,} or {n,m}; leaves pos alone if it is a literal brace.
+    bool braceQuantifier(size_t& min, size_t& max, bool& bounded) {
+        size_t i = pos + 1;
+        auto number = [&](size_t& n) {
+            size_t start = i;
+            n = 0;
+            while (i < p.size() && std::isdigit(static_cast<unsigned char>(p[i])))
+                n = std::min<size_t>(n * 10 + static_cast<size_t>(p[i++] - '0'), 1000000);
+            return i > start;
+        };
+        if (!number(min)) return false;
+        max = min;
+        bounded = true;
+        if (i < p.size() && p[i] == ',') {
+            ++i;
+            bounded = number(max);
+        }
+        if (i >= p.size() || p[i] != '}') return false;
+        pos = i + 1;
+        return true;
+    }
+
+    Info literal(unsigned char c) {
+        return exactly({std::string(1, static_cast<char>(std::tolower(c)))});
+    }
+
+    Info atom() {
+        char c = p[pos++];
+        switch (c) {
+        case '^':
+        case '$':
+            return emptyString();
+        case '.':
+            return unknown();
+        case '(':
+            return group();
+        case '[':
+            return characterClass();
+        case '\\':
+            return escape();
+        case '*': case '+': case '?':
+            ok = false;   // Quantifier without an atom
+            return unknown();
+        default:
+            return literal(static_cast<unsigned char>(c));
+        }
+    }
+
+    Info group() {
+        bool zeroWidth = false;
+        if (pos + 1 < p.size() && p[pos] == '?') {
+            if (p[pos + 1] == ':') {
+                pos += 2;
+            } else if (p[pos + 1] == '=' || p[pos + 1] == '!') {
+                pos += 2;
+                zeroWidth = true;
+            } else {
+                ok = false;
+                return unknown();
+            }
+        }
+        Info inner = alternation();
+        if (!more() || p[pos] != ')') {
+            ok = false;
+            return unknown();
+        }
+        ++pos;
+        return zeroWidth ? emptyString() : inner;
+    }
+
+    // Decodes one escape inside or outside a class. Returns -1 for a class
+    // escape (\d, \w, ...), -2 for \b / \B, -3 for a back-reference.
+    int escapedChar() {
+        if (!more()) {
+            ok = false;
+            return -1;
+        }
+        char c = p[pos++];
+        auto hex = [&](size_t digits) {
+            int value = 0;
+            for (size_t i = 0; i < digits; ++i) {
+                if (!more() || !std::isxdigit(static_cast<unsigned char>(p[pos]))) {
+                    ok = false;
+                    return 0;
+                }
+                char h = static_cast<char>(std::tolower(static_cast<unsigned char>(p[pos++])));
+                value = value * 16 + (h <= '9' ? h - '0' : h - 'a' + 10);
+            }
+            return value;
+        };
+        switch (c) {
+        case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+            return -1;
+        case 'b': case 'B':
+            return -2;
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case '0': return 0;
+        case 'x': return hex(2);
+        case 'u': {
+            int value = hex(4);
+            return value <= 0xff ? value : -1;   // Beyond a byte: std::regex compares chars
+        }
+        case 'c':
+            if (!more()) { ok = false; return -1; }
+            return p[pos++] % 32;
+        default:
+            if (c >= '1' && c <= '9') return -3;
+            return static_cast<unsigned char>(c);
+        }
+    }
+
+    Info escape() {
+        int c = escapedChar();
+        if (c == -2) return emptyString();
+        if (c < 0) return unknown();
+        return literal(static_cast<unsigned char>(c));
+    }
+
+    Info characterClass() {
+        bool negated = more() && p[pos] == '^';
+        if (negated) ++pos;
+        std::set<char> members;
+        bool spelled = !negated;
+        bool first = true;
+        while (ok) {
+            if (!more()) {
+                ok = false;
+                return unknown();
+            }
+            char c = p[pos];
+            if (c == ']' && !first) {
+                ++pos;
+                break;
+            }
+            first = false;
+            ++pos;
+            int lo = static_cast<unsigned char>(c);
+            if (c == '\\') {
+                lo = escapedChar();
+                if (lo == -2) lo = '\b';   // \b is a backspace inside a class
+                if (lo < 0) {
+                    spelled = false;
+                    continue;
+                }
+            } else if (c == '[' && more() && (p[pos] == ':' || p[pos] == '.' || p[pos] == '=')) {
+                // [:alpha:] and friends
+                size_t close = p.find(std::string(1, p[pos]) + "]", pos + 1);
+                if (close == std::string::npos) {
+                    ok = false;
+                    return unknown();
+                }
+                pos = close + 2;
+                spelled = false;
+                continue;
+            }
+            int hi = lo;
+            if (pos + 1 < p.size() && p[pos] == '-' && p[pos + 1] != ']') {
+                ++pos;
+                char d = p[pos++];
+                hi = static_cast<unsigned char>(d);
+                if (d == '\\') {
+                    hi = escapedChar();
+                    if (hi < 0) {
+                        spelled = false;
+                        continue;
+                    }
+                }
+            }
+            if (!spelled) continue;
+            for (int x = lo; x <= hi && members.size() <= MAX_CLASS; ++x)
+                members.insert(static_cast<char>(std::tolower(x)));
+            if (hi - lo >= static_cast<int>(MAX_CLASS) || members.size() > MAX_CLASS) spelled = false;
+        }
+        if (!spelled || members.empty()) return unknown();
+        StringSet strings;
+        for (char m : members) strings.insert(std::string(1, m));
+        return exactly(strings);
+    }
+};
+}
+
+std::vector<std::string> requiredLiterals(const std::string& pattern) {
+    Info info;
+    Parser parser(pattern);
+    StringSet required;
+    if (!parser.parse(info) || !requiredOf(info, required) || required.count(std::string())) return {};
+    // A literal containing another one adds nothing ("bar" covers "foobar").
+    std::vector<std::string> literals;
+    for (const std::string& lit : required) {
+        bool covered = std::any_of(required.begin(), required.end(), [&lit](const std::string& other) {
+            return other.size() < lit.size() && lit.find(other) != std::string::npos;
+        });
+        if (!covered) literals.push_back(lit);
+    }
+    return literals;
+}
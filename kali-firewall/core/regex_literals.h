@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Literal factors a DPI signature cannot match without.
+//
+// Returns a set of strings such that every match of `pattern` (an
+// ECMAScript regex as std::regex takes it) contains at least one of them,
+// lower-cased so they can be searched for case-insensitively. An empty
+// result means no such set was found (e.g. ".*", "\d+" or an alternation
+// with a non-literal branch): the signature has to be tried on every
+// payload.
+//
+// Literal text, escapes, small character classes ("[Gg]"), groups,
+// alternations and quantifiers are followed; anchors and lookarounds are
+// treated as matching the empty string, and anything else as unknown text.
+std::vector<std::string> requiredLiterals(const std::string& pattern);
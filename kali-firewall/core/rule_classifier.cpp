@@ -0,0 +1,194 @@
+#include "rule_classifier.h"
+#include <algorithm>
+#include <netinet/in.h>
+
+size_t RuleClassifier::KeyHash::operator()(const Key& k) const {
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    auto mix = [&h](uint64_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        h *= 0xff51afd7ed558ccdull;
+    };
+    for (int i = 0; i < 4; ++i) mix((static_cast<uint64_t>(k.src[i]) << 32) | k.dst[i]);
+    mix((static_cast<uint64_t>(k.srcPort) << 32) | (static_cast<uint64_t>(k.dstPort) << 16)
+        | static_cast<uint16_t>(k.protocol));
+    return static_cast<size_t>(h ^ (h >> 29));
+}
+
+RuleClassifier::Partition RuleClassifier::partitionOf(uint8_t protocol) {
+    switch (protocol) {
+    case IPPROTO_TCP: return TCP;
+    case IPPROTO_UDP: return UDP;
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6: return ICMP;
+    default: return OTHER;
+    }
+}
+
+namespace {
+// Partition of an exact-protocol rule, PARTITIONS for a protocol wildcard.
+uint32_t partitionBits(const CompiledRule& r) {
+    return r.protocol >= 0 ? RuleClassifier::partitionOf(static_cast<uint8_t>(r.protocol))
+                           : RuleClassifier::PARTITIONS;
+}
+}
+
+uint32_t RuleClassifier::shapeOf(const CompiledRule& r) {
+    return (static_cast<uint32_t>(r.family) << 24) | (static_cast<uint32_t>(r.srcPrefix) << 16)
+         | (static_cast<uint32_t>(r.dstPrefix) << 8) | (partitionBits(r) << 3)
+         | ((r.srcPortLo == r.srcPortHi) ? 4u : 0u) | ((r.dstPortLo == r.dstPortHi) ? 2u : 0u)
+         | (r.protocol >= 0 ? 1u : 0u);
+}
+
+void RuleClassifier::Tuple::grow() {
+    std::vector<Slot> old;
+    old.swap(table);
+    table.assign(old.empty() ? 16 : old.size() * 2, Slot());
+    size_t mask = table.size() - 1;
+    for (const Slot& s : old) {
+        if (s.head == END) continue;
+        size_t i = KeyHash()(s.key) & mask;
+        while (table[i].head != END) i = (i + 1) & mask;
+        table[i] = s;
+    }
+}
+
+// Returns the chain head for `key`, creating it with `index` if absent
+// (in which case the returned head already equals `index`).
+uint32_t* RuleClassifier::Tuple::insert(const Key& key, uint32_t index) {
+    if ((used + 1) * 2 > table.size()) grow();   // Keep the load factor <= 1/2
+    size_t mask = table.size() - 1;
+    size_t i = KeyHash()(key) & mask;
+    while (table[i].head != END) {
+        if (table[i].key == key) return &table[i].head;
+        i = (i + 1) & mask;
+    }
+    table[i].key = key;
+    table[i].head = index;
+    ++used;
+    return &table[i].head;
+}
+
+uint32_t RuleClassifier::Tuple::lookup(const Key& key) const {
+    size_t mask = table.size() - 1;
+    size_t i = KeyHash()(key) & mask;
+    while (table[i].head != END) {
+        if (table[i].key == key) return table[i].head;
+        i = (i + 1) & mask;
+    }
+    return END;
+}
+
+RuleClassifier::Key RuleClassifier::ruleKey(const Tuple& t, const CompiledRule& r) {
+    Key k;
+    std::memcpy(k.src, r.srcNet, sizeof(k.src));
+    std::memcpy(k.dst, r.dstNet, sizeof(k.dst));
+    k.srcPort = t.exactSrcPort ? r.srcPortLo : 0;
+    k.dstPort = t.exactDstPort ? r.dstPortLo : 0;
+    k.protocol = t.exactProtocol ? r.protocol : -1;
+    return k;
+}
+
+RuleClassifier::Key RuleClassifier::packetKey(const Tuple& t, const PacketMeta& pkt) {
+    Key k;
+    uint32_t words[4];
+    std::memcpy(words, pkt.src.bytes, sizeof(words));
+    for (int i = 0; i < 4; ++i) k.src[i] = words[i] & t.srcMask[i];
+    std::memcpy(words, pkt.dst.bytes, sizeof(words));
+    for (int i = 0; i < 4; ++i) k.dst[i] = words[i] & t.dstMask[i];
+    k.srcPort = t.exactSrcPort ? pkt.srcPort : 0;
+    k.dstPort = t.exactDstPort ? pkt.dstPort : 0;
+    k.protocol = t.exactProtocol ? pkt.protocol : -1;
+    return k;
+}
+
+void RuleClassifier::clear() {
+    rules.clear();
+    next.clear();
+    tuples.clear();
+    for (PartitionIndex& p : byPartition) {
+        p.tuples.clear();
+        p.linear.clear();
+    }
+}
+
+void RuleClassifier::build(const CompiledRule* ruleList, size_t count) {
+    clear();
+    rules.assign(ruleList, ruleList + count);
+    next.assign(count, END);
+    if (count <= LINEAR_SCAN_MAX) {
+        for (size_t n = 0; n < count; ++n) {
+            uint32_t bits = partitionBits(rules[n]);
+            for (int p = 0; p < PARTITIONS; ++p) {
+                if (bits == PARTITIONS || bits == static_cast<uint32_t>(p))
+                    byPartition[p].linear.push_back(static_cast<uint32_t>(n));
+            }
+        }
+        return;
+    }
+
+    std::unordered_map<uint32_t, size_t> tupleByShape;
+    // Walk from the back so each chain ends up in ascending index order.
+    for (size_t n = count; n-- > 0;) {
+        const CompiledRule& r = rules[n];
+        if (!r.valid) continue;
+
+        auto shape = tupleByShape.emplace(shapeOf(r), tuples.size());
+        if (shape.second) {
+            Tuple tuple;
+            tuple.family = r.family;
+            tuple.srcPrefix = r.srcPrefix;
+            tuple.dstPrefix = r.dstPrefix;
+            tuple.exactSrcPort = r.srcPortLo == r.srcPortHi;
+            tuple.exactDstPort = r.dstPortLo == r.dstPortHi;
+            tuple.exactProtocol = r.protocol >= 0;
+            tuple.partition = static_cast<uint8_t>(partitionBits(r));
+            std::memcpy(tuple.srcMask, r.srcMask, sizeof(tuple.srcMask));
+            std::memcpy(tuple.dstMask, r.dstMask, sizeof(tuple.dstMask));
+            tuples.push_back(std::move(tuple));
+        }
+        Tuple* t = &tuples[shape.first->second];
+
+        uint32_t index = static_cast<uint32_t>(n);
+        uint32_t* head = t->insert(ruleKey(*t, r), index);
+        if (*head != index) {
+            next[n] = *head;
+            *head = index;
+        }
+        t->bestIndex = index;
+    }
+
+    std::sort(tuples.begin(), tuples.end(),
+              [](const Tuple& a, const Tuple& b) { return a.bestIndex < b.bestIndex; });
+    // Walking the sorted list keeps every partition's tuples in priority order.
+    for (size_t i = 0; i < tuples.size(); ++i) {
+        for (int p = 0; p < PARTITIONS; ++p) {
+            if (tuples[i].partition == PARTITIONS || tuples[i].partition == p)
+                byPartition[p].tuples.push_back(static_cast<uint32_t>(i));
+        }
+    }
+}
+
+int RuleClassifier::find(const PacketMeta& pkt) const {
+    const PartitionIndex& part = byPartition[partitionOf(pkt.protocol)];
+    if (rules.size() <= LINEAR_SCAN_MAX) {
+        for (uint32_t i : part.linear) {
+            if (rules[i].matches(pkt)) return static_cast<int>(i);
+        }
+        return NO_MATCH;
+    }
+
+    uint32_t best = END;
+    for (uint32_t ti : part.tuples) {
+        const Tuple& t = tuples[ti];
+        if (t.bestIndex >= best) break; // Nothing left can precede the current match
+        if (t.family && pkt.src.family != t.family) continue;
+
+        for (uint32_t i = t.lookup(packetKey(t, pkt)); i != END && i < best; i = next[i]) {
+            if (rules[i].matches(pkt)) {
+                best = i;
+                break;
+            }
+        }
+    }
+    return best == END ? NO_MATCH : static_cast<int>(best);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "compiled_rule.h"
+
+// Tuple-space-search classifier over a first-match rule list.
+//
+// Rules are grouped by their tuple: address family, source and destination
+// prefix lengths, and whether the source port, destination port and protocol
+// are exact values or not. Each tuple is a hash table keyed by the masked
+// addresses plus the exact fields, so a lookup costs one probe per tuple
+// instead of one compare per rule. Port ranges are hashed as wildcards and
+// checked on the candidates.
+//
+// Tuples are visited in order of the best (lowest) rule index they hold, and
+// the search stops once no remaining tuple can beat the match already found,
+// so find() returns exactly what a linear first-match scan would.
+//
+// Rules are also partitioned by protocol (TCP, UDP, ICMP/ICMPv6, other) at
+// build time: a packet only visits the tuples of its own partition plus the
+// tuples of protocol-wildcard rules, merged in by rule priority.
+class RuleClassifier {
+public:
+    static constexpr int NO_MATCH = -1;
+
+    // Rebuild from `rules`; index i has priority i (0 = checked first).
+    void build(const CompiledRule* rules, size_t count);
+    void clear();
+
+    // Index of the first rule (in list order) matching `pkt`, or NO_MATCH.
+    int find(const PacketMeta& pkt) const;
+
+    size_t ruleCount() const { return rules.size(); }
+    size_t tupleCount() const { return tuples.size(); }
+
+    enum Partition : uint8_t { TCP, UDP, ICMP, OTHER, PARTITIONS };
+    static Partition partitionOf(uint8_t protocol);
+    // Tuples a packet of `partition` visits (its own plus protocol-wildcard ones).
+    size_t tupleCount(Partition partition) const { return byPartition[partition].tuples.size(); }
+
+private:
+    static constexpr uint32_t END = UINT32_MAX;
+    // Below this many rules a plain scan beats hashing.
+    static constexpr size_t LINEAR_SCAN_MAX = 8;
+
+    struct Key {
+        uint32_t src[4];
+        uint32_t dst[4];
+        uint16_t srcPort;
+        uint16_t dstPort;
+        int16_t protocol;
+
+        bool operator==(const Key& o) const {
+            return std::memcmp(src, o.src, sizeof(src)) == 0 && std::memcmp(dst, o.dst, sizeof(dst)) == 0
+                && srcPort == o.srcPort && dstPort == o.dstPort && protocol == o.protocol;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const;
+    };
+
+    struct Tuple {
+        uint8_t family = 0;
+        uint8_t srcPrefix = 0;
+        uint8_t dstPrefix = 0;
+        bool exactSrcPort = false;
+        bool exactDstPort = false;
+        bool exactProtocol = false;
+        uint8_t partition = PARTITIONS;   // PARTITIONS: protocol wildcard, visited by every partition
+        uint32_t srcMask[4] = {};
+        uint32_t dstMask[4] = {};
+        uint32_t bestIndex = END;   // Lowest rule index in this tuple
+
+        // Open-addressing table (linear probing, power-of-two size):
+        // key -> first rule index of its chain. head == END marks a free slot.
+        struct Slot {
+            Key key;
+            uint32_t head = END;
+        };
+        std::vector<Slot> table;
+        size_t used = 0;
+
+        uint32_t* insert(const Key& key, uint32_t index);
+        uint32_t lookup(const Key& key) const;
+        void grow();
+    };
+
+    static uint32_t shapeOf(const CompiledRule& r);
+    static Key ruleKey(const Tuple& t, const CompiledRule& r);
+    static Key packetKey(const Tuple& t, const PacketMeta& pkt);
+
+    std::vector<CompiledRule> rules;
+    std::vector<uint32_t> next;   // Next rule index with the same tuple and key, ascending
+    std::vector<Tuple> tuples;    // Sorted by bestIndex
+
+    struct PartitionIndex {
+        std::vector<uint32_t> tuples;   // Into `tuples`, still sorted by bestIndex
+        std::vector<uint32_t> linear;   // Rule indices in order; only below LINEAR_SCAN_MAX
+    };
+    PartitionIndex byPartition[PARTITIONS];
+};
@@ -1,4 +1,7 @@
 #include "rule_engine.h"
+#include "packet_parser.h"
+#include "rule_journal.h"
+#include "rule_optimizer.h"
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QJsonDocument>
@@ -7,88 +10,273 @@
 #include <QMutexLocker>
 #include <QDebug>
 #include <QCoreApplication>
-#include <QEventLoop>
 #include <QTimer>
+#include <algorithm>
+#include <chrono>
+
+namespace {
+constexpr int DEFAULT_DECISION_TIMEOUT_MS = 30000;
+constexpr size_t MAX_PENDING_FLOWS = 1024;   // Beyond this, unknown flows are blocked unprompted
+constexpr size_t DEFAULT_FLOW_CACHE_ENTRIES = 16384;   // Per classifying thread
+
+qint64 monotonicMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::atomic<quint64> nextInstanceId{1};
+
+template <typename T>
+void bump(std::atomic<T>& counter, T n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+}
 
 // --- CONSTRUCTOR / DESTRUCTOR ---
 RuleEngine::RuleEngine(QObject* parent, const QString& rulesPath)
-    : QObject(parent), rulesPath(rulesPath), interactiveMode(false)
+    : QObject(parent), ruleSet(std::make_shared<RuleSet>()), rulesPath(rulesPath), interactiveMode(false),
+      pendingTimer(new QTimer(this)), decisionTimeoutMs(DEFAULT_DECISION_TIMEOUT_MS),
+      flowCacheCapacity(DEFAULT_FLOW_CACHE_ENTRIES), instanceId(nextInstanceId++)
 {
-    loadRules(rulesPath);
+    // userDecisionNeeded is emitted from capture threads.
+    qRegisterMetaType<PacketInfo>("PacketInfo");
+    if (!rulesPath.isEmpty())
+        journal.reset(new RuleJournal(rulesPath));
+    if (!loadRules(rulesPath) && journal) {
+        // No usable rules file yet: start from an empty list, plus whatever
+        // was journaled against an empty file before a crash.
+        QList<Rule> rules;
+        bool replayed = journal->replay(QByteArray(), rules) > 0;
+        QVector<CompiledRule> compiled;
+        for (const Rule& rule : rules)
+            compiled.append(compile(rule));
+        QMutexLocker locker(&writeMutex);
+        journal->start(QByteArray(), rulesOf(publish(rules, compiled, newIds(rules.size()))), replayed);
+    }
+
+    connect(pendingTimer, &QTimer::timeout, this, &RuleEngine::expirePendingDecisions);
+    pendingTimer->start(1000);
 }
 
-RuleEngine::~RuleEngine() {}
+RuleEngine::~RuleEngine() {
+    journal.reset(); // Writes out pending edits before the rules go away
+}
 
 // --- INTERFACE ---
 
 void RuleEngine::setInteractiveMode(bool enabled) {
-    QMutexLocker locker(&mutex);
-    interactiveMode = enabled;
+    if (interactiveMode.exchange(enabled) != enabled)
+        emit interactiveModeChanged(enabled);
+    if (enabled) return;
+
+    // Nobody will be asked any more: drop what is still held.
+    QList<FlowKey> released;
+    {
+        QMutexLocker locker(&pendingMutex);
+        for (const auto& entry : pending) {
+            if (!entry.second.expired) released.append(entry.first);
+        }
+        pending.clear();
+    }
+    for (const FlowKey& flow : released)
+        emit flowResolved(flow, true);
+}
+
+void RuleEngine::setDecisionTimeout(int ms) {
+    decisionTimeoutMs = ms;
+}
+
+RuleText RuleEngine::textOf(const Rule& rule) {
+    RuleText text;
+    text.srcIp = rule.srcIp.toStdString();
+    text.dstIp = rule.dstIp.toStdString();
+    text.srcPort = rule.srcPort.toStdString();
+    text.dstPort = rule.dstPort.toStdString();
+    text.protocol = rule.protocol.toStdString();
+    text.action = rule.action.toStdString();
+    return text;
+}
+
+CompiledRule RuleEngine::compile(const Rule& rule) {
+    CompiledRule c;
+    if (!compileRule(textOf(rule), c))
+        qWarning() << "Rule will never match, unparsable field:" << rule.srcIp << rule.dstIp
+                   << rule.srcPort << rule.dstPort << rule.protocol;
+    return c;
+}
+
+RuleEngine::RuleSetPtr RuleEngine::publish(QList<Rule> rules, QVector<CompiledRule> compiled, QVector<quint64> ids) {
+    auto next = std::make_shared<RuleSet>();
+    next->rules = std::move(rules);
+    next->compiled = std::move(compiled);
+    next->ids = std::move(ids);
+    next->idLimit = nextRuleId;
+    next->generation = nextGeneration++;
+    next->classifier.build(next->compiled.data(), static_cast<size_t>(next->compiled.size()));
+    RuleSetPtr published(std::move(next));
+    std::atomic_store(&ruleSet, published);
+    return published;
+}
+
+QVector<quint64> RuleEngine::newIds(int count) {
+    QVector<quint64> ids;
+    ids.reserve(count);
+    for (int i = 0; i < count; ++i)
+        ids.append(nextRuleId++);
+    return ids;
 }
 
-bool RuleEngine::matchRule(const Rule& rule, const PacketInfo& pkt) const {
-    auto matchField = [](const QString& ruleVal, const QString& pktVal) {
-        return ruleVal.isEmpty() || ruleVal == "*" || ruleVal == pktVal;
-    };
-    return matchField(rule.srcIp, pkt.srcIp)
-        && matchField(rule.dstIp, pkt.dstIp)
-        && matchField(rule.srcPort, pkt.srcPort)
-        && matchField(rule.dstPort, pkt.dstPort);
+std::shared_ptr<const QList<Rule>> RuleEngine::rulesOf(const RuleSetPtr& set) {
+    return std::shared_ptr<const QList<Rule>>(set, &set->rules);
 }
 
 QString RuleEngine::decide(const PacketInfo& pkt) {
-    QMutexLocker locker(&mutex);
-    for (const Rule& rule : rules) {
-        if (matchRule(rule, pkt)) {
-            return rule.action.toLower();
-        }
+    PacketMeta meta;
+    IpAddr::parse(pkt.srcIp.toStdString(), meta.src);
+    IpAddr::parse(pkt.dstIp.toStdString(), meta.dst);
+    meta.srcPort = static_cast<uint16_t>(pkt.srcPort.toInt());
+    meta.dstPort = static_cast<uint16_t>(pkt.dstPort.toInt());
+    int16_t protocol = 0;
+    if (parseProtocol(pkt.protocol.toStdString(), protocol) && protocol >= 0)
+        meta.protocol = static_cast<uint8_t>(protocol);
+
+    RuleSetPtr set = snapshot();
+    int idx = set->classifier.find(meta);
+    if (idx >= 0)
+        return set->rules[idx].action.toLower();
+    if (interactiveMode)
+        requestDecision(FlowKey::of(meta), &pkt);
+    return "block"; // Default action
+}
+
+RuleDecision RuleEngine::requestDecision(const FlowKey& flow, const PacketInfo* info) {
+    {
+        QMutexLocker locker(&pendingMutex);
+        auto it = pending.find(flow);
+        if (it != pending.end())
+            return it->second.expired ? RuleDecision::Block : RuleDecision::Pending;
+        if (pending.size() >= MAX_PENDING_FLOWS)
+            return RuleDecision::Block;
+        pending.emplace(flow, PendingFlow{monotonicMs() + decisionTimeoutMs, false});
     }
+    // Queued to the GUI thread; the capture thread does not wait for it.
+    emit userDecisionNeeded(info ? *info : describe(flow));
+    return RuleDecision::Pending;
+}
+
+void RuleEngine::resolveDecision(const PacketInfo& pkt, const QString& action) {
+    // Publish the learned rule first: from here on new packets of the flow
+    // match it, and only those already parked need releasing.
+    Rule newRule;
+    newRule.srcIp = pkt.srcIp;
+    newRule.dstIp = pkt.dstIp;
+    newRule.srcPort = pkt.srcPort;
+    newRule.dstPort = pkt.dstPort;
+    newRule.protocol = pkt.protocol;
+    newRule.action = action.toLower();
+    addRule(newRule); // Persists and emits rulesChanged
+
+    FlowKey flow = flowOf(pkt);
+    {
+        QMutexLocker locker(&pendingMutex);
+        pending.erase(flow);
+    }
+    emit flowResolved(flow, parseVerdict(newRule.action.toStdString()) == RuleVerdict::Block);
+}
 
-    if (interactiveMode) {
-        // Interactive mode: ask user via GUI and wait for response
-        QString userDecision = askUserForDecision(pkt);
-        if (!userDecision.isEmpty()) {
-            // Add rule for future packets
-            Rule newRule;
-            newRule.srcIp = pkt.srcIp;
-            newRule.dstIp = pkt.dstIp;
-            newRule.srcPort = pkt.srcPort;
-            newRule.dstPort = pkt.dstPort;
-            newRule.action = userDecision;
-            rules.push_front(newRule);
-            saveRules(rulesPath); // Persist new rule
-            return userDecision;
+void RuleEngine::expirePendingDecisions() {
+    // Timeout: drop the held packets (auto-block) but keep the entry so the
+    // flow is not prompted again while the dialog may still be open.
+    QList<FlowKey> expired;
+    {
+        QMutexLocker locker(&pendingMutex);
+        qint64 now = monotonicMs();
+        for (auto& entry : pending) {
+            if (!entry.second.expired && entry.second.deadlineMs <= now) {
+                entry.second.expired = true;
+                expired.append(entry.first);
+            }
         }
     }
-    return "block"; // Default action
+    for (const FlowKey& flow : expired)
+        emit flowResolved(flow, true);
+}
+
+PacketInfo RuleEngine::describe(const FlowKey& flow) {
+    char protoBuf[8];
+    PacketInfo pkt;
+    pkt.srcIp = QString::fromStdString(flow.src.toString());
+    pkt.dstIp = QString::fromStdString(flow.dst.toString());
+    pkt.srcPort = QString::number(flow.srcPort);
+    pkt.dstPort = QString::number(flow.dstPort);
+    pkt.protocol = QString::fromLatin1(protocolName(flow.protocol, protoBuf, sizeof(protoBuf)));
+    return pkt;
+}
+
+FlowKey RuleEngine::flowOf(const PacketInfo& pkt) {
+    FlowKey flow;
+    IpAddr::parse(pkt.srcIp.toStdString(), flow.src);
+    IpAddr::parse(pkt.dstIp.toStdString(), flow.dst);
+    flow.srcPort = static_cast<uint16_t>(pkt.srcPort.toInt());
+    flow.dstPort = static_cast<uint16_t>(pkt.dstPort.toInt());
+    int16_t protocol = 0;
+    if (parseProtocol(pkt.protocol.toStdString(), protocol) && protocol >= 0)
+        flow.protocol = static_cast<uint8_t>(protocol);
+    return flow;
 }
 
 void RuleEngine::addRule(const Rule& rule) {
-    QMutexLocker locker(&mutex);
+    QMutexLocker locker(&writeMutex);
+    RuleSetPtr cur = snapshot();
+    QList<Rule> rules = cur->rules;
+    QVector<CompiledRule> compiled = cur->compiled;
+    QVector<quint64> ids = cur->ids;
     rules.push_front(rule);
-    saveRules(rulesPath);
+    compiled.prepend(compile(rule));
+    ids.prepend(nextRuleId++);
+    RuleSetPtr set = publish(rules, compiled, ids);
+    if (journal) journal->recordAdd(rule, rulesOf(set));
+    emit rulesChanged();
 }
 
 void RuleEngine::removeRule(int index) {
-    QMutexLocker locker(&mutex);
-    if (index >= 0 && index < rules.size())
-        rules.removeAt(index);
-    saveRules(rulesPath);
+    QMutexLocker locker(&writeMutex);
+    RuleSetPtr cur = snapshot();
+    QList<Rule> rules = cur->rules;
+    QVector<CompiledRule> compiled = cur->compiled;
+    QVector<quint64> ids = cur->ids;
+    if (index < 0 || index >= rules.size())
+        return;
+    rules.removeAt(index);
+    compiled.removeAt(index);
+    ids.removeAt(index);
+    RuleSetPtr set = publish(rules, compiled, ids);
+    if (journal) journal->recordRemove(index, rulesOf(set));
+    emit rulesChanged();
 }
 
 void RuleEngine::clearRules() {
-    QMutexLocker locker(&mutex);
-    rules.clear();
-    saveRules(rulesPath);
+    QMutexLocker locker(&writeMutex);
+    RuleSetPtr set = publish(QList<Rule>(), QVector<CompiledRule>(), QVector<quint64>());
+    if (journal) journal->recordClear(rulesOf(set));
+    emit rulesChanged();
 }
 
 QList<Rule> RuleEngine::getRules() const {
-    QMutexLocker locker(&mutex);
-    return rules;
+    return snapshot()->rules;
+}
+
+QVector<CompiledRule> RuleEngine::compiledRules() const {
+    return snapshot()->compiled;
 }
 
 bool RuleEngine::loadRules(const QString& path) {
-    QMutexLocker locker(&mutex);
+    // Parse and compile before taking the writer lock; readers keep using the
+    // current set until the new one is published.
+    bool ownFile = journal && path == rulesPath;
+    if (ownFile && journal->isStarted())
+        journal->flush(); // Reloading: let the file catch up with our edits first
+
     QFile file(path);
     if (!file.open(QIODevice::ReadOnly)) {
         qWarning() << "Failed to open rule file:" << path;
@@ -104,75 +292,245 @@ bool RuleEngine::loadRules(const QString& path) {
         return false;
     }
 
-    rules.clear();
+    QList<Rule> rules;
     QJsonArray arr = doc.array();
     for (const QJsonValue& val : arr) {
         if (!val.isObject()) continue;
-        QJsonObject obj = val.toObject();
-        Rule rule;
-        rule.srcIp = obj.value("src_ip").toString();
-        rule.dstIp = obj.value("dst_ip").toString();
-        rule.srcPort = obj.value("src_port").toString();
-        rule.dstPort = obj.value("dst_port").toString();
-        rule.action = obj.value("action").toString().toLower();
-        rules.append(rule);
+        rules.append(RuleJournal::fromJson(val.toObject()));
     }
+
+    // First load of our own file: apply edits journaled after its last
+    // compaction (e.g. before a crash).
+    bool firstLoad = ownFile && !journal->isStarted();
+    int replayed = firstLoad ? journal->replay(data, rules) : 0;
+
+    QVector<CompiledRule> compiled;
+    for (const Rule& rule : rules)
+        compiled.append(compile(rule));
+
+    QMutexLocker locker(&writeMutex);
+    RuleSetPtr set = publish(rules, compiled, newIds(rules.size()));
+    if (firstLoad)
+        journal->start(data, rulesOf(set), replayed > 0);
+    else if (journal && !ownFile)
+        journal->recordReplace(rulesOf(set));
+    emit rulesChanged();
     return true;
 }
 
-bool RuleEngine::saveRules(const QString& path) const {
-    QMutexLocker locker(&mutex);
-    QJsonArray arr;
-    for (const Rule& rule : rules) {
-        QJsonObject obj;
-        obj["src_ip"] = rule.srcIp;
-        obj["dst_ip"] = rule.dstIp;
-        obj["src_port"] = rule.srcPort;
-        obj["dst_port"] = rule.dstPort;
-        obj["action"] = rule.action;
-        arr.append(obj);
-    }
-    QJsonDocument doc(arr);
-    QFile file(path);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-        qWarning() << "Failed to open rule file for writing:" << path;
+RuleOptimizationReport RuleEngine::analyzeRules() const {
+    RuleSetPtr set = snapshot();
+    std::vector<RuleText> texts;
+    texts.reserve(set->rules.size());
+    for (const Rule& rule : set->rules)
+        texts.push_back(textOf(rule));
+    std::vector<CompiledRule> compiled(set->compiled.begin(), set->compiled.end());
+
+    RuleOptimization result = optimizeRules(texts, compiled);
+    measureRuleLookup(compiled, result);
+
+    RuleOptimizationReport report;
+    for (size_t i = 0; i < result.rules.size(); ++i) {
+        int origin = result.origin[i];
+        if (origin >= 0) {
+            report.rules.append(set->rules[origin]);
+        } else {
+            const RuleText& text = result.rules[i];
+            Rule rule;
+            rule.srcIp = QString::fromStdString(text.srcIp);
+            rule.dstIp = QString::fromStdString(text.dstIp);
+            rule.srcPort = QString::fromStdString(text.srcPort);
+            rule.dstPort = QString::fromStdString(text.dstPort);
+            rule.protocol = QString::fromStdString(text.protocol);
+            rule.action = QString::fromStdString(text.action);
+            report.rules.append(rule);
+        }
+        report.origin.append(origin);
+    }
+    report.rulesBefore = set->rules.size();
+    report.neverMatching = static_cast<int>(result.neverMatching);
+    report.shadowed = static_cast<int>(result.shadowed);
+    report.redundant = static_cast<int>(result.redundant);
+    report.merged = static_cast<int>(result.merged);
+    report.nsPerLookupBefore = result.nsPerLookupBefore;
+    report.nsPerLookupAfter = result.nsPerLookupAfter;
+    report.verified = result.verified;
+    report.generation = set->generation;
+    return report;
+}
+
+bool RuleEngine::applyOptimizedRules(const RuleOptimizationReport& report) {
+    QMutexLocker locker(&writeMutex);
+    RuleSetPtr cur = snapshot();
+    if (cur->generation != report.generation) {
+        qWarning() << "Rules changed since they were analyzed, not applying the optimization";
         return false;
     }
-    file.write(doc.toJson());
-    file.close();
+    if (!report.verified) {
+        qWarning() << "Optimized rules did not verify, not applying them";
+        return false;
+    }
+
+    QVector<CompiledRule> compiled;
+    QVector<quint64> ids;
+    for (int i = 0; i < report.rules.size(); ++i) {
+        int origin = i < report.origin.size() ? report.origin[i] : -1;
+        compiled.append(origin >= 0 ? cur->compiled[origin] : compile(report.rules[i]));
+        ids.append(origin >= 0 ? cur->ids[origin] : nextRuleId++);
+    }
+    RuleSetPtr set = publish(report.rules, compiled, ids);
+    if (journal) journal->recordReplace(rulesOf(set));
+    emit rulesChanged();
     return true;
 }
 
-// --- INTERACTIVE MODE IMPLEMENTATION ---
+bool RuleEngine::saveRules(const QString& path) const {
+    if (journal && path == rulesPath)
+        return journal->flush();
+    return RuleJournal::writeRulesFile(snapshot()->rules, path);
+}
+
+// --- REQUIRED FOR PACKET CAPTURE INTEGRATION ---
+RuleDecision RuleEngine::classify(const PacketMeta& meta) {
+    // Lock-free with respect to writers: this set stays valid while we hold it.
+    RuleSetPtr set = snapshot();
+    ThreadShard* shard = localShard();
+    if (shard->set != set)
+        rebindShard(*shard, set); // Only after the rules changed
+    int idx = lookup(*shard, meta);
+    countHit(*shard, idx, meta.wireLen);
+    if (idx >= 0)
+        return set->compiled[idx].verdict == RuleVerdict::Block ? RuleDecision::Block : RuleDecision::Allow;
+    if (!interactiveMode)
+        return RuleDecision::Block; // Default action
+    return requestDecision(FlowKey::of(meta), nullptr);
+}
+
+// --- RULE STATISTICS ---
+RuleEngine::ThreadShard* RuleEngine::localShard() {
+    // Almost always a single entry: one engine per process.
+    thread_local std::vector<std::pair<quint64, ThreadShard*>> cache;
+    for (const auto& entry : cache) {
+        if (entry.first == instanceId) return entry.second;
+    }
+    QMutexLocker locker(&statsMutex);
+    shards.emplace_back(new ThreadShard);
+    cache.emplace_back(instanceId, shards.back().get());
+    return shards.back().get();
+}
+
+void RuleEngine::rebindShard(ThreadShard& shard, const RuleSetPtr& set) {
+    std::unique_ptr<RuleCounter[]> fresh(new RuleCounter[set->rules.size()]);
+    // The generation stamp already invalidated the cache; only a resize needs a new one.
+    size_t capacity = flowCacheCapacity.load(std::memory_order_relaxed);
+    bool resize = capacity != (shard.flowCache ? shard.flowCache->capacity() : 0);
+    std::unique_ptr<FlowCache> cache(resize && capacity ? new FlowCache(capacity) : nullptr);
 
-// This function emits a signal and waits for the GUI to respond.
-// It uses an event loop to block until the user makes a decision or timeout occurs.
-QString RuleEngine::askUserForDecision(const PacketInfo& pkt) {
-    QString decision;
-    QEventLoop loop;
-    QTimer timer;
-    timer.setSingleShot(true);
+    QMutexLocker locker(&statsMutex);
+    if (shard.set) {
+        for (int i = 0; i < shard.set->ids.size(); ++i)
+            addCounter(retired[shard.set->ids[i]], shard.counters[i]);
+    }
+    shard.set = set;
+    shard.counters = std::move(fresh);
+    if (resize) shard.flowCache = std::move(cache);
+}
 
-    // Connect a lambda to receive the user's decision from the GUI
-    connect(this, &RuleEngine::userDecisionReceived, &loop, [&](const QString& userAction) {
-        decision = userAction.toLower();
-        loop.quit();
-    });
+int RuleEngine::lookup(ThreadShard& shard, const PacketMeta& meta) {
+    const RuleSet& set = *shard.set;
+    FlowCache* cache = shard.flowCache.get();
+    if (!cache)
+        return set.classifier.find(meta);
 
-    // Timeout after 30 seconds (auto-block)
-    connect(&timer, &QTimer::timeout, &loop, [&]() {
-        decision = "block";
-        loop.quit();
-    });
+    // Everything the classifier matches on is in the 5-tuple.
+    FlowKey key = FlowKey::of(meta);
+    size_t hash = key.hash();
+    int idx = cache->find(key, hash, set.generation);
+    if (idx == FlowCache::MISS) {
+        idx = set.classifier.find(meta);
+        cache->insert(key, hash, set.generation, idx);
+    }
+    return idx;
+}
 
-    emit userDecisionNeeded(pkt); // Signal to GUI to prompt user
-    timer.start(30000); // 30 seconds
-    loop.exec();
+void RuleEngine::countHit(ThreadShard& shard, int idx, size_t bytes) {
+    RuleCounter& counter = idx >= 0 ? shard.counters[idx] : shard.defaults;
+    bump<quint64>(counter.hits);
+    bump<quint64>(counter.bytes, bytes);
+    counter.lastHit.store(std::time(nullptr), std::memory_order_relaxed);
+}
 
-    return decision;
+void RuleEngine::addCounter(RuleStats& total, const RuleCounter& counter) {
+    total.hits += counter.hits.load(std::memory_order_relaxed);
+    total.bytes += counter.bytes.load(std::memory_order_relaxed);
+    total.lastHit = std::max(total.lastHit, counter.lastHit.load(std::memory_order_relaxed));
+}
+
+RuleStatsReport RuleEngine::ruleStats() const {
+    RuleSetPtr set = snapshot();
+    RuleStatsReport report;
+    report.rules = set->rules;
+    report.stats.resize(set->rules.size());
+
+    std::unordered_map<quint64, int> indexOf;
+    for (int i = 0; i < set->ids.size(); ++i)
+        indexOf.emplace(set->ids[i], i);
+
+    QMutexLocker locker(&statsMutex);
+    for (const auto& shard : shards) {
+        addCounter(report.defaultPolicy, shard->defaults);
+        if (!shard->set) continue;
+        for (int i = 0; i < shard->set->ids.size(); ++i) {
+            auto it = indexOf.find(shard->set->ids[i]);
+            if (it != indexOf.end())
+                addCounter(report.stats[it->second], shard->counters[i]);
+        }
+    }
+    for (auto it = retired.begin(); it != retired.end(); ) {
+        auto idx = indexOf.find(it->first);
+        if (idx != indexOf.end()) {
+            RuleStats& total = report.stats[idx->second];
+            total.hits += it->second.hits;
+            total.bytes += it->second.bytes;
+            total.lastHit = std::max(total.lastHit, it->second.lastHit);
+            ++it;
+        } else if (it->first < set->idLimit) {
+            // Removed (ids are never reused): nothing will report it again.
+            it = retired.erase(it);
+        } else {
+            ++it; // Added after our snapshot
+        }
+    }
+    return report;
+}
+
+void RuleEngine::setFlowCacheCapacity(size_t entries) {
+    flowCacheCapacity = entries;
+    // Republish the same rules: every thread rebinds and resizes its cache.
+    QMutexLocker locker(&writeMutex);
+    RuleSetPtr cur = snapshot();
+    publish(cur->rules, cur->compiled, cur->ids);
+}
+
+FlowCacheStats RuleEngine::flowCacheStats() const {
+    FlowCacheStats total;
+    QMutexLocker locker(&statsMutex);
+    for (const auto& shard : shards) {
+        if (!shard->flowCache) continue;
+        FlowCacheStats s = shard->flowCache->stats();
+        total.lookups += s.lookups;
+        total.hits += s.hits;
+        total.evictions += s.evictions;
+        total.occupancy += s.occupancy;
+        total.capacity += s.capacity;
+    }
+    return total;
+}
+
+bool RuleEngine::shouldBlock(const PacketMeta& meta) {
+    return classify(meta) != RuleDecision::Allow;
 }
 
-// --- REQUIRED FOR PACKET CAPTURE INTEGRATION ---
 bool RuleEngine::shouldBlock(const std::string& src_ip,
                              const std::string& dst_ip,
                              int src_port,
@@ -188,6 +546,5 @@ bool RuleEngine::shouldBlock(const std::string& src_ip,
     pkt.dstPort = QString::number(dst_port);
     pkt.protocol = QString::fromStdString(protocol);
 
-    QString action = decide(pkt);
-    return action == "block";
+    return parseVerdict(decide(pkt).toStdString()) == RuleVerdict::Block;
 }
\ No newline at end of file
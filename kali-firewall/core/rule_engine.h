@@ -5,6 +5,20 @@
 #include <QList>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QVector>
+#include <QMetaType>
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "compiled_rule.h"
+#include "flow_cache.h"
+#include "flow_key.h"
+#include "rule_classifier.h"
+
+class QTimer;
+class RuleJournal;
 
 // Structure for packet info
 struct PacketInfo {
@@ -17,11 +31,58 @@ struct PacketInfo {
 
 // Structure for a firewall rule
 struct Rule {
-    QString srcIp;
+    QString srcIp;    // Address, CIDR prefix, or "*"
     QString dstIp;
-    QString srcPort;
+    QString srcPort;  // Port, "lo-hi" range, or "*"/"0" for any
     QString dstPort;
-    QString action; // "allow" or "block"
+    QString protocol; // "tcp", "udp", ..., a number, or empty for any
+    QString action;   // "allow" or "block" ("drop", "deny" and "reject" also block)
+
+    // Same fields: matches the same packets, with the same verdict.
+    bool operator==(const Rule& o) const {
+        return srcIp == o.srcIp && dstIp == o.dstIp && srcPort == o.srcPort
+            && dstPort == o.dstPort && protocol == o.protocol && action == o.action;
+    }
+    bool operator!=(const Rule& o) const { return !(*this == o); }
+};
+
+// Traffic that RuleEngine::classify attributed to one rule (or to the default policy).
+struct RuleStats {
+    quint64 hits = 0;
+    quint64 bytes = 0;        // IP-level bytes (PacketMeta::wireLen)
+    std::time_t lastHit = 0;  // 0 if never hit
+};
+
+// The rule list and its counters, taken from the same rule set.
+struct RuleStatsReport {
+    QList<Rule> rules;
+    QVector<RuleStats> stats;   // Index for index with `rules`
+    RuleStats defaultPolicy;    // Packets no rule matched
+};
+
+// What RuleEngine::analyzeRules found: a shorter rule list with the same
+// verdicts, and how much it saves.
+struct RuleOptimizationReport {
+    QList<Rule> rules;          // The optimized list
+    QVector<int> origin;        // Index of each rule in the analyzed list, -1 if merged
+    int rulesBefore = 0;
+    int neverMatching = 0;
+    int shadowed = 0;
+    int redundant = 0;
+    int merged = 0;
+    double nsPerLookupBefore = 0;
+    double nsPerLookupAfter = 0;
+    bool verified = false;      // Sampled packets got the same verdicts from both lists
+    quint64 generation = 0;     // Rule set it was computed from
+
+    int removed() const { return rulesBefore - rules.size(); }
+};
+
+// Outcome of RuleEngine::classify for one packet.
+enum class RuleDecision {
+    Allow,
+    Block,
+    Pending   // Interactive mode, waiting for the user: hold the packet
 };
 
 class RuleEngine : public QObject {
@@ -31,15 +92,63 @@ public:
     ~RuleEngine();
 
     void setInteractiveMode(bool enabled);
+    bool isInteractiveMode() const { return interactiveMode; }
+    // Text form. An unknown connection in interactive mode is prompted for
+    // and reported as "block" until the user answers.
     QString decide(const PacketInfo& pkt);
+    // Edits take effect at once; persisting them to the rules file is
+    // write-behind (see RuleJournal) and never blocks the caller on disk.
     void addRule(const Rule& rule);
     void removeRule(int index);
     void clearRules();
     QList<Rule> getRules() const;
+    // Integer form of getRules(), index for index (used by NftOffload).
+    QVector<CompiledRule> compiledRules() const;
     bool loadRules(const QString& path);
+    // Saving to the engine's own rules file waits for the pending edits to be
+    // compacted into it; any other path gets a snapshot of the current rules.
     bool saveRules(const QString& path) const;
 
-    // For packet_capture.cpp integration
+    // For packet_capture.cpp integration. Matches on the binary fields only;
+    // never blocks. In interactive mode a packet of an unknown flow returns
+    // Pending: the flow is parked in the pending table (userDecisionNeeded is
+    // emitted once per flow) and the caller holds the packet until
+    // flowResolved is emitted for it. Flows whose prompt timed out are
+    // blocked until the user answers.
+    RuleDecision classify(const PacketMeta& meta);
+    // classify() with Pending counted as a block.
+    bool shouldBlock(const PacketMeta& meta);
+
+    // The user's answer for a prompted connection: learns a rule for it and
+    // releases the flow's held packets.
+    void resolveDecision(const PacketInfo& pkt, const QString& action);
+
+    // How long a prompted flow is held before its packets are dropped (default 30 s).
+    void setDecisionTimeout(int ms);
+
+    // Per-rule hit/byte counters and last-hit times for the packets seen by
+    // classify(). A rule keeps its counters while other rules are added or
+    // removed; reloading the rule file starts them over.
+    RuleStatsReport ruleStats() const;
+
+    // Runs the rule optimizer (see rule_optimizer.h) over the current rules
+    // and times lookups before and after. Changes nothing; takes a while on
+    // large rule sets, so keep it off the packet path.
+    RuleOptimizationReport analyzeRules() const;
+    // Replaces the rules with report.rules. Refused (false) when the rules
+    // changed since the analysis or the result was not verified. Rules taken
+    // over unchanged keep their counters.
+    bool applyOptimizedRules(const RuleOptimizationReport& report);
+
+    // Every classifying thread keeps a flow cache of this many entries
+    // (default 16384, 0 disables it) mapping a 5-tuple to the rule it matched.
+    // Entries are stamped with the rule-set generation, so any rule change
+    // invalidates them at once.
+    void setFlowCacheCapacity(size_t entries);
+    // Summed over the classifying threads.
+    FlowCacheStats flowCacheStats() const;
+
+    // String form, kept for callers that only have text addresses.
     bool shouldBlock(const std::string& src_ip,
                      const std::string& dst_ip,
                      int src_port,
@@ -50,14 +159,96 @@ public:
 
 signals:
     void userDecisionNeeded(const PacketInfo& pkt);
-    void userDecisionReceived(const QString& action);
+    // The packets held for `flow` can be released: dropped if `block`, else accepted.
+    void flowResolved(const FlowKey& flow, bool block);
+    // Emitted whenever the rule list changes (edits, loads, interactive decisions).
+    void rulesChanged();
+    void interactiveModeChanged(bool enabled);
+
+private slots:
+    void expirePendingDecisions();
 
 private:
-    bool matchRule(const Rule& rule, const PacketInfo& pkt) const;
-    QString askUserForDecision(const PacketInfo& pkt);
+    // One immutable, published version of the rule list. The packet path takes
+    // a reference with std::atomic_load and never waits for writers; writers
+    // (GUI edits, loads, interactive answers) build a new RuleSet off to the
+    // side under writeMutex and swap it in with std::atomic_store. The old set
+    // is freed when its last reader drops it.
+    struct RuleSet {
+        QList<Rule> rules;
+        QVector<CompiledRule> compiled;   // Mirrors `rules` index for index
+        QVector<quint64> ids;             // Stable rule identities, same order
+        quint64 idLimit = 0;              // Every id below it was assigned when this set was built
+        quint64 generation = 0;           // Bumped on every publish; stamps flow cache entries
+        RuleClassifier classifier;        // Indexes `compiled`
+    };
+    using RuleSetPtr = std::shared_ptr<const RuleSet>;
 
-    QList<Rule> rules;
+    RuleSetPtr snapshot() const { return std::atomic_load(&ruleSet); }
+    // Builds the classifier and publishes. Caller holds writeMutex.
+    RuleSetPtr publish(QList<Rule> rules, QVector<CompiledRule> compiled, QVector<quint64> ids);
+    // Fresh ids for a whole new rule list. Caller holds writeMutex.
+    QVector<quint64> newIds(int count);
+    // The rule list of `set`, sharing its ownership (handed to the journal).
+    static std::shared_ptr<const QList<Rule>> rulesOf(const RuleSetPtr& set);
+
+    // A rule with a field that does not parse never matches.
+    static CompiledRule compile(const Rule& rule);
+    static RuleText textOf(const Rule& rule);
+    // No rule matched in interactive mode: park the flow (prompting once)
+    // or report an earlier timeout. `info` is built from the key if null.
+    RuleDecision requestDecision(const FlowKey& flow, const PacketInfo* info);
+    static PacketInfo describe(const FlowKey& flow);
+    static FlowKey flowOf(const PacketInfo& pkt);
+
+    RuleSetPtr ruleSet;
     QString rulesPath;
-    bool interactiveMode;
-    mutable QMutex mutex;
-};
\ No newline at end of file
+    std::unique_ptr<RuleJournal> journal;   // Null without a rules path
+    std::atomic<bool> interactiveMode;
+    QMutex writeMutex;   // Serializes writers only; readers never take it
+
+    // Flows waiting on the user. Only touched for unknown flows in interactive mode.
+    struct PendingFlow {
+        qint64 deadlineMs;
+        bool expired;   // Timed out: block until the user answers, don't prompt again
+    };
+    std::unordered_map<FlowKey, PendingFlow, FlowKeyHash> pending;
+    QMutex pendingMutex;
+    QTimer* pendingTimer;
+    std::atomic<int> decisionTimeoutMs;
+
+    // Per-thread state of classify(): rule counters and the flow cache. Every
+    // thread that calls classify() gets its own shard, written only by that
+    // thread (relaxed load + store, no locked read-modify-write) and aligned
+    // to its own cache line; ruleStats() sums the shards. A shard is bound to
+    // one rule set: when a thread first sees a newer set it folds its counters
+    // into `retired` by rule id.
+    struct RuleCounter {
+        std::atomic<quint64> hits{0};
+        std::atomic<quint64> bytes{0};
+        std::atomic<std::time_t> lastHit{0};
+    };
+    struct alignas(64) ThreadShard {
+        RuleSetPtr set;                             // What `counters` is indexed for
+        std::unique_ptr<RuleCounter[]> counters;
+        RuleCounter defaults;
+        std::unique_ptr<FlowCache> flowCache;       // Null when disabled
+    };
+
+    ThreadShard* localShard();
+    void rebindShard(ThreadShard& shard, const RuleSetPtr& set);
+    // Rule index for `meta` under shard.set, through the flow cache.
+    static int lookup(ThreadShard& shard, const PacketMeta& meta);
+    static void countHit(ThreadShard& shard, int idx, size_t bytes);
+    static void addCounter(RuleStats& total, const RuleCounter& counter);
+
+    quint64 nextRuleId = 0;       // Guarded by writeMutex
+    quint64 nextGeneration = 1;   // Guarded by writeMutex
+    std::atomic<size_t> flowCacheCapacity;
+    const quint64 instanceId;     // Tells engines apart in the per-thread shard cache
+    mutable QMutex statsMutex;    // Shard list, shard rebinding, `retired`
+    std::vector<std::unique_ptr<ThreadShard>> shards;
+    mutable std::unordered_map<quint64, RuleStats> retired;   // By rule id; ruleStats() prunes removed rules
+};
+
+Q_DECLARE_METATYPE(PacketInfo)
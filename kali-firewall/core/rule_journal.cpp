@@ -0,0 +1,283 @@
+#include "rule_journal.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QSaveFile>
+#include <chrono>
+
+namespace {
+constexpr size_t COMPACT_EVERY = 512;     // Journal entries before a compaction is forced
+constexpr int COMPACT_IDLE_MS = 2000;     // Otherwise compact once edits pause this long
+
+QByteArray checksumOf(const QByteArray& data) {
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+// Ports are JSON numbers when written by the rule editor ("0" = any) and
+// strings for ranges or "*"; keep whichever form the file used.
+QString portField(const QJsonValue& v) {
+    return v.isDouble() ? QString::number(v.toInt()) : v.toString();
+}
+
+QJsonValue portJson(const QString& port) {
+    bool ok = false;
+    int n = port.toInt(&ok);
+    return ok ? QJsonValue(n) : QJsonValue(port);
+}
+
+QByteArray entryLine(const QJsonObject& obj) {
+    return QJsonDocument(obj).toJson(QJsonDocument::Compact) + '\n';
+}
+}
+
+RuleJournal::RuleJournal(const QString& rulesPath)
+    : rulesPath(rulesPath), journalPath(rulesPath + ".journal") {}
+
+RuleJournal::~RuleJournal() {
+    if (!running) return;
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+    }
+    cv.notify_all();
+    if (writer.joinable())
+        writer.join();
+}
+
+QJsonObject RuleJournal::toJson(const Rule& rule) {
+    QJsonObject obj;
+    obj["src_ip"] = rule.srcIp;
+    obj["dst_ip"] = rule.dstIp;
+    obj["src_port"] = portJson(rule.srcPort);
+    obj["dst_port"] = portJson(rule.dstPort);
+    if (!rule.protocol.isEmpty())
+        obj["protocol"] = rule.protocol;
+    obj["action"] = rule.action;
+    return obj;
+}
+
+Rule RuleJournal::fromJson(const QJsonObject& obj) {
+    Rule rule;
+    rule.srcIp = obj.value("src_ip").toString();
+    rule.dstIp = obj.value("dst_ip").toString();
+    rule.srcPort = portField(obj.value("src_port"));
+    rule.dstPort = portField(obj.value("dst_port"));
+    rule.protocol = obj.value("protocol").toString();
+    rule.action = obj.value("action").toString();
+    return rule;
+}
+
+bool RuleJournal::writeRulesFile(const QList<Rule>& rules, const QString& path, QByteArray* written) {
+    QJsonArray arr;
+    for (const Rule& rule : rules)
+        arr.append(toJson(rule));
+    QByteArray data = QJsonDocument(arr).toJson();
+
+    // Written to a temporary file and renamed over the target on commit, so
+    // a crash leaves either the old or the new file, never a torn one.
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to open rule file for writing:" << path;
+        return false;
+    }
+    file.write(data);
+    if (!file.commit()) {
+        qWarning() << "Failed to write rule file:" << path << file.errorString();
+        return false;
+    }
+    if (written) *written = data;
+    return true;
+}
+
+int RuleJournal::replay(const QByteArray& fileData, QList<Rule>& rules) {
+    QFile file(journalPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+
+    QByteArray header = file.readLine().trimmed();
+    QJsonObject head = QJsonDocument::fromJson(header).object();
+    if (head.value("checkpoint").toString().toLatin1() != checksumOf(fileData)) {
+        qWarning() << "Ignoring rule journal for a different rule file:" << journalPath;
+        return 0;
+    }
+
+    int replayed = 0;
+    while (!file.atEnd()) {
+        QJsonParseError err;
+        QJsonDocument doc = QJsonDocument::fromJson(file.readLine().trimmed(), &err);
+        if (err.error != QJsonParseError::NoError || !doc.isObject())
+            break; // Torn last line from a crash: everything before it is good
+        QJsonObject entry = doc.object();
+        QString op = entry.value("op").toString();
+        if (op == "add") {
+            rules.push_front(fromJson(entry.value("rule").toObject()));
+        } else if (op == "remove") {
+            int index = entry.value("index").toInt(-1);
+            if (index >= 0 && index < rules.size())
+                rules.removeAt(index);
+        } else if (op == "clear") {
+            rules.clear();
+        } else {
+            break;
+        }
+        ++replayed;
+    }
+    if (replayed)
+        qInfo() << "Replayed" << replayed << "rule journal entries from" << journalPath;
+    return replayed;
+}
+
+void RuleJournal::start(const QByteArray& fileData, RuleListPtr current, bool compactNow) {
+    baseChecksum = checksumOf(fileData);
+    // A journal that was replayed stays valid for appending until compacted.
+    journalValid = compactNow;
+    running = true;
+    started = true;
+    writer = std::thread(&RuleJournal::writerLoop, this);
+    if (compactNow) {
+        Entry entry;
+        entry.after = std::move(current);
+        entry.compact = true;
+        enqueue(std::move(entry));
+    }
+}
+
+void RuleJournal::enqueue(Entry entry) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back(std::move(entry));
+    }
+    cv.notify_one();
+}
+
+void RuleJournal::recordAdd(const Rule& rule, RuleListPtr after) {
+    QJsonObject obj;
+    obj["op"] = "add";
+    obj["rule"] = toJson(rule);
+    enqueue(Entry{entryLine(obj), std::move(after), false});
+}
+
+void RuleJournal::recordRemove(int index, RuleListPtr after) {
+    QJsonObject obj;
+    obj["op"] = "remove";
+    obj["index"] = index;
+    enqueue(Entry{entryLine(obj), std::move(after), false});
+}
+
+void RuleJournal::recordClear(RuleListPtr after) {
+    QJsonObject obj;
+    obj["op"] = "clear";
+    enqueue(Entry{entryLine(obj), std::move(after), false});
+}
+
+void RuleJournal::recordReplace(RuleListPtr after) {
+    enqueue(Entry{QByteArray(), std::move(after), true});
+}
+
+bool RuleJournal::flush() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!running) return false;
+    uint64_t ticket = ++flushRequested;
+    cv.notify_one();
+    flushedCv.wait(lock, [&] { return flushDone >= ticket || !running; });
+    return lastCompactOk;
+}
+
+bool RuleJournal::writeFreshJournal(const QByteArray& checksum) {
+    QJsonObject head;
+    head["checkpoint"] = QString::fromLatin1(checksum);
+    QSaveFile file(journalPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to open rule journal:" << journalPath;
+        return false;
+    }
+    file.write(entryLine(head));
+    if (!file.commit()) {
+        qWarning() << "Failed to write rule journal:" << journalPath << file.errorString();
+        return false;
+    }
+    baseChecksum = checksum;
+    journalValid = true;
+    return true;
+}
+
+bool RuleJournal::appendLines(const std::vector<Entry>& entries) {
+    if (!journalValid && !writeFreshJournal(baseChecksum))
+        return false;
+    QFile file(journalPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Failed to open rule journal:" << journalPath;
+        return false;
+    }
+    for (const Entry& entry : entries) {
+        if (!entry.line.isEmpty())
+            file.write(entry.line);
+    }
+    file.close();
+    return true;
+}
+
+bool RuleJournal::compact(const RuleListPtr& rules) {
+    // New rules file first: if we crash before the journal is replaced, the
+    // old journal's checkpoint no longer matches and it is ignored.
+    QByteArray written;
+    if (!writeRulesFile(*rules, rulesPath, &written))
+        return false;
+    return writeFreshJournal(checksumOf(written));
+}
+
+void RuleJournal::writerLoop() {
+    RuleListPtr latest;          // Rule list matching what the journal holds
+    size_t journalEntries = 0;   // Appended since the last compaction
+    bool dirty = false;          // Rules file is behind `latest`
+    bool keepRunning = true;
+
+    while (keepRunning) {
+        std::vector<Entry> batch;
+        uint64_t flushTicket = 0;
+        bool idle = false;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            idle = !cv.wait_for(lock, std::chrono::milliseconds(COMPACT_IDLE_MS), [this] {
+                return !queue.empty() || flushRequested != flushDone || !running;
+            });
+            batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.end()));
+            queue.clear();
+            flushTicket = flushRequested;
+            keepRunning = running;
+        }
+
+        bool compactNow = false;
+        for (const Entry& entry : batch) {
+            compactNow = compactNow || entry.compact;
+            if (!entry.compact) ++journalEntries;
+            latest = entry.after;
+        }
+        dirty = dirty || !batch.empty();
+        // A compaction in the batch rewrites the rules file from `latest`, so
+        // the batch's journal lines would be superseded straight away.
+        if (!compactNow && !batch.empty())
+            appendLines(batch);
+
+        bool flushing = flushTicket != flushDone;
+        if (dirty && (compactNow || flushing || journalEntries >= COMPACT_EVERY || idle)) {
+            bool ok = compact(latest);
+            if (ok) {
+                journalEntries = 0;
+                dirty = false;
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            lastCompactOk = ok;
+        }
+
+        if (flushing) {
+            std::lock_guard<std::mutex> lock(mtx);
+            flushDone = flushTicket;
+        }
+        if (flushing) flushedCv.notify_all();
+    }
+}
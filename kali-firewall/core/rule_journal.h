@@ -0,0 +1,84 @@
+#pragma once
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "rule_engine.h"
+
+// Write-behind persistence for RuleEngine's rule file.
+//
+// Every edit becomes one line appended to "<rules file>.journal" by a
+// background thread; the caller only queues it. The thread periodically
+// compacts: it rewrites the rules JSON from the matching rule list with an
+// atomic rename (QSaveFile) and starts a fresh journal. The journal's first
+// line holds the SHA-1 of the rules file it applies to, so after a crash it
+// is replayed only on top of that exact file.
+class RuleJournal {
+public:
+    using RuleListPtr = std::shared_ptr<const QList<Rule>>;
+
+    explicit RuleJournal(const QString& rulesPath);
+    ~RuleJournal();   // Compacts whatever is outstanding, then stops the thread
+
+    // Applies the journal to `rules`, which were just parsed from the rules
+    // file whose raw contents are `fileData`. Returns the number of entries
+    // replayed (0 if the journal is missing or belongs to another file).
+    int replay(const QByteArray& fileData, QList<Rule>& rules);
+
+    // Starts the writer. `fileData` is what the rules file held when loaded;
+    // `current` is the rule list after replay (compacted right away if any
+    // entries were replayed).
+    void start(const QByteArray& fileData, RuleListPtr current, bool compactNow);
+
+    // Queue one edit; `after` is the rule list once the edit is applied.
+    void recordAdd(const Rule& rule, RuleListPtr after);
+    void recordRemove(int index, RuleListPtr after);
+    void recordClear(RuleListPtr after);
+    // The whole list was replaced (e.g. loaded from another file).
+    void recordReplace(RuleListPtr after);
+
+    // Blocks until everything queued is on disk and compacted into the rules file.
+    bool flush();
+    bool isStarted() const { return started; }
+
+    // Atomically (QSaveFile) writes `rules` as the rules JSON array.
+    static bool writeRulesFile(const QList<Rule>& rules, const QString& path, QByteArray* written = nullptr);
+    static QJsonObject toJson(const Rule& rule);
+    static Rule fromJson(const QJsonObject& obj);
+
+private:
+    struct Entry {
+        QByteArray line;   // Empty: compaction request only
+        RuleListPtr after;
+        bool compact = false;
+    };
+
+    void enqueue(Entry entry);
+    void writerLoop();
+    bool appendLines(const std::vector<Entry>& entries);
+    bool compact(const RuleListPtr& rules);
+    bool writeFreshJournal(const QByteArray& checksum);
+
+    QString rulesPath;
+    QString journalPath;
+    QByteArray baseChecksum;     // Of the rules file the journal on disk applies to
+    bool journalValid = false;   // Journal on disk starts with baseChecksum
+
+    std::thread writer;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable flushedCv;
+    std::deque<Entry> queue;
+    bool running = false;
+    bool started = false;   // start() was called; only touched by the owner
+    uint64_t flushRequested = 0;
+    uint64_t flushDone = 0;
+    bool lastCompactOk = true;
+};
@@ -0,0 +1,359 @@
+#include "rule_optimizer.h"
+#include "rule_classifier.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+namespace {
+constexpr size_t SAMPLE_PACKETS = 4096;
+constexpr size_t MEASURE_LOOKUPS = 200000;
+constexpr int MAX_ROUNDS = 8;
+
+// Does `a` (with prefix `aPrefix`) contain every address of `bNet/bPrefix`?
+bool prefixCovers(uint8_t aPrefix, const uint32_t* aNet, const uint32_t* aMask,
+                  uint8_t bPrefix, const uint32_t* bNet) {
+    if (aPrefix == 0) return true;
+    if (bPrefix < aPrefix) return false;
+    for (int i = 0; i < 4; ++i) {
+        if ((bNet[i] & aMask[i]) != aNet[i]) return false;
+    }
+    return true;
+}
+
+bool prefixOverlaps(uint8_t aPrefix, const uint32_t* aNet, const uint32_t* aMask,
+                    uint8_t bPrefix, const uint32_t* bNet, const uint32_t* bMask) {
+    return aPrefix <= bPrefix ? prefixCovers(aPrefix, aNet, aMask, bPrefix, bNet)
+                              : prefixCovers(bPrefix, bNet, bMask, aPrefix, aNet);
+}
+
+// Every packet `b` matches is matched by `a`.
+bool covers(const CompiledRule& a, const CompiledRule& b) {
+    if (!a.valid) return false;
+    if (a.family && a.family != b.family) return false;
+    if (a.protocol >= 0 && a.protocol != b.protocol) return false;
+    if (a.srcPortLo > b.srcPortLo || a.srcPortHi < b.srcPortHi) return false;
+    if (a.dstPortLo > b.dstPortLo || a.dstPortHi < b.dstPortHi) return false;
+    return prefixCovers(a.srcPrefix, a.srcNet, a.srcMask, b.srcPrefix, b.srcNet)
+        && prefixCovers(a.dstPrefix, a.dstNet, a.dstMask, b.dstPrefix, b.dstNet);
+}
+
+// Some packet is matched by both.
+bool overlaps(const CompiledRule& a, const CompiledRule& b) {
+    if (!a.valid || !b.valid) return false;
+    if (a.family && b.family && a.family != b.family) return false;
+    if (a.protocol >= 0 && b.protocol >= 0 && a.protocol != b.protocol) return false;
+    if (a.srcPortHi < b.srcPortLo || b.srcPortHi < a.srcPortLo) return false;
+    if (a.dstPortHi < b.dstPortLo || b.dstPortHi < a.dstPortLo) return false;
+    return prefixOverlaps(a.srcPrefix, a.srcNet, a.srcMask, b.srcPrefix, b.srcNet, b.srcMask)
+        && prefixOverlaps(a.dstPrefix, a.dstNet, a.dstMask, b.dstPrefix, b.dstNet, b.dstMask);
+}
+
+void setPrefix(uint8_t prefix, uint32_t net[4], uint32_t mask[4]) {
+    for (int i = 0; i < 4; ++i) {
+        int wordBits = std::min(32, std::max(0, static_cast<int>(prefix) - i * 32));
+        mask[i] = wordBits == 0 ? 0 : htonl(0xffffffffu << (32 - wordBits));
+        net[i] &= mask[i];
+    }
+}
+
+// Address bit `bit` (0 = most significant) flipped: the other half of the parent prefix.
+void flipBit(uint32_t net[4], unsigned bit) {
+    net[bit / 32] ^= htonl(1u << (31 - bit % 32));
+}
+
+enum class Field { SrcAddr, DstAddr, SrcPort, DstPort };
+
+// Everything that has to be equal for two rules to merge along `skip`.
+std::string mergeKey(const CompiledRule& r, Field skip) {
+    std::string key;
+    auto put = [&key](const void* p, size_t n) { key.append(static_cast<const char*>(p), n); };
+    put(&r.family, sizeof(r.family));
+    put(&r.protocol, sizeof(r.protocol));
+    if (skip != Field::SrcAddr) { put(&r.srcPrefix, 1); put(r.srcNet, sizeof(r.srcNet)); }
+    if (skip != Field::DstAddr) { put(&r.dstPrefix, 1); put(r.dstNet, sizeof(r.dstNet)); }
+    if (skip != Field::SrcPort) { put(&r.srcPortLo, 2); put(&r.srcPortHi, 2); }
+    if (skip != Field::DstPort) { put(&r.dstPortLo, 2); put(&r.dstPortHi, 2); }
+    return key;
+}
+
+struct Entry {
+    RuleText text;
+    CompiledRule rule;
+    int origin;          // Input index while unchanged, -1 once merged
+    bool removed = false;
+};
+
+// Merge port ranges within `run` (indices into `list`). Returns merges done.
+size_t mergePorts(std::vector<Entry>& list, const std::vector<size_t>& run, Field field) {
+    std::unordered_map<std::string, std::vector<size_t>> groups;
+    for (size_t i : run) groups[mergeKey(list[i].rule, field)].push_back(i);
+
+    size_t merges = 0;
+    for (auto& group : groups) {
+        std::vector<size_t>& members = group.second;
+        if (members.size() < 2) continue;
+        auto lo = [&](size_t i) -> uint16_t& { return field == Field::SrcPort ? list[i].rule.srcPortLo : list[i].rule.dstPortLo; };
+        auto hi = [&](size_t i) -> uint16_t& { return field == Field::SrcPort ? list[i].rule.srcPortHi : list[i].rule.dstPortHi; };
+        std::sort(members.begin(), members.end(), [&](size_t a, size_t b) { return lo(a) < lo(b); });
+        size_t cur = members[0];
+        for (size_t k = 1; k < members.size(); ++k) {
+            size_t next = members[k];
+            if (static_cast<int>(lo(next)) <= static_cast<int>(hi(cur)) + 1) {
+                hi(cur) = std::max(hi(cur), hi(next));
+                list[cur].origin = -1;
+                list[next].removed = true;
+                ++merges;
+            } else {
+                cur = next;
+            }
+        }
+    }
+    return merges;
+}
+
+// Merge sibling prefixes within `run` into their parent. Returns merges done.
+size_t mergeAddresses(std::vector<Entry>& list, const std::vector<size_t>& run, Field field) {
+    std::unordered_map<std::string, std::vector<size_t>> groups;
+    for (size_t i : run) {
+        const CompiledRule& r = list[i].rule;
+        if ((field == Field::SrcAddr ? r.srcPrefix : r.dstPrefix) > 0)
+            groups[mergeKey(r, field)].push_back(i);
+    }
+
+    size_t merges = 0;
+    for (auto& group : groups) {
+        std::vector<size_t>& members = group.second;
+        // (prefix, net) -> member; merging a pair may enable the next level up.
+        std::unordered_map<std::string, size_t> byNet;
+        auto netKey = [&](size_t i) {
+            const CompiledRule& r = list[i].rule;
+            uint8_t prefix = field == Field::SrcAddr ? r.srcPrefix : r.dstPrefix;
+            const uint32_t* net = field == Field::SrcAddr ? r.srcNet : r.dstNet;
+            return std::string(reinterpret_cast<const char*>(&prefix), 1) +
+                   std::string(reinterpret_cast<const char*>(net), 16);
+        };
+        std::vector<size_t> work = members;
+        for (size_t i : members) byNet.emplace(netKey(i), i);
+        while (!work.empty()) {
+            size_t i = work.back();
+            work.pop_back();
+            if (list[i].removed) continue;
+            CompiledRule& r = list[i].rule;
+            uint8_t& prefix = field == Field::SrcAddr ? r.srcPrefix : r.dstPrefix;
+            uint32_t* net = field == Field::SrcAddr ? r.srcNet : r.dstNet;
+            uint32_t* mask = field == Field::SrcAddr ? r.srcMask : r.dstMask;
+            if (prefix == 0) continue;
+
+            uint32_t sibling[4];
+            std::memcpy(sibling, net, sizeof(sibling));
+            flipBit(sibling, prefix - 1u);
+            std::string siblingKey = std::string(reinterpret_cast<const char*>(&prefix), 1) +
+                                     std::string(reinterpret_cast<const char*>(sibling), 16);
+            auto it = byNet.find(siblingKey);
+            if (it == byNet.end() || it->second == i || list[it->second].removed) continue;
+
+            size_t other = it->second;
+            byNet.erase(it);
+            byNet.erase(netKey(i));
+            list[other].removed = true;
+            --prefix;
+            setPrefix(prefix, net, mask);
+            list[i].origin = -1;
+            ++merges;
+            auto placed = byNet.emplace(netKey(i), i);
+            if (!placed.second) {
+                // The parent prefix is already a rule of this group: same packets.
+                list[i].removed = true;
+            } else {
+                work.push_back(i);
+            }
+        }
+    }
+    return merges;
+}
+
+std::string addressText(const CompiledRule& r, bool src) {
+    uint8_t prefix = src ? r.srcPrefix : r.dstPrefix;
+    uint8_t otherPrefix = src ? r.dstPrefix : r.srcPrefix;
+    const uint32_t* net = src ? r.srcNet : r.dstNet;
+    if (prefix == 0) {
+        // "*" unless it is what pins the rule to one family
+        if (!r.family || otherPrefix > 0) return "*";
+        return r.family == AF_INET ? "0.0.0.0/0" : "::/0";
+    }
+    char buf[INET6_ADDRSTRLEN];
+    inet_ntop(r.family, net, buf, sizeof(buf));
+    unsigned full = r.family == AF_INET ? 32 : 128;
+    return prefix == full ? std::string(buf) : std::string(buf) + "/" + std::to_string(prefix);
+}
+
+std::string portText(uint16_t lo, uint16_t hi) {
+    if (lo == 0 && hi == 0xffff) return "0";    // Rule editor notation for any port
+    if (lo == hi) return lo == 0 ? "0-0" : std::to_string(lo);
+    return std::to_string(lo) + "-" + std::to_string(hi);
+}
+
+PacketMeta samplePacket(std::mt19937& rng, const CompiledRule& r) {
+    PacketMeta pkt;
+    uint8_t family = r.family ? r.family : ((rng() & 3) ? AF_INET : AF_INET6);
+    pkt.src.family = pkt.dst.family = family;
+    uint32_t src[4], dst[4];
+    for (int i = 0; i < 4; ++i) {
+        src[i] = (rng() & ~r.srcMask[i]) | r.srcNet[i];
+        dst[i] = (rng() & ~r.dstMask[i]) | r.dstNet[i];
+    }
+    if (family == AF_INET) src[1] = src[2] = src[3] = dst[1] = dst[2] = dst[3] = 0;
+    std::memcpy(pkt.src.bytes, src, 16);
+    std::memcpy(pkt.dst.bytes, dst, 16);
+    static const uint8_t protocols[] = {IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP};
+    pkt.protocol = r.protocol >= 0 ? static_cast<uint8_t>(r.protocol) : protocols[rng() % 3];
+    if (pkt.protocol == IPPROTO_TCP || pkt.protocol == IPPROTO_UDP) {
+        pkt.srcPort = static_cast<uint16_t>(r.srcPortLo + rng() % (r.srcPortHi - r.srcPortLo + 1u));
+        pkt.dstPort = static_cast<uint16_t>(r.dstPortLo + rng() % (r.dstPortHi - r.dstPortLo + 1u));
+    }
+    return pkt;
+}
+
+double nsPerLookup(const RuleClassifier& classifier, const std::vector<PacketMeta>& packets, long& sink) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < MEASURE_LOOKUPS; ++i) sink += classifier.find(packets[i % packets.size()]);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(ns) / MEASURE_LOOKUPS;
+}
+}
+
+RuleText ruleTextOf(const CompiledRule& rule, const std::string& protocol, const std::string& action) {
+    RuleText text;
+    text.srcIp = addressText(rule, true);
+    text.dstIp = addressText(rule, false);
+    text.srcPort = portText(rule.srcPortLo, rule.srcPortHi);
+    text.dstPort = portText(rule.dstPortLo, rule.dstPortHi);
+    text.protocol = protocol;
+    text.action = action;
+    return text;
+}
+
+RuleOptimization optimizeRules(const std::vector<RuleText>& texts, const std::vector<CompiledRule>& compiled) {
+    RuleOptimization result;
+    std::vector<Entry> list;
+    list.reserve(compiled.size());
+    for (size_t i = 0; i < compiled.size(); ++i) {
+        if (!compiled[i].valid) {
+            ++result.neverMatching;
+            continue;
+        }
+        list.push_back(Entry{texts[i], compiled[i], static_cast<int>(i)});
+    }
+
+    auto compact = [&list]() {
+        list.erase(std::remove_if(list.begin(), list.end(), [](const Entry& e) { return e.removed; }), list.end());
+    };
+
+    for (int round = 0; round < MAX_ROUNDS; ++round) {
+        size_t changes = 0;
+
+        // Shadowed: covered by an earlier rule.
+        for (size_t j = 0; j < list.size(); ++j) {
+            for (size_t i = 0; i < j; ++i) {
+                if (!list[i].removed && covers(list[i].rule, list[j].rule)) {
+                    list[j].removed = true;
+                    ++result.shadowed;
+                    ++changes;
+                    break;
+                }
+            }
+        }
+        compact();
+
+        // Redundant: a later rule with the same verdict covers it and nothing
+        // in between overlaps it with the other verdict. Checked back to
+        // front so each decision sees the final list after it.
+        for (size_t i = list.size(); i-- > 0;) {
+            const CompiledRule& r = list[i].rule;
+            for (size_t k = i + 1; k < list.size(); ++k) {
+                if (list[k].removed) continue;
+                const CompiledRule& later = list[k].rule;
+                if (later.verdict == r.verdict) {
+                    if (covers(later, r)) {
+                        list[i].removed = true;
+                        ++result.redundant;
+                        ++changes;
+                        break;
+                    }
+                } else if (overlaps(later, r)) {
+                    break;
+                }
+            }
+        }
+        compact();
+
+        // Merge within runs of equal verdicts.
+        for (size_t start = 0; start < list.size();) {
+            size_t end = start;
+            std::vector<size_t> run;
+            while (end < list.size() && list[end].rule.verdict == list[start].rule.verdict) run.push_back(end++);
+            if (run.size() > 1) {
+                for (Field field : {Field::DstPort, Field::SrcPort, Field::SrcAddr, Field::DstAddr}) {
+                    std::vector<size_t> live;
+                    for (size_t i : run) {
+                        if (!list[i].removed) live.push_back(i);
+                    }
+                    size_t merges = (field == Field::SrcPort || field == Field::DstPort)
+                                        ? mergePorts(list, live, field)
+                                        : mergeAddresses(list, live, field);
+                    result.merged += merges;
+                    changes += merges;
+                }
+            }
+            start = end;
+        }
+        compact();
+
+        if (!changes) break;
+    }
+
+    for (Entry& e : list) {
+        if (e.origin < 0) e.text = ruleTextOf(e.rule, e.text.protocol, e.text.action);
+        result.rules.push_back(e.text);
+        result.compiled.push_back(e.rule);
+        result.origin.push_back(e.origin);
+    }
+    return result;
+}
+
+void measureRuleLookup(const std::vector<CompiledRule>& before, RuleOptimization& result) {
+    RuleClassifier oldClassifier, newClassifier;
+    oldClassifier.build(before.data(), before.size());
+    newClassifier.build(result.compiled.data(), result.compiled.size());
+
+    std::mt19937 rng(1);
+    CompiledRule anything;
+    std::vector<PacketMeta> packets;
+    packets.reserve(SAMPLE_PACKETS);
+    for (size_t i = 0; i < SAMPLE_PACKETS; ++i) {
+        const CompiledRule& r = (before.empty() || (i & 1)) ? anything : before[rng() % before.size()];
+        packets.push_back(samplePacket(rng, r));
+    }
+
+    result.verified = true;
+    for (const PacketMeta& pkt : packets) {
+        int a = oldClassifier.find(pkt);
+        int b = newClassifier.find(pkt);
+        bool sameOutcome = (a < 0 && b < 0) ||
+                           (a >= 0 && b >= 0 && before[a].verdict == result.compiled[b].verdict);
+        if (!sameOutcome) {
+            result.verified = false;
+            break;
+        }
+    }
+
+    long sink = 0;
+    result.nsPerLookupBefore = nsPerLookup(oldClassifier, packets, sink);
+    result.nsPerLookupAfter = nsPerLookup(newClassifier, packets, sink);
+    if (sink == 42) result.nsPerLookupAfter += 0; // Keep the lookups from being optimized away
+}
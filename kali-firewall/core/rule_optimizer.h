@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "compiled_rule.h"
+
+// Result of optimizeRules(): an equivalent, shorter first-match rule list.
+struct RuleOptimization {
+    std::vector<RuleText> rules;
+    std::vector<CompiledRule> compiled;   // Index for index with `rules`
+    std::vector<int> origin;              // Input index of an output rule taken over unchanged, -1 if merged
+
+    size_t neverMatching = 0;   // Fields that do not parse: the rule can never match
+    size_t shadowed = 0;        // An earlier rule matches everything this one does
+    size_t redundant = 0;       // A later rule with the same verdict would decide the same packets
+    size_t merged = 0;          // Folded into a neighbouring CIDR or port range
+
+    // From measureRuleLookup() on packets sampled from the input rules.
+    double nsPerLookupBefore = 0;
+    double nsPerLookupAfter = 0;
+    bool verified = false;      // Every sampled packet got the same verdict from both lists
+};
+
+// Minimizes a first-match rule list without changing any verdict.
+//
+//  - Rules that never match are dropped.
+//  - A rule covered by one earlier rule (addresses, ports and protocol all
+//    inside it) is shadowed and dropped, whatever its verdict.
+//  - A rule covered by a later rule with the same verdict is dropped when no
+//    rule in between overlaps it with the other verdict.
+//  - Within a run of consecutive rules with the same verdict the order does
+//    not matter, so rules there that differ in one field only are merged:
+//    sibling CIDRs into their parent prefix, touching port ranges into one.
+//
+// Coverage by the union of several earlier rules is not detected, and no
+// rule is removed for falling through to the default policy, which can
+// change with interactive mode. Runs until nothing changes.
+RuleOptimization optimizeRules(const std::vector<RuleText>& texts, const std::vector<CompiledRule>& compiled);
+
+// Times RuleClassifier lookups over both lists with packets drawn from the
+// `before` rules (half aimed inside a rule, half random) and fills the
+// nsPerLookup fields and `verified` of `result`.
+void measureRuleLookup(const std::vector<CompiledRule>& before, RuleOptimization& result);
+
+// Text form of a compiled rule, in the notation the rules JSON uses.
+RuleText ruleTextOf(const CompiledRule& rule, const std::string& protocol, const std::string& action);
@@ -0,0 +1,614 @@
+#include "signature_dfa.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+
+struct SignatureDfa::Node {
+    enum Type { Set, Concat, Alt, Repeat, Bol, Eol } type = Concat;
+    ByteSet set;                 // Set
+    std::vector<Node> kids;      // Concat, Alt; Repeat has one
+    int min = 0;                 // Repeat
+    int max = 0;                 // Repeat; -1 = unbounded
+};
+
+namespace {
+using ByteSet = std::bitset<256>;
+
+uint64_t nextEpoch() {
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+}
+
+ByteSet range(int lo, int hi) {
+    ByteSet set;
+    for (int c = lo; c <= hi; ++c) set.set(static_cast<size_t>(c));
+    return set;
+}
+
+// What std::regex's classic-locale ctype makes of \d, \w and \s.
+ByteSet digits() { return range('0', '9'); }
+ByteSet wordChars() { return range('0', '9') | range('A', 'Z') | range('a', 'z') | range('_', '_'); }
+ByteSet spaces() { return range('\t', '\r') | range(' ', ' '); }
+
+// Adds the other case of every ASCII letter in `set`.
+ByteSet foldCase(ByteSet set) {
+    for (int c = 'a'; c <= 'z'; ++c) {
+        if (set[static_cast<size_t>(c)] || set[static_cast<size_t>(c - 32)]) {
+            set.set(static_cast<size_t>(c));
+            set.set(static_cast<size_t>(c - 32));
+        }
+    }
+    return set;
+}
+}
+
+// Parses the supported subset into a Node tree; fails on anything else
+// (the pattern then stays on the std::regex path).
+class SignatureDfa::Parser {
+public:
+    Parser(const std::string& pattern, bool caseInsensitive) : p(pattern), icase(caseInsensitive) {}
+
+    bool parse(Node& out) {
+        out = alternation();
+        return ok && pos == p.size();
+    }
+
+private:
+    const std::string& p;
+    bool icase;
+    size_t pos = 0;
+    bool ok = true;
+
+    bool more() const { return pos < p.size(); }
+
+    Node fail() {
+        ok = false;
+        return Node();
+    }
+
+    Node setNode(ByteSet set) {
+        Node node;
+        node.type = Node::Set;
+        node.set = icase ? foldCase(set) : set;
+        return node;
+    }
+
+    Node alternation() {
+        Node first = sequence();
+        if (!ok || !more() || p[pos] != '|') return first;
+        Node alt;
+        alt.type = Node::Alt;
+        alt.kids.push_back(std::move(first));
+        while (ok && more() && p[pos] == '|') {
+            ++pos;
+            alt.kids.push_back(sequence());
+        }
+        return alt;
+    }
+
+    Node sequence() {
+        Node seq;
+        seq.type = Node::Concat;
+        while (ok && more() && p[pos] != '|' && p[pos] != ')')
+            seq.kids.push_back(quantified());
+        return seq;
+    }
+
+    Node quantified() {
+        Node atom = this->atom();
+        while (ok && more()) {
+            int min, max;
+            char c = p[pos];
+            if (c == '*') { min = 0; max = -1; ++pos; }
+            else if (c == '+') { min = 1; max = -1; ++pos; }
+            else if (c == '?') { min = 0; max = 1; ++pos; }
+            else if (c == '{') { if (!braces(min, max)) return fail(); }
+            else break;
+            if (more() && p[pos] == '?') ++pos; // Lazy: decides which match, not whether
+            if (atom.type == Node::Bol || atom.type == Node::Eol) return fail();
+            Node repeat;
+            repeat.type = Node::Repeat;
+            repeat.min = min;
+            repeat.max = max;
+            repeat.kids.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+        return atom;
+    }
+
+    bool braces(int& min, int& max) {
+        size_t i = pos + 1;
+        auto number = [&](int& n) {
+            size_t start = i;
+            n = 0;
+            while (i < p.size() && std::isdigit(static_cast<unsigned char>(p[i])) && n < 100000)
+                n = n * 10 + (p[i++] - '0');
+            return i > start;
+        };
+        if (!number(min)) return false;
+        max = min;
+        if (i < p.size() && p[i] == ',') {
+            ++i;
+            if (!number(max)) max = -1;
+        }
+        if (i >= p.size() || p[i] != '}' || (max >= 0 && max < min)) return false;
+        pos = i + 1;
+        return true;
+    }
+
+    Node atom() {
+        char c = p[pos++];
+        switch (c) {
+        case '^': { Node n; n.type = Node::Bol; return n; }
+        case '$': { Node n; n.type = Node::Eol; return n; }
+        case '.': return setNode(~(range('\n', '\n') | range('\r', '\r')));
+        case '(': return group();
+        case '[': return characterClass();
+        case '\\': {
+            ByteSet set;
+            if (!escape(set, false)) return fail();
+            return setNode(set);
+        }
+        case '*': case '+': case '?': case '{': case '}': case ']':
+            return fail();
+        default:
+            return setNode(range(static_cast<unsigned char>(c), static_cast<unsigned char>(c)));
+        }
+    }
+
+    Node group() {
+        if (more() && p[pos] == '?') {
+            if (pos + 1 < p.size() && p[pos + 1] == ':') pos += 2;
+            else return fail(); // Lookarounds
+        }
+        Node inner = alternation();
+        if (!ok || !more() || p[pos] != ')') return fail();
+        ++pos;
+        return inner;
+    }
+
+    // One escape into `set`. In a class \b is a backspace; outside it is a
+    // word boundary, which is not supported.
+    bool escape(ByteSet& set, bool inClass) {
+        if (!more()) return false;
+        char c = p[pos++];
+        auto hex = [&](size_t digits, int& value) {
+            value = 0;
+            for (size_t i = 0; i < digits; ++i) {
+                if (!more() || !std::isxdigit(static_cast<unsigned char>(p[pos]))) return false;
+                char h = static_cast<char>(std::tolower(static_cast<unsigned char>(p[pos++])));
+                value = value * 16 + (h <= '9' ? h - '0' : h - 'a' + 10);
+            }
+            return true;
+        };
+        int value;
+        switch (c) {
+        case 'd': set = digits(); return true;
+        case 'D': set = ~digits(); return true;
+        case 'w': set = wordChars(); return true;
+        case 'W': set = ~wordChars(); return true;
+        case 's': set = spaces(); return true;
+        case 'S': set = ~spaces(); return true;
+        case 'n': value = '\n'; break;
+        case 'r': value = '\r'; break;
+        case 't': value = '\t'; break;
+        case 'f': value = '\f'; break;
+        case 'v': value = '\v'; break;
+        case 'b':
+            if (!inClass) return false;
+            value = '\b';
+            break;
+        case '0':
+            if (more() && std::isdigit(static_cast<unsigned char>(p[pos]))) return false;
+            value = 0;
+            break;
+        case 'x':
+            if (!hex(2, value)) return false;
+            break;
+        case 'u':
+            if (!hex(4, value) || value > 0xff) return false;
+            break;
+        case 'c':
+            if (!more() || !std::isalpha(static_cast<unsigned char>(p[pos]))) return false;
+            value = p[pos++] % 32;
+            break;
+        default:
+            // Escaped punctuation is itself; letters and digits mean
+            // something else (back-references, \B, ...).
+            if (std::isalnum(static_cast<unsigned char>(c))) return false;
+            value = static_cast<unsigned char>(c);
+            break;
+        }
+        set = range(value, value);
+        return true;
+    }
+
+    // A single character of a class for a range endpoint; -1 if it is a set.
+    int classChar(ByteSet& set) {
+        char c = p[pos++];
+        if (c != '\\') {
+            set = range(static_cast<unsigned char>(c), static_cast<unsigned char>(c));
+            return static_cast<unsigned char>(c);
+        }
+        if (!escape(set, true)) {
+            ok = false;
+            return -1;
+        }
+        if (set.count() != 1) return -1;
+        int first = 0;
+        while (!set[static_cast<size_t>(first)]) ++first;
+        return first;
+    }
+
+    Node characterClass() {
+        bool negated = more() && p[pos] == '^';
+        if (negated) ++pos;
+        if (!more() || p[pos] == ']') return fail(); // "[]" / "[^]"
+        ByteSet members;
+        while (ok) {
+            if (!more()) return fail();
+            if (p[pos] == ']') {
+                ++pos;
+                break;
+            }
+            if (p[pos] == '[' && pos + 1 < p.size() && (p[pos + 1] == ':' || p[pos + 1] == '.' || p[pos + 1] == '='))
+                return fail(); // POSIX classes
+            ByteSet set;
+            int lo = classChar(set);
+            if (!ok) return fail();
+            if (lo >= 0 && pos + 1 < p.size() && p[pos] == '-' && p[pos + 1] != ']') {
+                ++pos;
+                ByteSet endSet;
+                int hi = classChar(endSet);
+                // Ranges past 0x7f compare as signed chars in std::regex: leave them to it.
+                if (!ok || hi < 0 || hi < lo || hi > 0x7f) return fail();
+                set = range(lo, hi);
+            }
+            members |= set;
+        }
+        if (icase) members = foldCase(members);
+        Node node;
+        node.type = Node::Set;
+        node.set = negated ? ~members : members;
+        return node;
+    }
+};
+
+uint32_t SignatureDfa::newState() {
+    nfa.emplace_back();
+    return static_cast<uint32_t>(nfa.size() - 1);
+}
+
+bool SignatureDfa::compile(const Node& node, Fragment& out, size_t limit) {
+    if (nfa.size() > limit) return false;
+    switch (node.type) {
+    case Node::Set: {
+        out.start = newState();
+        out.end = newState();
+        nfa[out.start].byteSet = static_cast<int32_t>(sets.size());
+        nfa[out.start].next = out.end;
+        sets.push_back(node.set);
+        return true;
+    }
+    case Node::Concat: {
+        out.start = out.end = newState();
+        for (const Node& kid : node.kids) {
+            Fragment f;
+            if (!compile(kid, f, limit)) return false;
+            nfa[out.end].eps.push_back(f.start);
+            out.end = f.end;
+        }
+        return true;
+    }
+    case Node::Alt: {
+        out.start = newState();
+        out.end = newState();
+        for (const Node& kid : node.kids) {
+            Fragment f;
+            if (!compile(kid, f, limit)) return false;
+            nfa[out.start].eps.push_back(f.start);
+            nfa[f.end].eps.push_back(out.end);
+        }
+        return true;
+    }
+    case Node::Repeat: {
+        const Node& kid = node.kids[0];
+        out.start = out.end = newState();
+        for (int i = 0; i < node.min; ++i) {
+            Fragment f;
+            if (!compile(kid, f, limit)) return false;
+            nfa[out.end].eps.push_back(f.start);
+            out.end = f.end;
+        }
+        if (node.max < 0) {
+            // Loop: any number of further copies.
+            Fragment f;
+            if (!compile(kid, f, limit)) return false;
+            uint32_t loop = newState();
+            uint32_t exit = newState();
+            nfa[out.end].eps.push_back(loop);
+            nfa[loop].eps.push_back(f.start);
+            nfa[loop].eps.push_back(exit);
+            nfa[f.end].eps.push_back(loop);
+            out.end = exit;
+        } else if (node.max > node.min) {
+            // Up to max - min optional copies, each able to skip to the end.
+            uint32_t exit = newState();
+            for (int i = node.min; i < node.max; ++i) {
+                Fragment f;
+                if (!compile(kid, f, limit)) return false;
+                nfa[out.end].eps.push_back(f.start);
+                nfa[out.end].eps.push_back(exit);
+                out.end = f.end;
+            }
+            nfa[out.end].eps.push_back(exit);
+            out.end = exit;
+        }
+        return nfa.size() <= limit;
+    }
+    case Node::Bol:
+    case Node::Eol:
+        return false; // Only supported at the ends of a top-level alternative
+    }
+    return false;
+}
+
+bool SignatureDfa::add(const std::string& pattern, bool caseInsensitive, uint32_t id) {
+    Node root;
+    Parser parser(pattern, caseInsensitive);
+    if (!parser.parse(root)) return false;
+
+    if (nfa.empty()) {
+        unanchoredStart = newState();
+        anchoredStart = newState();
+    }
+    size_t baseStates = nfa.size();
+    size_t baseSets = sets.size();
+    size_t baseUnanchored = nfa[unanchoredStart].eps.size();
+    size_t baseAnchored = nfa[anchoredStart].eps.size();
+    size_t limit = baseStates + MAX_NFA_STATES_PER_PATTERN;
+
+    std::vector<Node> branches;
+    if (root.type == Node::Alt) branches = std::move(root.kids);
+    else branches.push_back(std::move(root));
+
+    bool fits = true;
+    for (Node& branch : branches) {
+        std::vector<Node>& items = branch.kids; // sequence() always yields a Concat
+        bool bol = !items.empty() && items.front().type == Node::Bol;
+        if (bol) items.erase(items.begin());
+        bool eol = !items.empty() && items.back().type == Node::Eol;
+        if (eol) items.pop_back();
+
+        Fragment f;
+        if (!compile(branch, f, limit)) {
+            fits = false;
+            break;
+        }
+        uint32_t accept = newState();
+        nfa[accept].accept = id;
+        nfa[accept].atEnd = eol;
+        nfa[f.end].eps.push_back(accept);
+        nfa[bol ? anchoredStart : unanchoredStart].eps.push_back(f.start);
+    }
+    if (!fits) {
+        nfa.resize(baseStates);
+        sets.resize(baseSets);
+        nfa[unanchoredStart].eps.resize(baseUnanchored);
+        nfa[anchoredStart].eps.resize(baseAnchored);
+        return false;
+    }
+
+    ++patternCount;
+    lowestId = std::min(lowestId, id);
+    built = false;
+    return true;
+}
+
+void SignatureDfa::clear() {
+    nfa.clear();
+    sets.clear();
+    patternCount = 0;
+    lowestId = NO_MATCH;
+    dstates.clear();
+    trans.clear();
+    index.clear();
+    classByte.clear();
+    classCount = 0;
+    built = false;
+    flushes = 0;
+}
+
+SignatureDfa::SignatureDfa(const SignatureDfa& other) {
+    *this = other;
+}
+
+SignatureDfa& SignatureDfa::operator=(const SignatureDfa& other) {
+    if (this == &other) return *this;
+    nfa = other.nfa;
+    sets = other.sets;
+    unanchoredStart = other.unanchoredStart;
+    anchoredStart = other.anchoredStart;
+    patternCount = other.patternCount;
+    lowestId = other.lowestId;
+    std::copy(std::begin(other.byteClass), std::end(other.byteClass), std::begin(byteClass));
+    classByte = other.classByte;
+    classCount = other.classCount;
+    dstates = other.dstates;
+    trans = other.trans;
+    index = other.index;
+    startState = other.startState;
+    buildEpoch = other.buildEpoch;
+    built = other.built;
+    flushes = other.flushes;
+    mark = other.mark;
+    markEpoch = other.markEpoch;
+    // The states built from here on are numbered apart from the original's.
+    cacheEpoch = nextEpoch();
+    return *this;
+}
+
+bool SignatureDfa::supports(const std::string& pattern, bool caseInsensitive) {
+    SignatureDfa probe;
+    return probe.add(pattern, caseInsensitive, 0);
+}
+
+void SignatureDfa::build() {
+    built = false;
+    if (patternCount == 0) return;
+
+    // Byte classes: bytes no set tells apart share a class, and the DFA
+    // has one column per class instead of 256.
+    uint16_t cls[256] = {};
+    size_t count = 1;
+    for (const ByteSet& set : sets) {
+        std::vector<int> split(count * 2, -1);
+        size_t next = 0;
+        for (int b = 0; b < 256; ++b) {
+            int& target = split[cls[b] * 2 + (set[static_cast<size_t>(b)] ? 1 : 0)];
+            if (target < 0) target = static_cast<int>(next++);
+            cls[b] = static_cast<uint16_t>(target);
+        }
+        count = next;
+    }
+    classCount = count;
+    classByte.assign(classCount, 0);
+    for (int b = 255; b >= 0; --b) {
+        byteClass[b] = static_cast<uint8_t>(cls[b]);
+        classByte[cls[b]] = static_cast<uint8_t>(b);
+    }
+
+    mark.assign(nfa.size(), 0);
+    markEpoch = 0;
+    flushes = 0;
+    resetCache();
+    buildEpoch = nextEpoch();
+    built = true;
+}
+
+void SignatureDfa::closure(std::vector<uint32_t>& stack, std::vector<uint32_t>& out) {
+    if (++markEpoch == 0) {
+        std::fill(mark.begin(), mark.end(), 0);
+        markEpoch = 1;
+    }
+    out.clear();
+    for (uint32_t s : stack) mark[s] = markEpoch;
+    while (!stack.empty()) {
+        uint32_t s = stack.back();
+        stack.pop_back();
+        const NfaState& state = nfa[s];
+        if (state.byteSet >= 0 || state.accept != NO_MATCH) out.push_back(s);
+        for (uint32_t t : state.eps) {
+            if (mark[t] != markEpoch) {
+                mark[t] = markEpoch;
+                stack.push_back(t);
+            }
+        }
+    }
+    std::sort(out.begin(), out.end());
+}
+
+uint32_t SignatureDfa::intern(std::vector<uint32_t> set) {
+    std::string key(reinterpret_cast<const char*>(set.data()), set.size() * sizeof(uint32_t));
+    auto it = index.find(key);
+    if (it != index.end()) return it->second;
+
+    DState state;
+    for (uint32_t s : set) {
+        const NfaState& n = nfa[s];
+        if (n.accept == NO_MATCH) continue;
+        uint32_t& slot = n.atEnd ? state.minEndAccept : state.minAccept;
+        slot = std::min(slot, n.accept);
+    }
+    state.nfa = std::move(set);
+    uint32_t id = static_cast<uint32_t>(dstates.size());
+    dstates.push_back(std::move(state));
+    trans.resize(trans.size() + classCount, -1);
+    index.emplace(std::move(key), id);
+    return id;
+}
+
+void SignatureDfa::resetCache() {
+    dstates.clear();
+    trans.clear();
+    index.clear();
+    cacheEpoch = nextEpoch();
+    std::vector<uint32_t> stack = {unanchoredStart, anchoredStart};
+    std::vector<uint32_t> start;
+    closure(stack, start);
+    startState = intern(std::move(start));
+}
+
+uint32_t SignatureDfa::step(uint32_t from, uint8_t cls) {
+    if (dstates.size() >= MAX_DFA_STATES) {
+        // Cache full: start over from the state we are in.
+        std::vector<uint32_t> current = dstates[from].nfa;
+        resetCache();
+        ++flushes;
+        from = intern(std::move(current));
+    }
+
+    uint8_t byte = classByte[cls];
+    std::vector<uint32_t> stack = {unanchoredStart}; // A match may start at the next byte
+    for (uint32_t s : dstates[from].nfa) {
+        const NfaState& n = nfa[s];
+        if (n.byteSet >= 0 && sets[static_cast<size_t>(n.byteSet)][byte]) stack.push_back(n.next);
+    }
+    std::vector<uint32_t> target;
+    closure(stack, target);
+    uint32_t to = intern(std::move(target));
+    trans[from * classCount + cls] = static_cast<int32_t>(to);
+    return to;
+}
+
+uint32_t SignatureDfa::firstMatch(const uint8_t* data, size_t len) {
+    if (!built) return NO_MATCH;
+    uint32_t s = startState;
+    uint32_t best = dstates[s].minAccept;
+    for (size_t i = 0; i < len && best != lowestId; ++i) {
+        uint8_t cls = byteClass[data[i]];
+        int32_t t = trans[s * classCount + cls];
+        s = t >= 0 ? static_cast<uint32_t>(t) : step(s, cls);
+        best = std::min(best, dstates[s].minAccept);
+    }
+    return std::min(best, dstates[s].minEndAccept);
+}
+
+void SignatureDfa::reset(Cursor& cursor, bool midStream) {
+    cursor.state = 0;
+    cursor.epoch = 0;
+    cursor.build = 0;
+    cursor.midStream = midStream;
+    cursor.nfa.clear();
+}
+
+uint32_t SignatureDfa::resume(const Cursor& cursor) {
+    if (cursor.build == buildEpoch) {
+        if (cursor.epoch == cacheEpoch) return cursor.state;
+        return intern(cursor.nfa); // Same patterns, cache flushed since
+    }
+    if (cursor.build == 0 && !cursor.midStream) return startState;
+    // Somewhere inside the stream: only unanchored matches can start here.
+    std::vector<uint32_t> stack = {unanchoredStart};
+    std::vector<uint32_t> set;
+    closure(stack, set);
+    return intern(std::move(set));
+}
+
+uint32_t SignatureDfa::feed(Cursor& cursor, const uint8_t* data, size_t len) {
+    if (!built) return NO_MATCH;
+    bool fresh = cursor.build != buildEpoch;
+    uint32_t s = resume(cursor);
+    uint32_t best = fresh ? dstates[s].minAccept : NO_MATCH;
+    for (size_t i = 0; i < len; ++i) { // No early exit: the cursor has to end at the end of the piece
+        uint8_t cls = byteClass[data[i]];
+        int32_t t = trans[s * classCount + cls];
+        s = t >= 0 ? static_cast<uint32_t>(t) : step(s, cls);
+        best = std::min(best, dstates[s].minAccept);
+    }
+    cursor.state = s;
+    cursor.epoch = cacheEpoch;
+    cursor.build = buildEpoch;
+    cursor.nfa = dstates[s].nfa;
+    return std::min(best, dstates[s].minEndAccept);
+}
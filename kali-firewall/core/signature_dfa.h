@@ -0,0 +1,134 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// All DPI signatures compiled into one automaton, so a payload is inspected
+// in a single O(payload) pass with no backtracking, however many
+// signatures there are.
+//
+// Each pattern is parsed into a Thompson NFA; the NFAs are joined under one
+// start state, and the combined DFA is built lazily (subset construction
+// on demand, one transition per byte class), capped at MAX_DFA_STATES with
+// the cache flushed when it fills. A DFA state records the lowest pattern
+// id accepting in it, so a scan ends with the first pattern in list order
+// that matches anywhere.
+//
+// Supported: the ECMAScript subset the signatures use: literals, escapes
+// (\d \w \s and their negations, \n \r \t \f \v \0 \xHH \uHHHH up to 0xff,
+// \cX, escaped punctuation), character classes and ranges, ".", groups,
+// "(?:", alternation, * + ? {n} {n,} {n,m} (lazy or not), and "^" / "$" at
+// the start / end of a top-level alternative, plus case-insensitive
+// matching. Anything else (back-references, lookarounds, \b, ...) makes
+// add() return false and the pattern stays with std::regex.
+class SignatureDfa {
+public:
+    static constexpr uint32_t NO_MATCH = UINT32_MAX;
+    static constexpr size_t MAX_DFA_STATES = 4096;
+    static constexpr size_t MAX_NFA_STATES_PER_PATTERN = 4096;
+
+    SignatureDfa() = default;
+    // A copy has the same patterns and build, so a Cursor carries over
+    // between copies, but builds DFA states on its own: copies can scan on
+    // different threads.
+    SignatureDfa(const SignatureDfa& other);
+    SignatureDfa& operator=(const SignatureDfa& other);
+
+    // Adds `pattern` as `id` (ids must be added in increasing order).
+    // Returns false, adding nothing, if it is outside the supported subset.
+    bool add(const std::string& pattern, bool caseInsensitive, uint32_t id);
+    // Call after the last add(); scans before it find nothing.
+    void build();
+    void clear();
+    // Whether add() would take `pattern`.
+    static bool supports(const std::string& pattern, bool caseInsensitive);
+
+    bool empty() const { return patternCount == 0; }
+    size_t patterns() const { return patternCount; }
+    size_t dfaStates() const { return dstates.size(); }
+    uint64_t cacheFlushes() const { return flushes; }
+
+    // Lowest id among the patterns matching somewhere in [data, data + len),
+    // or NO_MATCH. Not const: DFA states are built as the scan needs them.
+    uint32_t firstMatch(const uint8_t* data, size_t len);
+
+    // Scanning a stream in pieces: the automaton position is kept in a
+    // Cursor between feed() calls, so a pattern split across pieces matches
+    // as if the stream had been scanned in one go. "^" matches at the start
+    // of the stream, "$" at the end of each piece (as with one packet).
+    struct Cursor {
+        uint32_t state = 0;
+        uint64_t epoch = 0;          // Cache generation `state` belongs to
+        uint64_t build = 0;          // build() the cursor was fed by; 0 = not started
+        bool midStream = false;      // Started after the stream start (after a gap)
+        std::vector<uint32_t> nfa;   // NFA set of `state`, to find it again after a cache flush
+    };
+    // Back to the stream start, or (midStream) to some point within it.
+    static void reset(Cursor& cursor, bool midStream);
+    // Lowest id among the patterns with a match ending in this piece, or
+    // NO_MATCH. A cursor from before the patterns were last rebuilt, or fed
+    // by another SignatureDfa, resumes as if after a gap.
+    uint32_t feed(Cursor& cursor, const uint8_t* data, size_t len);
+
+private:
+    using ByteSet = std::bitset<256>;
+
+    struct NfaState {
+        std::vector<uint32_t> eps;   // Epsilon edges
+        int32_t byteSet = -1;        // Index into `sets`; -1 = no byte edge
+        uint32_t next = 0;           // Target of the byte edge
+        uint32_t accept = NO_MATCH;  // Pattern id accepted in this state
+        bool atEnd = false;          // ...only at the end of the input ("$")
+    };
+
+    struct DState {
+        std::vector<uint32_t> nfa;   // Sorted NFA states with a byte edge or an accept
+        uint32_t minAccept = NO_MATCH;
+        uint32_t minEndAccept = NO_MATCH;
+    };
+
+    class Parser;
+    struct Node;
+    struct Fragment {
+        uint32_t start;
+        uint32_t end;   // Epsilon-only state, wired up by the caller
+    };
+
+    uint32_t newState();
+    bool compile(const Node& node, Fragment& out, size_t limit);
+    void closure(std::vector<uint32_t>& stack, std::vector<uint32_t>& out);
+    uint32_t intern(std::vector<uint32_t> set);
+    uint32_t step(uint32_t from, uint8_t cls);
+    uint32_t resume(const Cursor& cursor);
+    void resetCache();
+
+    std::vector<NfaState> nfa;
+    std::vector<ByteSet> sets;
+    uint32_t unanchoredStart = 0;   // Re-entered before every byte (search anywhere)
+    uint32_t anchoredStart = 0;     // Only at offset 0 ("^")
+    size_t patternCount = 0;
+    uint32_t lowestId = NO_MATCH;
+
+    uint8_t byteClass[256] = {};
+    std::vector<uint8_t> classByte;   // A representative byte per class
+    size_t classCount = 0;
+
+    std::vector<DState> dstates;
+    std::vector<int32_t> trans;       // dstate * classCount + class; -1 = not built yet
+    std::unordered_map<std::string, uint32_t> index;   // NFA set -> dstate
+    uint32_t startState = 0;
+    // Both drawn from one process-wide counter, so no two caches or builds
+    // of any SignatureDfa share a number.
+    uint64_t cacheEpoch = 0;   // Renewed whenever DFA state ids are invalidated
+    uint64_t buildEpoch = 0;   // Renewed by every build()
+    bool built = false;
+    uint64_t flushes = 0;
+
+    // Scratch for closure()
+    std::vector<uint32_t> mark;
+    uint32_t markEpoch = 0;
+};
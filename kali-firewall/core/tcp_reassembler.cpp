@@ -0,0 +1,276 @@
+#include "tcp_reassembler.h"
+#include <algorithm>
+#include <netinet/tcp.h>
+
+namespace {
+constexpr uint64_t SWEEP_INTERVAL_MS = 1000;
+// How far before the first byte seen the stream may have started.
+constexpr int64_t START_HOLE_SPAN = int64_t(1) << 30;
+
+// Appends `data` to `s`, keeping only the last `max` bytes.
+void appendTail(std::string& s, const char* data, size_t len, size_t max) {
+    if (len >= max) {
+        s.assign(data + len - max, max);
+        return;
+    }
+    s.append(data, len);
+    if (s.size() > max) s.erase(0, s.size() - max);
+}
+}
+
+TcpReassembler::TcpReassembler(const ReassemblyLimits& limits) : lim(limits) {}
+
+void TcpReassembler::setLimits(const ReassemblyLimits& limits) {
+    lim = limits;
+    while (flows.size() > lim.maxFlows && !lru.empty()) {
+        erase(flows.find(lru.back()));
+        ++counters.evictions;
+    }
+}
+
+void TcpReassembler::clear() {
+    flows.clear();
+    lru.clear();
+    heldTotal = 0;
+    closing = false;
+    released.clear();
+}
+
+ReassemblyStats TcpReassembler::stats() const {
+    ReassemblyStats s = counters;
+    s.flows = flows.size();
+    s.bufferedBytes = heldTotal;
+    return s;
+}
+
+void TcpReassembler::dropHeld(Flow& flow) {
+    heldTotal -= flow.heldBytes;
+    flow.heldBytes = 0;
+    flow.held.clear();
+}
+
+TcpReassembler::FlowMap::iterator TcpReassembler::create(const FlowKey& key, uint32_t nextSeq, bool midStream) {
+    if (flows.size() >= lim.maxFlows && !lru.empty()) {
+        erase(flows.find(lru.back()));
+        ++counters.evictions;
+    }
+    lru.push_front(key);
+    auto it = flows.emplace(key, Flow()).first;
+    Flow& flow = it->second;
+    flow.lru = lru.begin();
+    flow.nextSeq = nextSeq;
+    flow.pendingGap = midStream;
+    flow.holes.push_back(Hole{-START_HOLE_SPAN, 0, {}, {}});
+    return it;
+}
+
+void TcpReassembler::erase(FlowMap::iterator it) {
+    if (it == flows.end()) return;
+    dropHeld(it->second);
+    lru.erase(it->second.lru);
+    flows.erase(it);
+}
+
+void TcpReassembler::expireIdle(uint64_t nowMs) {
+    // `lru` is ordered by last sighting, so the idle ones are at the back.
+    while (!lru.empty()) {
+        auto it = flows.find(lru.back());
+        if (nowMs - it->second.lastSeenMs < lim.idleTimeoutMs) break;
+        erase(it);
+    }
+}
+
+void TcpReassembler::deliver(Flow& flow, const uint8_t* data, size_t len, std::vector<Chunk>& chunks) {
+    uint64_t room = flow.offset < lim.streamDepth ? lim.streamDepth - flow.offset : 0;
+    size_t n = static_cast<size_t>(std::min<uint64_t>(len, room));
+    if (n) {
+        chunks.push_back(Chunk{data, n, flow.pendingGap, false});
+        flow.pendingGap = false;
+        const char* text = reinterpret_cast<const char*>(data);
+        if (!flow.holes.empty()) {
+            Hole& last = flow.holes.back();
+            if (last.end + static_cast<int64_t>(last.after.size()) == static_cast<int64_t>(flow.offset)
+                && last.after.size() < lim.holeContext) {
+                last.after.append(text, std::min(n, lim.holeContext - last.after.size()));
+            }
+        }
+        appendTail(flow.recent, text, n, lim.holeContext);
+    }
+    flow.nextSeq += static_cast<uint32_t>(len);
+    flow.offset += len;
+    if (flow.offset >= lim.streamDepth) dropHeld(flow); // Nothing more will be inspected
+}
+
+void TcpReassembler::release(Flow& flow, bool skipGap, uint64_t nowMs, std::vector<Chunk>& chunks) {
+    while (!flow.held.empty() && flow.offset < lim.streamDepth) {
+        auto first = flow.held.begin();
+        if (first->first > flow.offset) {
+            if (!skipGap || flow.holes.size() >= lim.maxHoles) break;
+            // Give up on the hole: carry on after it, scanning as mid-stream,
+            // and remember it in case its bytes still turn up.
+            uint64_t hole = first->first - flow.offset;
+            flow.holes.push_back(Hole{static_cast<int64_t>(flow.offset), static_cast<int64_t>(flow.offset + hole),
+                                      flow.recent, {}});
+            flow.nextSeq += static_cast<uint32_t>(hole);
+            flow.offset += hole;
+            flow.pendingGap = true;
+            ++counters.gapsSkipped;
+            skipGap = false;
+        }
+        uint64_t at = first->first;
+        std::vector<uint8_t> data = std::move(first->second);
+        flow.heldBytes -= data.size();
+        heldTotal -= data.size();
+        flow.held.erase(first);
+        if (at + data.size() <= flow.offset) continue; // Overlapped by what came before
+
+        size_t trim = static_cast<size_t>(flow.offset - at);
+        released.push_back(std::move(data)); // Keeps the bytes alive for the caller
+        const std::vector<uint8_t>& kept = released.back();
+        deliver(flow, kept.data() + trim, kept.size() - trim, chunks);
+    }
+    if (!flow.held.empty()) flow.gapSinceMs = nowMs; // A new hole starts now
+}
+
+bool TcpReassembler::fillHoles(Flow& flow, int64_t at, const uint8_t* data, size_t len,
+                               std::vector<Chunk>& chunks) {
+    bool filled = false;
+    size_t splits = 0;
+    int64_t end = at + static_cast<int64_t>(len);
+    std::vector<Hole> kept;
+    kept.reserve(flow.holes.size() + 1);
+    for (Hole& hole : flow.holes) {
+        int64_t a = std::max(at, hole.start);
+        int64_t b = std::min(end, hole.end);
+        if (a >= b) {
+            kept.push_back(std::move(hole));
+            continue;
+        }
+        const char* fill = reinterpret_cast<const char*>(data + (a - at));
+        size_t n = static_cast<size_t>(b - a);
+        // The bytes around the hole only join up with the fill where it reaches an edge.
+        std::string text;
+        if (a == hole.start) text += hole.before;
+        text.append(fill, n);
+        if (b == hole.end) text += hole.after;
+        released.emplace_back(text.begin(), text.end());
+        chunks.push_back(Chunk{released.back().data(), released.back().size(), true, true});
+        ++counters.lateFills;
+        filled = true;
+
+        bool split = a > hole.start && b < hole.end;
+        if (split && flow.holes.size() + splits + 1 > lim.maxHoles) {
+            kept.push_back(std::move(hole)); // No room to track both halves: keep (and rescan) the whole hole
+            continue;
+        }
+        if (split) ++splits;
+        if (a > hole.start) {
+            Hole left{hole.start, a, hole.before, std::string(fill, n)};
+            if (b == hole.end) left.after += hole.after;
+            if (left.after.size() > lim.holeContext) left.after.resize(lim.holeContext);
+            kept.push_back(std::move(left));
+        }
+        if (b < hole.end) {
+            Hole right{b, hole.end, a == hole.start ? hole.before : std::string(), hole.after};
+            appendTail(right.before, fill, n, lim.holeContext);
+            kept.push_back(std::move(right));
+        }
+    }
+    flow.holes.swap(kept);
+    return filled;
+}
+
+TcpReassembler::Result TcpReassembler::add(const FlowKey& key, uint32_t seq, uint8_t tcpFlags,
+                                           const uint8_t* payload, size_t len, uint64_t nowMs,
+                                           Stream*& stream, std::vector<Chunk>& chunks) {
+    released.clear();
+    chunks.clear();
+    stream = nullptr;
+    if (closing) {
+        erase(flows.find(closingFlow));
+        closing = false;
+    }
+    if (nowMs - lastSweepMs >= SWEEP_INTERVAL_MS) {
+        expireIdle(nowMs);
+        lastSweepMs = nowMs;
+    }
+
+    auto it = flows.find(key);
+    if (tcpFlags & TH_SYN) {
+        // A new SYN means the tuple is being reused for a new connection,
+        // unless it is a retransmission. A blocked flow stays blocked.
+        if (it != flows.end() && !it->second.stream.blocked
+            && !(it->second.synSeen && it->second.isn == seq)) {
+            erase(it);
+            it = flows.end();
+        }
+        if (it == flows.end()) {
+            if (len == 0 && flows.size() >= lim.maxFlows) return Result::Untracked;
+            it = create(key, seq + 1, false);
+            it->second.synSeen = true;
+            it->second.isn = seq;
+        }
+        ++seq; // Payload (TCP Fast Open) follows the SYN
+    } else if (it == flows.end()) {
+        if (len == 0) return Result::Untracked;
+        it = create(key, seq, true); // Joined after the stream start
+    }
+    lru.splice(lru.begin(), lru, it->second.lru);
+
+    Flow& flow = it->second;
+    flow.lastSeenMs = nowMs;
+    stream = &flow.stream;
+    if (!flow.held.empty() && nowMs - flow.gapSinceMs >= lim.gapTimeoutMs)
+        release(flow, true, nowMs, chunks);
+
+    int32_t ahead = static_cast<int32_t>(seq - flow.nextSeq);
+    // Only a RST the receiver would accept (RFC 5961: exactly at the next
+    // expected byte) ends the stream; anyone can send one that is not.
+    bool end = (tcpFlags & TH_RST) && ahead == 0;
+    Result result = len ? Result::Duplicate : Result::Untracked;
+    if (ahead < 0 && len) {
+        // Starts before the stream position: handed out already, or late
+        // bytes for a hole.
+        size_t behind = static_cast<size_t>(std::min<int64_t>(len, -static_cast<int64_t>(ahead)));
+        if (fillHoles(flow, static_cast<int64_t>(flow.offset) + ahead, payload, behind, chunks))
+            result = Result::Delivered;
+        payload += behind;
+        len -= behind;
+        ahead = 0;
+    }
+
+    if (len && flow.offset < lim.streamDepth) {
+        if (ahead == 0) {
+            deliver(flow, payload, len, chunks);
+            release(flow, false, nowMs, chunks);
+            result = Result::Delivered;
+            // A FIN ends the stream once everything before it has been seen.
+            end = end || (tcpFlags & TH_FIN);
+        } else {
+            uint64_t at = flow.offset + static_cast<uint64_t>(ahead);
+            auto existing = flow.held.find(at);
+            if (existing != flow.held.end() && existing->second.size() >= len) return Result::Duplicate;
+            size_t replaced = existing != flow.held.end() ? existing->second.size() : 0;
+            if (flow.heldBytes - replaced + len > lim.perFlowBytes || heldTotal - replaced + len > lim.globalBytes) {
+                ++counters.overflowDrops;
+                return Result::Overflow;
+            }
+            if (flow.held.empty()) flow.gapSinceMs = nowMs;
+            flow.held[at].assign(payload, payload + len);
+            flow.heldBytes += len - replaced;
+            heldTotal += len - replaced;
+            result = Result::Held;
+        }
+    } else if (len) {
+        if (result == Result::Duplicate) result = Result::Untracked; // Past the stream depth
+    } else if (ahead == 0 && (tcpFlags & TH_FIN)) {
+        end = true;
+    }
+
+    if (end && !flow.stream.blocked) {
+        // Erased at the next add(), once the caller is done with `stream`.
+        closing = true;
+        closingFlow = key;
+    }
+    return result;
+}
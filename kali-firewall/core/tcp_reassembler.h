@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "flow_key.h"
+#include "signature_dfa.h"
+
+// Memory and time bounds of TcpReassembler.
+struct ReassemblyLimits {
+    size_t perFlowBytes = 256 * 1024;         // Out-of-order data buffered per direction
+    size_t globalBytes = 32 * 1024 * 1024;    // Out-of-order data buffered over all flows
+    size_t maxFlows = 65536;                  // Directions tracked; the least recently seen goes first
+    uint32_t gapTimeoutMs = 1000;             // Wait for a missing segment, then skip the hole
+    uint32_t idleTimeoutMs = 120000;          // Forget a direction silent for this long
+    uint64_t streamDepth = 1024 * 1024;       // Stream bytes inspected per direction; the rest passes
+    size_t maxHoles = 8;                      // Unscanned ranges remembered per direction; then holes are waited for
+    size_t holeContext = 256;                 // Bytes kept on each side of a hole to scan late bytes with
+};
+
+struct ReassemblyStats {
+    size_t flows = 0;
+    size_t bufferedBytes = 0;
+    uint64_t gapsSkipped = 0;     // Holes given up on after gapTimeoutMs
+    uint64_t lateFills = 0;       // Bytes for a hole that turned up after all, scanned on their own
+    uint64_t overflowDrops = 0;   // Out-of-order segments refused (budget full): dropped for retransmission
+    uint64_t evictions = 0;       // Directions dropped at maxFlows
+};
+
+// In-order reassembly of TCP payload per flow direction, for DPI.
+//
+// A direction's state starts at its SYN, which fixes the stream start
+// (a bare SYN never evicts another flow for it), or else at the first
+// segment carrying payload, which is then scanned as mid-stream. State is
+// dropped on an in-order FIN or a RST at exactly the next expected
+// sequence number (not for a blocked flow), after idleTimeoutMs of
+// silence, or when maxFlows is reached (least recently seen first).
+// Segments are handed to the caller in stream order as soon as they are
+// contiguous. Retransmitted or overlapping bytes are trimmed (the first
+// copy wins). A segment ahead of the stream is copied and held until the
+// hole before it is filled, within perFlowBytes and globalBytes; if it does
+// not fit add() returns Overflow and the caller should drop the packet so
+// the sender retransmits it once there is room, instead of letting the
+// data through uninspected. A hole still open after gapTimeoutMs is
+// skipped. Past streamDepth bytes a direction is no longer inspected.
+//
+// Bytes are only reported as Duplicate once they have been handed out.
+// Whatever lies before the first byte seen, and every skipped hole, is
+// remembered (up to maxHoles, with holeContext bytes from each side); bytes
+// that turn up there later are handed out as a detached chunk, to be
+// scanned on their own between the bytes around them.
+//
+// Not thread-safe; DPIEngine calls it under its own lock.
+class TcpReassembler {
+public:
+    // Scanning state kept per direction for the caller (DPIEngine).
+    struct Stream {
+        SignatureDfa::Cursor cursor;
+        std::string regexTail;   // Last bytes scanned, re-searched by std::regex signatures
+        bool blocked = false;    // A blocking signature matched: drop the rest of the flow
+    };
+
+    // Contiguous stream bytes to scan. Valid until the next add().
+    struct Chunk {
+        const uint8_t* data;
+        size_t len;
+        bool afterGap;   // Bytes are missing before this chunk
+        bool detached;   // Late bytes for a hole plus its context: scan on its own, leave the cursor alone
+    };
+
+    enum class Result {
+        Untracked,   // No payload and no state, or past the stream depth
+        Delivered,   // `chunks` has it (in order, or for a hole), plus any held segments it released
+        Held,        // Ahead of the stream: copied, delivered once the hole is filled
+        Duplicate,   // Already handed out
+        Overflow     // Ahead of the stream and no room to hold it: drop the packet
+    };
+
+    explicit TcpReassembler(const ReassemblyLimits& limits = ReassemblyLimits());
+
+    void setLimits(const ReassemblyLimits& limits);
+    const ReassemblyLimits& limits() const { return lim; }
+
+    // Feeds one TCP segment of `flow` (a direction). `stream` is set to the
+    // direction's scanning state whenever there is one, even when nothing
+    // is delivered (a blocked flow stays blocked).
+    Result add(const FlowKey& flow, uint32_t seq, uint8_t tcpFlags, const uint8_t* payload, size_t len,
+               uint64_t nowMs, Stream*& stream, std::vector<Chunk>& chunks);
+
+    void clear();
+    ReassemblyStats stats() const;
+
+private:
+    // Stream bytes never handed out, by stream offset (negative: before the
+    // first byte seen).
+    struct Hole {
+        int64_t start;
+        int64_t end;
+        std::string before;   // Up to holeContext bytes handed out just before it
+        std::string after;    // ...and just after it
+    };
+
+    struct Flow {
+        Stream stream;
+        uint32_t nextSeq = 0;       // Sequence number of the next in-order byte
+        uint64_t offset = 0;        // Stream bytes passed so far (in order or skipped)
+        std::map<uint64_t, std::vector<uint8_t>> held;   // By stream offset
+        size_t heldBytes = 0;
+        uint64_t gapSinceMs = 0;    // When the oldest open hole appeared
+        uint64_t lastSeenMs = 0;
+        bool pendingGap = false;    // The next chunk follows skipped bytes
+        bool synSeen = false;
+        uint32_t isn = 0;           // Sequence number of the SYN
+        std::vector<Hole> holes;    // By start
+        std::string recent;         // Last holeContext bytes handed out
+        std::list<FlowKey>::iterator lru;
+    };
+
+    using FlowMap = std::unordered_map<FlowKey, Flow, FlowKeyHash>;
+    FlowMap::iterator create(const FlowKey& key, uint32_t nextSeq, bool midStream);
+    void erase(FlowMap::iterator it);
+    void expireIdle(uint64_t nowMs);
+    // Hands out what `flow` holds that is now contiguous (after a skipped hole if `skipGap`).
+    void release(Flow& flow, bool skipGap, uint64_t nowMs, std::vector<Chunk>& chunks);
+    void deliver(Flow& flow, const uint8_t* data, size_t len, std::vector<Chunk>& chunks);
+    // Bytes at stream offsets [at, at + len), all before the stream position:
+    // hands out what falls into holes. Returns false if nothing did.
+    bool fillHoles(Flow& flow, int64_t at, const uint8_t* data, size_t len, std::vector<Chunk>& chunks);
+    void dropHeld(Flow& flow);
+
+    ReassemblyLimits lim;
+    FlowMap flows;
+    std::list<FlowKey> lru;   // Most recently seen first
+    size_t heldTotal = 0;
+    uint64_t lastSweepMs = 0;
+    bool closing = false;     // closingFlow ended (FIN/RST); erased at the next add(),
+    FlowKey closingFlow;      // once the caller is done with its Stream
+    std::vector<std::vector<uint8_t>> released;   // Held segments handed out by the last add()
+    ReassemblyStats counters;
+};
@@ -15,6 +15,13 @@ Dashboard::Dashboard(Logger* logger, QWidget* parent)
       trafficLabel(new QLabel("Traffic: 0 packets", this)),
       blockedLabel(new QLabel("Blocked: 0 packets", this)),
       memoryLabel(new QLabel("Memory Usage: 0 KB", this)),
+      rateLabel(new QLabel("Rate: 0 packets/s, 0 KB/s (GSO packets: 0)", this)),
+      dropReasonLabel(new QLabel("Blocked by rules: 0, by DPI: 0, held for a decision: 0", this)),
+      verdictLabel(new QLabel("Verdict syscalls saved: 0/s", this)),
+      overloadLabel(new QLabel("Kernel queue: backlog 0, dropped 0 (queue full) / 0 (socket full), ENOBUFS 0", this)),
+      flowCacheLabel(new QLabel("Flow cache: hit rate 0%, 0/0 entries, 0 evictions", this)),
+      streamLabel(new QLabel("TCP streams: 0 tracked, 0 KB buffered, 0 gaps skipped, 0 overflow drops", this)),
+      dpiDispatchLabel(new QLabel("DPI: 0.0 of 0 signatures per packet, 0 signature groups", this)),
       cpuBar(new QProgressBar(this)),
       memBar(new QProgressBar(this)),
       statsTimer(new QTimer(this)),
@@ -54,6 +61,13 @@ void Dashboard::setupUI() {
     trafficLayout->addWidget(trafficLabel);
     trafficLayout->addWidget(blockedLabel);
     trafficLayout->addWidget(memoryLabel);
+    trafficLayout->addWidget(rateLabel);
+    trafficLayout->addWidget(dropReasonLabel);
+    trafficLayout->addWidget(verdictLabel);
+    trafficLayout->addWidget(overloadLabel);
+    trafficLayout->addWidget(flowCacheLabel);
+    trafficLayout->addWidget(streamLabel);
+    trafficLayout->addWidget(dpiDispatchLabel);
     trafficBox->setLayout(trafficLayout);
 
     auto* btnLayout = new QHBoxLayout;
@@ -86,6 +100,40 @@ void Dashboard::setStats(int total, int blocked, int memoryKB) {
     }
 }
 
+void Dashboard::setCaptureStats(const CaptureStats& stats) {
+    rateLabel->setText(QString("Rate: %1 packets/s, %2 KB/s (GSO packets: %3)")
+                           .arg(stats.packetsPerSec)
+                           .arg(stats.bytesPerSec / 1024)
+                           .arg(stats.gsoPackets));
+    dropReasonLabel->setText(QString("Blocked by rules: %1, by DPI: %2, held for a decision: %3")
+                                 .arg(stats.blockedByRule)
+                                 .arg(stats.blockedByDpi)
+                                 .arg(stats.heldPackets));
+    verdictLabel->setText(QString("Verdict syscalls saved: %1/s, log records dropped: %2")
+                              .arg(stats.syscallsSavedPerSec)
+                              .arg(stats.logRecordsDropped));
+    overloadLabel->setText(QString("Kernel queue: backlog %1, dropped %2 (queue full) / %3 (socket full), ENOBUFS %4")
+                               .arg(stats.kernelBacklog)
+                               .arg(stats.kernelQueueDropped)
+                               .arg(stats.kernelUserDropped)
+                               .arg(stats.enobufsEvents));
+    double hitRate = stats.flowCacheLookups ? 100.0 * stats.flowCacheHits / stats.flowCacheLookups : 0.0;
+    flowCacheLabel->setText(QString("Flow cache: hit rate %1%, %2/%3 entries, %4 evictions")
+                                .arg(hitRate, 0, 'f', 1)
+                                .arg(stats.flowCacheOccupancy)
+                                .arg(stats.flowCacheCapacity)
+                                .arg(stats.flowCacheEvictions));
+    streamLabel->setText(QString("TCP streams: %1 tracked, %2 KB buffered, %3 gaps skipped, %4 overflow drops")
+                             .arg(stats.streamFlows)
+                             .arg(stats.streamBufferedBytes / 1024)
+                             .arg(stats.streamGapsSkipped)
+                             .arg(stats.streamOverflowDrops));
+    dpiDispatchLabel->setText(QString("DPI: %1 of %2 signatures per packet, %3 signature groups")
+                                  .arg(stats.dpiCandidatesPerPacket, 0, 'f', 1)
+                                  .arg(stats.dpiSignatures)
+                                  .arg(stats.dpiSignatureGroups));
+}
+
 // --- System stats (CPU/memory) for info only ---
 void Dashboard::updateStats() {
     int cpu = getCpuUsage();
@@ -6,6 +6,7 @@
 #include <QPushButton>
 #include <QTimer>
 #include "logger.h"
+#include "capture_stats.h"
 
 class Dashboard : public QWidget {
     Q_OBJECT
@@ -22,6 +23,8 @@ signals:
 public slots:
     // Called by MainWindow to update real-time firewall stats
     void setStats(int total, int blocked, int memoryKB);
+    // Called at PacketCapture's stats interval with the aggregated counters
+    void setCaptureStats(const CaptureStats& stats);
 
 private slots:
     // Periodically updates system stats (CPU/memory) for display
@@ -35,6 +38,13 @@ private:
     QLabel* trafficLabel;
     QLabel* blockedLabel;
     QLabel* memoryLabel;
+    QLabel* rateLabel;
+    QLabel* dropReasonLabel;
+    QLabel* verdictLabel;
+    QLabel* overloadLabel;
+    QLabel* flowCacheLabel;
+    QLabel* streamLabel;
+    QLabel* dpiDispatchLabel;
     QProgressBar* cpuBar;
     QProgressBar* memBar;
     QTimer* statsTimer;
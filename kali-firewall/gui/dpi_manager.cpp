@@ -1,5 +1,6 @@
 #include "dpi_manager.h"
 #include "dpi_engine.h"
+#include "compiled_rule.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFormLayout>
@@ -14,10 +15,32 @@
 #include <QRegularExpression>
 #include <QGroupBox>
 #include <QHeaderView>
+#include <netinet/in.h>
+
+namespace {
+// "tcp, ports 80,8000-8080, to server"; empty for an unscoped signature.
+QString scopeText(const DPIScope& scope) {
+    QStringList parts;
+    if (scope.protocol == IPPROTO_TCP) parts << "tcp";
+    else if (scope.protocol == IPPROTO_UDP) parts << "udp";
+    else if (scope.protocol != 0) parts << QString("proto %1").arg(scope.protocol);
+    if (!scope.ports.empty()) {
+        QStringList ports;
+        for (const auto& range : scope.ports) {
+            ports << (range.first == range.second ? QString::number(range.first)
+                                                  : QString("%1-%2").arg(range.first).arg(range.second));
+        }
+        parts << "ports " + ports.join(',');
+    }
+    if (scope.direction == DPIDirection::ToServer) parts << "to server";
+    else if (scope.direction == DPIDirection::ToClient) parts << "to client";
+    return parts.join(", ");
+}
+}
 
-DPImanager::DPImanager(QWidget* parent)
+DPImanager::DPImanager(DPIEngine* engine, QWidget* parent)
     : QWidget(parent),
-      dpiEngine(new DPIEngine())
+      dpiEngine(engine)
 {
     auto* mainLayout = new QVBoxLayout(this);
 
@@ -35,6 +58,12 @@ DPImanager::DPImanager(QWidget* parent)
     sigResultBox->addItems({"Allow", "Block", "HTTP", "DNS", "TLS", "SSH", "FTP", "SMTP", "QUIC", "NONE", "UNKNOWN"});
     caseInsensitiveBox = new QComboBox(this);
     caseInsensitiveBox->addItems({"No", "Yes"});
+    scopeProtocolBox = new QComboBox(this);
+    scopeProtocolBox->addItems({"Any", "TCP", "UDP"});
+    scopePortsEdit = new QLineEdit(this);
+    scopePortsEdit->setPlaceholderText("Any, or e.g. 53 or 80,443,8000-8080");
+    scopeDirectionBox = new QComboBox(this);
+    scopeDirectionBox->addItems({"Either", "To these ports (client to server)", "From these ports (server to client)"});
     addBtn = new QPushButton("Add Signature", this);
     removeBtn = new QPushButton("Remove Selected", this);
 
@@ -42,6 +71,9 @@ DPImanager::DPImanager(QWidget* parent)
     addLayout->addRow("Regex:", sigRegexEdit);
     addLayout->addRow("Result:", sigResultBox);
     addLayout->addRow("Case Insensitive:", caseInsensitiveBox);
+    addLayout->addRow("Protocol:", scopeProtocolBox);
+    addLayout->addRow("Ports:", scopePortsEdit);
+    addLayout->addRow("Direction:", scopeDirectionBox);
 
     auto* btnLayout = new QHBoxLayout;
     btnLayout->addWidget(addBtn);
@@ -81,6 +113,7 @@ void DPImanager::refreshSignatureList() {
             .arg(QString::fromStdString(info.name))
             .arg(info.case_insensitive ? "i" : "")
             .arg(QString::fromStdString(info.regex_str));
+        if (!info.scope.unscoped()) display += QString("  (%1)").arg(scopeText(info.scope));
         sigList->addItem(display);
     }
 }
@@ -103,6 +136,31 @@ void DPImanager::onAddSignature() {
         return;
     }
 
+    // Scope: only packets of this protocol / on these ports are inspected for it
+    DPIScope scope;
+    if (scopeProtocolBox->currentText() == "TCP") scope.protocol = IPPROTO_TCP;
+    else if (scopeProtocolBox->currentText() == "UDP") scope.protocol = IPPROTO_UDP;
+    QString portsText = scopePortsEdit->text().trimmed();
+    if (!portsText.isEmpty()) {
+        for (const QString& item : portsText.split(',', Qt::SkipEmptyParts)) {
+            uint16_t lo, hi;
+            if (!parsePortRange(item.trimmed().toStdString(), lo, hi)) {
+                QMessageBox::warning(this, "Scope Error", "Invalid port or port range: " + item.trimmed());
+                return;
+            }
+            if (lo == 0 && hi == 0xffff) { // "*" or "0": any port
+                scope.ports.clear();
+                break;
+            }
+            scope.ports.emplace_back(lo, hi);
+        }
+    }
+    scope.direction = static_cast<DPIDirection>(scopeDirectionBox->currentIndex());
+    if (scope.direction != DPIDirection::Any && scope.ports.empty()) {
+        QMessageBox::warning(this, "Scope Error", "A direction needs the ports it is relative to.");
+        return;
+    }
+
     DPIResult result = DPIResult::UNKNOWN;
     if      (resultStr == "Allow")  result = DPIResult::Allow;
     else if (resultStr == "Block")  result = DPIResult::Block;
@@ -116,13 +174,17 @@ void DPImanager::onAddSignature() {
     else if (resultStr == "NONE")   result = DPIResult::NONE;
     else if (resultStr == "UNKNOWN")result = DPIResult::UNKNOWN;
 
-    if (dpiEngine->addSignature(name.toStdString(), regex.toStdString(), result, caseInsensitive)) {
+    if (dpiEngine->addSignature(name.toStdString(), regex.toStdString(), result, caseInsensitive, scope)) {
         refreshSignatureList();
+        emit signaturesChanged();
         QMessageBox::information(this, "Signature Added", "Signature added successfully.");
         sigNameEdit->clear();
         sigRegexEdit->clear();
         sigResultBox->setCurrentIndex(0);
         caseInsensitiveBox->setCurrentIndex(0);
+        scopeProtocolBox->setCurrentIndex(0);
+        scopePortsEdit->clear();
+        scopeDirectionBox->setCurrentIndex(0);
     } else {
         QMessageBox::warning(this, "Duplicate Signature", "A signature with this name already exists.");
     }
@@ -139,6 +201,7 @@ void DPImanager::onRemoveSignature() {
     QString name = display.section(' ', 0, 0);
     if (dpiEngine->removeSignature(name.toStdString())) {
         refreshSignatureList();
+        emit signaturesChanged();
         QMessageBox::information(this, "Signature Removed", "Signature removed successfully.");
     } else {
         QMessageBox::warning(this, "Remove Signature", "Signature not found.");
@@ -162,7 +225,7 @@ void DPImanager::onTestDPI() {
     }
 
     std::string matched;
-    DPIResult res = dpiEngine->inspect(reinterpret_cast<const uint8_t*>(payload.constData()), payload.size(), matched);
+    DPIResult res = dpiEngine->testPayload(payload.toStdString(), &matched);
 
     QString resStr;
     switch (res) {
@@ -12,7 +12,11 @@
 class DPImanager : public QWidget {
     Q_OBJECT
 public:
-    explicit DPImanager(QWidget* parent = nullptr);
+    explicit DPImanager(DPIEngine* engine, QWidget* parent = nullptr);
+
+signals:
+    // Emitted after a signature was added or removed.
+    void signaturesChanged();
 
 private slots:
     void refreshSignatureList();
@@ -28,6 +32,9 @@ private:
     QLineEdit* sigRegexEdit;
     QComboBox* sigResultBox;
     QComboBox* caseInsensitiveBox;
+    QComboBox* scopeProtocolBox;
+    QLineEdit* scopePortsEdit;
+    QComboBox* scopeDirectionBox;
     QPushButton* addBtn;
     QPushButton* removeBtn;
 
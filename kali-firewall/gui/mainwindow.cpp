@@ -16,12 +16,13 @@
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent),
+      dpiEngine(new DPIEngine),
       stackedWidget(new QStackedWidget(this)),
       dashboard(new Dashboard(&Logger::instance(), this)),
       logViewer(new LogViewer(this)),
       ruleEditor(new RuleEditor(this)),
       trafficShaperUI(new TrafficShaperUI(this)),
-      dpiManager(new DPImanager(this)),
+      dpiManager(new DPImanager(dpiEngine, this)),
       navToolBar(new QToolBar("Navigation", this)),
       dashboardAction(new QAction(QIcon::fromTheme("view-dashboard"), "Dashboard", this)),
       logAction(new QAction(QIcon::fromTheme("document-open"), "Logs", this)),
@@ -31,7 +32,7 @@ MainWindow::MainWindow(QWidget* parent)
       interactiveModeButton(new QToolButton(this)),
       ruleEngine(new RuleEngine(this, "../config/default_rules.json")),
       packetCapture(new PacketCapture),
-      dpiEngine(new DPIEngine)
+      nftOffload(new NftOffload(ruleEngine, dpiEngine, this))
 {
     setWindowTitle("Kali Firewall");
     setMinimumSize(900, 600);
@@ -56,6 +57,9 @@ MainWindow::MainWindow(QWidget* parent)
     // --- INTERACTIVE FIREWALL POPUP INTEGRATION ---
     connect(ruleEngine, &RuleEngine::userDecisionNeeded,
             this, &MainWindow::onUserDecisionNeeded);
+    // Answers (and timeouts) release the packets held for that flow
+    connect(ruleEngine, &RuleEngine::flowResolved,
+            packetCapture, &PacketCapture::releaseFlow);
     ruleEngine->setInteractiveMode(true); // Default ON
 
     // --- INTERACTIVE MODE TOGGLE BUTTON ---
@@ -66,16 +70,65 @@ MainWindow::MainWindow(QWidget* parent)
     connect(interactiveModeButton, &QToolButton::toggled,
             this, &MainWindow::onInteractiveModeToggled);
 
+    // Per-rule hit counters in the rule editor
+    ruleEditor->setRuleEngine(ruleEngine);
+
     // --- PACKET CAPTURE & DPI INTEGRATION ---
     packetCapture->setRuleEngine(ruleEngine);
     packetCapture->setDPIEngine(dpiEngine);
 
-    // Connect stats signal to dashboard update
+    // Inspect TCP as reassembled streams, so a signature split across
+    // segments still matches (whole packets are copied while DPI is active)
+    dpiEngine->setStreamReassembly(true);
+
+    // Only copy the bytes that will be inspected; re-derived on signature edits
+    packetCapture->refreshCopyRange();
+    connect(dpiManager, &DPImanager::signaturesChanged,
+            packetCapture, &PacketCapture::refreshCopyRange);
+
+    // Connect stats signals (emitted at a fixed 4 Hz) to dashboard update
     connect(packetCapture, &PacketCapture::statsUpdated,
             this, &MainWindow::updateStatsDisplay);
-
-    // Start packet capture (queue 0, adjust if needed)
-    packetCapture->init(0);
+    connect(packetCapture, &PacketCapture::statsSnapshot,
+            dashboard, &Dashboard::setCaptureStats);
+
+    // Coalesce up to 32 consecutive accepts into one batch verdict
+    packetCapture->setVerdictBatching(32, 1);
+
+    // Let each queue absorb bursts (4096 packets, 8 MB socket buffer). Fail-open
+    // stays off: a full queue drops rather than letting traffic bypass the rules.
+    packetCapture->setQueueLimits(4096, 8 * 1024 * 1024, false);
+
+    // Take bulk sends as unsegmented GSO packets: one verdict per ~64 KB.
+    packetCapture->setGsoQueueing(true);
+
+    // Hand flows with a final verdict to the kernel via connmark, one decision
+    // per direction (FW_FASTPATH chain in scripts/setup_iptables.sh);
+    // re-evaluate them after rule, mode or signature changes.
+    packetCapture->setFlowMarking(true);
+    connect(ruleEngine, &RuleEngine::rulesChanged,
+            packetCapture, &PacketCapture::ruleSetChanged);
+    connect(ruleEngine, &RuleEngine::interactiveModeChanged,
+            packetCapture, &PacketCapture::interactiveModeChanged);
+    connect(dpiManager, &DPImanager::signaturesChanged,
+            packetCapture, &PacketCapture::signatureSetChanged);
+
+    // Let nftables decide what the rules decide on their own (inet kali_firewall
+    // table), so only traffic needing DPI or a prompt is queued. Recompiled on
+    // every change to the rules, the interactive mode or the signatures.
+    nftOffload->setFlowMarks(0x1, 0x3); // Same bits as setFlowMarking above
+    connect(ruleEngine, &RuleEngine::rulesChanged,
+            nftOffload, &NftOffload::sync);
+    connect(ruleEngine, &RuleEngine::interactiveModeChanged,
+            nftOffload, &NftOffload::sync);
+    connect(dpiManager, &DPImanager::signaturesChanged,
+            nftOffload, &NftOffload::sync);
+    nftOffload->setEnabled(true);
+
+    // Start packet capture on queues 0..N-1, one worker per queue.
+    // FIREWALL_QUEUES must match the queue count used by scripts/setup_iptables.sh.
+    int numQueues = qMax(1, qEnvironmentVariableIntValue("FIREWALL_QUEUES"));
+    packetCapture->initQueues(0, static_cast<uint16_t>(numQueues));
     packetCapture->start();
 
     // Initialize dashboard stats
@@ -152,11 +205,7 @@ void MainWindow::onUserDecisionNeeded(const PacketInfo& pkt) {
         this, "Firewall Decision", msg, QMessageBox::Yes | QMessageBox::No);
 
     if (ruleEngine) {
-        if (reply == QMessageBox::Yes) {
-            ruleEngine->userDecisionReceived("allow");
-        } else {
-            ruleEngine->userDecisionReceived("block");
-        }
+        ruleEngine->resolveDecision(pkt, reply == QMessageBox::Yes ? "allow" : "block");
     }
 }
 
@@ -13,6 +13,7 @@
 #include "rule_engine.h"
 #include "packet_capture.h"
 #include "dpi_engine.h"
+#include "nft_offload.h"
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -37,6 +38,9 @@ private:
     void setupNavigation();
     void setupConnections();
 
+    // Created first: the DPI manager page edits this engine's signatures.
+    DPIEngine* dpiEngine;
+
     QStackedWidget* stackedWidget;
     Dashboard* dashboard;
     LogViewer* logViewer;
@@ -54,5 +58,5 @@ private:
 
     RuleEngine* ruleEngine;
     PacketCapture* packetCapture;
-    DPIEngine* dpiEngine;
+    NftOffload* nftOffload;
 };
\ No newline at end of file
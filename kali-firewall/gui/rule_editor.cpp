@@ -1,4 +1,6 @@
 #include "rule_editor.h"
+#include "rule_engine.h"
+#include "rule_journal.h"
 #include <QJsonObject>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
@@ -8,7 +10,25 @@
 #include <QJsonDocument>
 #include <QMessageBox>
 #include <QNetworkInterface>
-#include <QRegularExpression>
+#include <QDateTime>
+#include <QHash>
+#include <QLocale>
+#include <QTimer>
+
+namespace {
+// Columns 0..RULE_COLUMNS-1 are the rule itself, the rest are read-only counters.
+constexpr int RULE_COLUMNS = 6;
+constexpr int STATS_REFRESH_MS = 1000;
+
+QString lastHitText(std::time_t t) {
+    return t ? QDateTime::fromSecsSinceEpoch(t).toString("yyyy-MM-dd hh:mm:ss") : QString("never");
+}
+
+QString statsKey(const QString& srcIp, const QString& dstIp, const QString& srcPort,
+                 const QString& dstPort, const QString& protocol, const QString& action) {
+    return srcIp + '|' + dstIp + '|' + srcPort + '|' + dstPort + '|' + protocol.toLower() + '|' + action.toLower();
+}
+}
 
 RuleEditor::RuleEditor(QWidget* parent)
     : QWidget(parent),
@@ -17,11 +37,16 @@ RuleEditor::RuleEditor(QWidget* parent)
       removeBtn(new QPushButton("Remove Selected", this)),
       saveBtn(new QPushButton("Save", this)),
       loadBtn(new QPushButton("Load", this)),
+      optimizeBtn(new QPushButton("Optimize", this)),
       statusLabel(new QLabel(this)),
+      defaultPolicyLabel(new QLabel(this)),
+      statsTimer(new QTimer(this)),
+      ruleEngine(nullptr),
       rulesPath("../config/default_rules.json")
 {
-    table->setColumnCount(5);
-    table->setHorizontalHeaderLabels({"Source IP", "Destination IP", "Source Port", "Destination Port", "Action"});
+    table->setColumnCount(RULE_COLUMNS + 3);
+    table->setHorizontalHeaderLabels({"Source IP", "Destination IP", "Source Port", "Destination Port", "Protocol",
+                                      "Action", "Hits", "Bytes", "Last Hit"});
     table->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
     table->setSelectionBehavior(QAbstractItemView::SelectRows);
     table->setSelectionMode(QAbstractItemView::SingleSelection);
@@ -31,10 +56,12 @@ RuleEditor::RuleEditor(QWidget* parent)
     btnLayout->addWidget(removeBtn);
     btnLayout->addWidget(saveBtn);
     btnLayout->addWidget(loadBtn);
+    btnLayout->addWidget(optimizeBtn);
 
     auto* mainLayout = new QVBoxLayout(this);
     mainLayout->addWidget(table);
     mainLayout->addLayout(btnLayout);
+    mainLayout->addWidget(defaultPolicyLabel);
     mainLayout->addWidget(statusLabel);
 
     setLayout(mainLayout);
@@ -43,6 +70,8 @@ RuleEditor::RuleEditor(QWidget* parent)
     connect(removeBtn, &QPushButton::clicked, this, &RuleEditor::removeSelectedRule);
     connect(saveBtn, &QPushButton::clicked, this, &RuleEditor::saveToFile);
     connect(loadBtn, &QPushButton::clicked, this, &RuleEditor::loadFromFile);
+    connect(optimizeBtn, &QPushButton::clicked, this, &RuleEditor::optimizeRules);
+    connect(statsTimer, &QTimer::timeout, this, &RuleEditor::refreshRuleStats);
 
     loadRules(rulesPath);
     updateStatus("Ready.");
@@ -50,15 +79,116 @@ RuleEditor::RuleEditor(QWidget* parent)
 
 RuleEditor::~RuleEditor() = default;
 
+void RuleEditor::setRuleEngine(RuleEngine* engine) {
+    ruleEngine = engine;
+    optimizeBtn->setEnabled(ruleEngine != nullptr);
+    if (ruleEngine) {
+        statsTimer->start(STATS_REFRESH_MS);
+        refreshRuleStats();
+    } else {
+        statsTimer->stop();
+    }
+}
+
 void RuleEditor::addRule() {
     int row = table->rowCount();
     table->insertRow(row);
-    for (int col = 0; col < table->columnCount(); ++col) {
+    for (int col = 0; col < RULE_COLUMNS; ++col) {
         table->setItem(row, col, new QTableWidgetItem(""));
     }
+    setStatsCells(row, "-", "-", "-");
     updateStatus("Added new rule.");
 }
 
+void RuleEditor::setStatsCells(int row, const QString& hits, const QString& bytes, const QString& lastHit) {
+    const QString values[] = {hits, bytes, lastHit};
+    for (int i = 0; i < 3; ++i) {
+        QTableWidgetItem* item = table->item(row, RULE_COLUMNS + i);
+        if (!item) {
+            item = new QTableWidgetItem;
+            item->setFlags(item->flags() & ~Qt::ItemIsEditable);
+            table->setItem(row, RULE_COLUMNS + i, item);
+        }
+        item->setText(values[i]);
+    }
+}
+
+void RuleEditor::refreshRuleStats() {
+    if (!ruleEngine || !isVisible()) return;
+    RuleStatsReport report = ruleEngine->ruleStats();
+
+    // The table is an edited copy of the rule file, so rows are matched to the
+    // engine's rules by content (duplicates in order) rather than by position.
+    QHash<QString, QList<int>> byKey;
+    for (int i = 0; i < report.rules.size(); ++i) {
+        const Rule& rule = report.rules[i];
+        byKey[statsKey(rule.srcIp, rule.dstIp, rule.srcPort, rule.dstPort, rule.protocol, rule.action)].append(i);
+    }
+
+    QLocale locale;
+    for (int row = 0; row < table->rowCount(); ++row) {
+        auto text = [&](int col) { return table->item(row, col) ? table->item(row, col)->text() : QString(); };
+        QList<int>& matches = byKey[statsKey(text(0), text(1), text(2), text(3), text(4), text(5))];
+        if (matches.isEmpty()) {
+            setStatsCells(row, "-", "-", "-"); // Not active in the engine (unsaved edit)
+            continue;
+        }
+        const RuleStats& stats = report.stats[matches.takeFirst()];
+        setStatsCells(row, QString::number(stats.hits), locale.formattedDataSize(stats.bytes),
+                      lastHitText(stats.lastHit));
+    }
+
+    const RuleStats& fallback = report.defaultPolicy;
+    defaultPolicyLabel->setText(QString("No rule matched (default policy): %1 packets, %2, last hit %3")
+                                    .arg(fallback.hits)
+                                    .arg(locale.formattedDataSize(fallback.bytes))
+                                    .arg(lastHitText(fallback.lastHit)));
+}
+
+void RuleEditor::optimizeRules() {
+    if (!ruleEngine) return;
+    RuleOptimizationReport report = ruleEngine->analyzeRules();
+    if (report.removed() == 0) {
+        updateStatus(QString("Nothing to optimize: none of the %1 active rules is shadowed, redundant or mergeable.")
+                         .arg(report.rulesBefore));
+        return;
+    }
+    if (!report.verified) {
+        updateStatus("Optimized rules gave different verdicts on sampled traffic; not offered.", true);
+        return;
+    }
+
+    double speedup = report.nsPerLookupAfter > 0 ? report.nsPerLookupBefore / report.nsPerLookupAfter : 1.0;
+    QString summary = QString("The active rules can go from %1 to %2 with the same verdicts:\n\n"
+                              "  never matching: %3\n"
+                              "  shadowed by an earlier rule: %4\n"
+                              "  redundant with a later rule: %5\n"
+                              "  merged into a wider range: %6\n\n"
+                              "Rule lookup: %7 ns -> %8 ns per packet (%9x).\n\n"
+                              "Replace the active rules? Unsaved edits in this table are discarded.")
+                          .arg(report.rulesBefore)
+                          .arg(report.rules.size())
+                          .arg(report.neverMatching)
+                          .arg(report.shadowed)
+                          .arg(report.redundant)
+                          .arg(report.merged)
+                          .arg(report.nsPerLookupBefore, 0, 'f', 1)
+                          .arg(report.nsPerLookupAfter, 0, 'f', 1)
+                          .arg(speedup, 0, 'f', 2);
+    if (QMessageBox::question(this, "Optimize Rules", summary) != QMessageBox::Yes)
+        return;
+
+    if (!ruleEngine->applyOptimizedRules(report)) {
+        updateStatus("Rules changed while optimizing; try again.", true);
+        return;
+    }
+    QJsonArray rules;
+    for (const Rule& rule : ruleEngine->getRules())
+        rules.append(RuleJournal::toJson(rule));
+    populateTable(rules);
+    updateStatus(QString("Optimized rules: %1 -> %2.").arg(report.rulesBefore).arg(report.rules.size()));
+}
+
 void RuleEditor::removeSelectedRule() {
     auto selected = table->selectionModel()->selectedRows();
     if (selected.isEmpty()) {
@@ -133,8 +263,11 @@ void RuleEditor::populateTable(const QJsonArray& rules) {
         table->setItem(row, 1, new QTableWidgetItem(obj.value("dst_ip").toString()));
         table->setItem(row, 2, new QTableWidgetItem(obj.value("src_port").toVariant().toString()));
         table->setItem(row, 3, new QTableWidgetItem(obj.value("dst_port").toVariant().toString()));
-        table->setItem(row, 4, new QTableWidgetItem(obj.value("action").toString()));
+        table->setItem(row, 4, new QTableWidgetItem(obj.value("protocol").toString()));
+        table->setItem(row, 5, new QTableWidgetItem(obj.value("action").toString()));
+        setStatsCells(row, "-", "-", "-");
     }
+    refreshRuleStats();
 }
 
 QJsonArray RuleEditor::collectRules() const {
@@ -143,31 +276,47 @@ QJsonArray RuleEditor::collectRules() const {
         QJsonObject obj;
         obj["src_ip"] = table->item(row, 0) ? table->item(row, 0)->text() : "";
         obj["dst_ip"] = table->item(row, 1) ? table->item(row, 1)->text() : "";
-        obj["src_port"] = table->item(row, 2) ? table->item(row, 2)->text().toInt() : 0;
-        obj["dst_port"] = table->item(row, 3) ? table->item(row, 3)->text().toInt() : 0;
-        obj["action"] = table->item(row, 4) ? table->item(row, 4)->text() : "";
+        // Numbers stay numbers; ranges ("lo-hi") are kept as text.
+        for (int col : {2, 3}) {
+            QString port = table->item(row, col) ? table->item(row, col)->text().trimmed() : "";
+            bool isNumber = false;
+            int n = port.toInt(&isNumber);
+            obj[col == 2 ? "src_port" : "dst_port"] = isNumber ? QJsonValue(n) : QJsonValue(port.isEmpty() ? "0" : port);
+        }
+        QString protocol = table->item(row, 4) ? table->item(row, 4)->text().trimmed() : "";
+        if (!protocol.isEmpty())
+            obj["protocol"] = protocol;
+        obj["action"] = table->item(row, 5) ? table->item(row, 5)->text() : "";
         arr.append(obj);
     }
     return arr;
 }
 
 bool RuleEditor::validateAllRules() const {
-    QRegularExpression ipRegex(R"(^(\*|(\d{1,3}\.){3}\d{1,3})$)");
     QStringList validActions = {"Allow", "Block", "Log", "Drop"};
     for (int row = 0; row < table->rowCount(); ++row) {
         QString src_ip = table->item(row, 0) ? table->item(row, 0)->text() : "";
         QString dst_ip = table->item(row, 1) ? table->item(row, 1)->text() : "";
         QString src_port = table->item(row, 2) ? table->item(row, 2)->text() : "";
         QString dst_port = table->item(row, 3) ? table->item(row, 3)->text() : "";
-        QString action = table->item(row, 4) ? table->item(row, 4)->text() : "";
+        QString protocol = table->item(row, 4) ? table->item(row, 4)->text().trimmed() : "";
+        QString action = table->item(row, 5) ? table->item(row, 5)->text() : "";
 
-        if (!ipRegex.match(src_ip).hasMatch() || !ipRegex.match(dst_ip).hasMatch()) {
+        // Same parsers as the engine: "*", an address or a CIDR prefix (IPv4
+        // or IPv6); "0"/"*" for any port, a port, or a "lo-hi" range.
+        uint8_t family, prefix;
+        uint32_t net[4], mask[4];
+        if (!parseAddressPrefix(src_ip.toStdString(), family, prefix, net, mask) ||
+            !parseAddressPrefix(dst_ip.toStdString(), family, prefix, net, mask)) {
+            return false;
+        }
+        uint16_t lo, hi;
+        if (!parsePortRange(src_port.toStdString(), lo, hi) || !parsePortRange(dst_port.toStdString(), lo, hi)) {
             return false;
         }
-        bool ok1, ok2;
-        int sp = src_port.toInt(&ok1);
-        int dp = dst_port.toInt(&ok2);
-        if (!ok1 || !ok2 || sp < 0 || sp > 65535 || dp < 0 || dp > 65535) {
+        // Empty means any protocol; otherwise a name or number the engine parses.
+        int16_t protocolNumber = 0;
+        if (!protocol.isEmpty() && !parseProtocol(protocol.toStdString(), protocolNumber)) {
             return false;
         }
         if (!validActions.contains(action, Qt::CaseInsensitive)) {
@@ -6,6 +6,9 @@
 #include <QLabel>
 #include <QJsonArray>
 
+class QTimer;
+class RuleEngine;
+
 class RuleEditor : public QWidget {
     Q_OBJECT
 public:
@@ -21,6 +24,10 @@ public:
     // Validates all rules in the table
     bool validateAllRules() const;
 
+    // Source of the Hits/Bytes/Last Hit columns, refreshed once a second
+    // while the editor is visible.
+    void setRuleEngine(RuleEngine* engine);
+
 signals:
     void rulesChanged(const QJsonArray& rules);
 
@@ -29,17 +36,26 @@ private slots:
     void removeSelectedRule();
     void saveToFile();
     void loadFromFile();
+    void refreshRuleStats();
+    // Analyzes the engine's rules, shows what the optimizer would remove and
+    // the measured lookup time, and applies the result if the user agrees.
+    void optimizeRules();
 
 private:
     void populateTable(const QJsonArray& rules);
     QJsonArray collectRules() const;
     void updateStatus(const QString& msg, bool error = false);
+    void setStatsCells(int row, const QString& hits, const QString& bytes, const QString& lastHit);
 
     QTableWidget* table;
     QPushButton* addBtn;
     QPushButton* removeBtn;
     QPushButton* saveBtn;
     QPushButton* loadBtn;
+    QPushButton* optimizeBtn;
     QLabel* statusLabel;
+    QLabel* defaultPolicyLabel;
+    QTimer* statsTimer;
+    RuleEngine* ruleEngine;
     QString rulesPath;
 };
\ No newline at end of file
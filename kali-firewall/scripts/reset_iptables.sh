@@ -3,5 +3,9 @@
 
 echo "[*] Flushing all iptables rules..."
 iptables -F
+iptables -X FW_FASTPATH 2>/dev/null
+ip6tables -F
+ip6tables -X FW_FASTPATH 2>/dev/null
+nft delete table inet kali_firewall 2>/dev/null
 
 echo "[*] iptables rules reset."
\ No newline at end of file
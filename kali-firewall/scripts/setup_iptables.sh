@@ -1,11 +1,63 @@
 #!/bin/bash
 # Run as root
+# Usage: setup_iptables.sh [num_queues]
+# With more than one queue, packets are spread over queues 0..N-1 by a hash
+# of their address pair. The hash is symmetric, so both directions of a flow
+# land on the same worker. Start the firewall with FIREWALL_QUEUES=N so every
+# queue has a worker.
 
-echo "[*] Flushing old iptables rules..."
-iptables -F
+NUM_QUEUES=${1:-${FIREWALL_QUEUES:-1}}
 
-echo "[*] Redirecting all INPUT and OUTPUT packets to NFQUEUE 0..."
-iptables -A INPUT -j NFQUEUE --queue-num 0
-iptables -A OUTPUT -j NFQUEUE --queue-num 0
+# Decision bits the firewall puts in the packet mark (see PacketCapture::setFlowMarking)
+ALLOW_MARK=0x1
+DROP_MARK=0x2
+MARK_MASK=0x3
+# The connmark keeps one decision per direction: rules match source and
+# destination, so allowing a request says nothing about its replies. The
+# original direction uses the bits above, the reply direction the same bits
+# shifted up by 2 (the firewall's reply_shift).
+REPLY_ALLOW_MARK=0x4
+REPLY_DROP_MARK=0x8
+REPLY_MASK=0xc
 
-echo "[*] iptables rules set for NFQUEUE 0."
\ No newline at end of file
+# Everything below is applied to both iptables and ip6tables; the firewall
+# binds the queues for IPv4 and IPv6.
+for IPT in iptables ip6tables; do
+    echo "[*] Flushing old $IPT rules..."
+    $IPT -F
+
+    # Fast path: once a flow has a final verdict it is handled here in the kernel.
+    # The firewall re-injects the deciding packet (NF_REPEAT) with the decision in
+    # its mark; that mark is saved to the connmark so later packets never reach
+    # the queue. The firewall's nftables offload table (inet kali_firewall) sets
+    # the same allow bits for packets its rules accept in the kernel.
+    # A decision only covers the direction of the packet that carried it: a
+    # packet is matched against, and saved to, its own direction's bits, so
+    # the other direction still goes to the queue until it has a verdict too.
+    echo "[*] Setting up FW_FASTPATH chain (per-direction connmark verdicts)..."
+    $IPT -N FW_FASTPATH 2>/dev/null || $IPT -F FW_FASTPATH
+    $IPT -A FW_FASTPATH -m conntrack --ctdir ORIGINAL -m connmark --mark $ALLOW_MARK/$MARK_MASK -j ACCEPT
+    $IPT -A FW_FASTPATH -m conntrack --ctdir ORIGINAL -m connmark --mark $DROP_MARK/$MARK_MASK -j DROP
+    $IPT -A FW_FASTPATH -m conntrack --ctdir REPLY -m connmark --mark $REPLY_ALLOW_MARK/$REPLY_MASK -j ACCEPT
+    $IPT -A FW_FASTPATH -m conntrack --ctdir REPLY -m connmark --mark $REPLY_DROP_MARK/$REPLY_MASK -j DROP
+    $IPT -A FW_FASTPATH -m conntrack --ctdir ORIGINAL -m mark ! --mark 0x0/$MARK_MASK -j CONNMARK --save-mark --nfmask $MARK_MASK --ctmask $MARK_MASK
+    $IPT -A FW_FASTPATH -m conntrack --ctdir REPLY -m mark --mark $ALLOW_MARK/$MARK_MASK -j CONNMARK --set-mark $REPLY_ALLOW_MARK/$REPLY_MASK
+    $IPT -A FW_FASTPATH -m conntrack --ctdir REPLY -m mark --mark $DROP_MARK/$MARK_MASK -j CONNMARK --set-mark $REPLY_DROP_MARK/$REPLY_MASK
+    $IPT -A FW_FASTPATH -m mark --mark $ALLOW_MARK/$MARK_MASK -j ACCEPT
+    $IPT -A FW_FASTPATH -m mark --mark $DROP_MARK/$MARK_MASK -j DROP
+    $IPT -A INPUT -j FW_FASTPATH
+    $IPT -A OUTPUT -j FW_FASTPATH
+
+    if [ "$NUM_QUEUES" -gt 1 ]; then
+        LAST_QUEUE=$((NUM_QUEUES - 1))
+        echo "[*] Balancing all INPUT and OUTPUT packets over NFQUEUE 0:$LAST_QUEUE..."
+        $IPT -A INPUT -j NFQUEUE --queue-balance 0:$LAST_QUEUE
+        $IPT -A OUTPUT -j NFQUEUE --queue-balance 0:$LAST_QUEUE
+        echo "[*] $IPT rules set for NFQUEUE 0:$LAST_QUEUE."
+    else
+        echo "[*] Redirecting all INPUT and OUTPUT packets to NFQUEUE 0..."
+        $IPT -A INPUT -j NFQUEUE --queue-num 0
+        $IPT -A OUTPUT -j NFQUEUE --queue-num 0
+        echo "[*] $IPT rules set for NFQUEUE 0."
+    fi
+done
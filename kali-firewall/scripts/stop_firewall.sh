@@ -28,21 +28,38 @@ else
     done
 fi
 
-# Remove all iptables rules using NFQUEUE
-echo "[*] Scanning for iptables NFQUEUE rules to remove..."
-NFQUEUE_RULES=$(sudo iptables-save | grep NFQUEUE || true)
-if [ -z "$NFQUEUE_RULES" ]; then
-    echo -e "${YELLOW}[!] No NFQUEUE rules found in iptables.${NC}"
-else
-    echo "[*] Removing all NFQUEUE rules from iptables..."
-    sudo iptables-save | grep NFQUEUE | while read -r rule ; do
-        chain=$(echo $rule | awk '{print $2}')
-        rule_spec=$(echo $rule | sed 's/-A [A-Z0-9_]* //')
-        echo "[*] Removing rule from $chain: $rule_spec"
-        sudo iptables -D $chain $rule_spec 2>/dev/null || \
-            echo -e "${YELLOW}[!] Could not remove rule: $rule_spec from $chain (may already be gone).${NC}"
-    done
-    echo -e "${GREEN}[*] All NFQUEUE rules removed from iptables.${NC}"
+for IPT in iptables ip6tables; do
+    # Remove all rules using NFQUEUE
+    echo "[*] Scanning for $IPT NFQUEUE rules to remove..."
+    NFQUEUE_RULES=$(sudo $IPT-save | grep NFQUEUE || true)
+    if [ -z "$NFQUEUE_RULES" ]; then
+        echo -e "${YELLOW}[!] No NFQUEUE rules found in $IPT.${NC}"
+    else
+        echo "[*] Removing all NFQUEUE rules from $IPT..."
+        sudo $IPT-save | grep NFQUEUE | while read -r rule ; do
+            chain=$(echo $rule | awk '{print $2}')
+            rule_spec=$(echo $rule | sed 's/-A [A-Z0-9_]* //')
+            echo "[*] Removing rule from $chain: $rule_spec"
+            sudo $IPT -D $chain $rule_spec 2>/dev/null || \
+                echo -e "${YELLOW}[!] Could not remove rule: $rule_spec from $chain (may already be gone).${NC}"
+        done
+        echo -e "${GREEN}[*] All NFQUEUE rules removed from $IPT.${NC}"
+    fi
+
+    # Remove the connmark fast path chain
+    if sudo $IPT -L FW_FASTPATH -n > /dev/null 2>&1; then
+        echo "[*] Removing $IPT FW_FASTPATH chain..."
+        sudo $IPT -D INPUT -j FW_FASTPATH 2>/dev/null
+        sudo $IPT -D OUTPUT -j FW_FASTPATH 2>/dev/null
+        sudo $IPT -F FW_FASTPATH
+        sudo $IPT -X FW_FASTPATH
+    fi
+done
+
+# Remove the nftables rule offload table (see NftOffload)
+if sudo nft list table inet kali_firewall > /dev/null 2>&1; then
+    echo "[*] Removing nftables offload table..."
+    sudo nft delete table inet kali_firewall
 fi
 
 echo -e "${GREEN}==== Firewall stopped and iptables cleaned. ====${NC}"
\ No newline at end of file
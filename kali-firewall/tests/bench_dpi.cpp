@@ -0,0 +1,112 @@
+// DPI cost per payload at 10, 100 and 1000 signatures: std::regex run per
+// signature (testPayload before the prefilter), DPIEngine::testPayload with
+// the literal prefilter only, and with the combined DFA.
+// Build with -DFIREWALL_BUILD_BENCHMARKS=ON.
+#include "dpi_engine.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr size_t PAYLOADS = 2000;
+constexpr double MIN_SECONDS = 0.5;
+
+struct Sig {
+    std::string regex;
+    bool icase;
+};
+
+// A mix of the shapes the DPI manager gets: header values, paths, query
+// parameters, domains and banners, each made unique by a number.
+Sig signature(size_t n) {
+    std::string id = std::to_string(n);
+    switch (n % 6) {
+    case 0: return {"User-Agent: [^\\r\\n]*bot" + id, true};
+    case 1: return {"GET /(?:admin|wp-login)" + id + "\\.php", false};
+    case 2: return {"(?:cmd|exec|system)" + id + "=[a-z0-9]+", false};
+    case 3: return {"X-Trace-" + id + ": [0-9a-f]{16}", false};
+    case 4: return {"[a-z0-9.-]+\\.evil" + id + "\\.com", true};
+    default: return {"^SSH-2\\.0-Tool" + id, false};
+    }
+}
+
+// HTTP-like requests of 200-1400 bytes; about 1 in 100 carries a signature.
+std::vector<std::string> payloads(std::mt19937& rng, size_t signatures) {
+    static const char* paths[] = {"/index.html", "/api/v1/items?page=2", "/static/app.js", "/login", "/img/logo.png"};
+    static const char* agents[] = {"Mozilla/5.0 (X11; Linux x86_64)", "curl/8.5.0", "okhttp/4.12.0"};
+    std::vector<std::string> out;
+    for (size_t i = 0; i < PAYLOADS; ++i) {
+        std::string p = std::string("GET ") + paths[rng() % 5] + " HTTP/1.1\r\nHost: www.example.com\r\n";
+        p += std::string("User-Agent: ") + agents[rng() % 3] + "\r\nAccept: */*\r\n";
+        if (rng() % 100 == 0) {
+            size_t n = rng() % signatures;
+            switch (n % 6) {
+            case 0: p += "User-Agent: scanbot" + std::to_string(n) + "\r\n"; break;
+            case 1: p = "GET /admin" + std::to_string(n) + ".php HTTP/1.1\r\n" + p; break;
+            case 2: p += "Cookie: exec" + std::to_string(n) + "=x1\r\n"; break;
+            case 3: p += "X-Trace-" + std::to_string(n) + ": 0123456789abcdef\r\n"; break;
+            case 4: p += "Referer: http://cdn.evil" + std::to_string(n) + ".com/\r\n"; break;
+            default: p = "SSH-2.0-Tool" + std::to_string(n) + "\r\n" + p; break;
+            }
+        }
+        size_t target = 200 + rng() % 1200;
+        while (p.size() < target) p += "X-Pad: " + std::to_string(rng()) + "\r\n";
+        out.push_back(p);
+    }
+    return out;
+}
+
+// Microseconds per payload of `inspect`, repeated until MIN_SECONDS passed.
+template <typename F>
+double usPerPayload(const std::vector<std::string>& input, F&& inspect, size_t& matches) {
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    size_t done = 0;
+    matches = 0;
+    do {
+        for (size_t i = 0; i < input.size(); ++i, ++done) {
+            if (inspect(input[i])) ++matches;
+            if ((done & 63) == 63 && Clock::now() - start > std::chrono::duration<double>(MIN_SECONDS * 4)) break;
+        }
+    } while (Clock::now() - start < std::chrono::duration<double>(MIN_SECONDS));
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    return us / static_cast<double>(done);
+}
+}
+
+int main() {
+    std::printf("%-10s %10s %18s %18s %18s\n", "signatures", "in DFA", "regex each (us)", "prefilter (us)", "combined DFA (us)");
+    for (size_t count : {10, 100, 1000}) {
+        std::mt19937 rng(42);
+        std::vector<std::string> input = payloads(rng, count);
+
+        std::vector<std::regex> regexes;
+        DPIEngine filtered, combined;
+        filtered.setCombinedDfa(false);
+        for (size_t i = 0; i < count; ++i) {
+            Sig sig = signature(i);
+            regexes.emplace_back(sig.regex, sig.icase ? std::regex::icase : std::regex::ECMAScript);
+            filtered.addSignature("sig" + std::to_string(i), sig.regex, DPIResult::Block, sig.icase);
+            combined.addSignature("sig" + std::to_string(i), sig.regex, DPIResult::Block, sig.icase);
+        }
+
+        size_t m1, m2, m3;
+        double regexEach = usPerPayload(input, [&](const std::string& p) {
+            for (const std::regex& re : regexes) {
+                if (std::regex_search(p, re)) return true;
+            }
+            return false;
+        }, m1);
+        double prefilter = usPerPayload(input, [&](const std::string& p) {
+            return filtered.testPayload(p) == DPIResult::Block;
+        }, m2);
+        double dfa = usPerPayload(input, [&](const std::string& p) {
+            return combined.testPayload(p) == DPIResult::Block;
+        }, m3);
+        std::printf("%-10zu %10zu %18.2f %18.2f %18.2f\n", count, combined.dfaSignatureCount(), regexEach, prefilter, dfa);
+    }
+    return 0;
+}
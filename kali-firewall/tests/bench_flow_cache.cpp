@@ -0,0 +1,125 @@
+// Per-packet classification cost with and without the flow verdict cache,
+// for a few traffic mixes over 10k rules. Build with -DFIREWALL_BUILD_BENCHMARKS=ON.
+#include "compiled_rule.h"
+#include "flow_cache.h"
+#include "rule_classifier.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr size_t RULES = 10000;
+constexpr size_t CACHE_ENTRIES = 16384;   // RuleEngine's per-thread default
+constexpr size_t PACKETS = 2000000;
+
+// Same blocklist-like mix as bench_rule_classifier.
+CompiledRule randomRule(std::mt19937& rng) {
+    static const int prefixes[] = {32, 32, 32, 24, 24, 16, 8};
+    RuleText text;
+    std::uniform_int_distribution<int> octet(0, 255), port(1, 65535), pick(0, 99);
+    int prefix = prefixes[pick(rng) % 7];
+    text.srcIp = std::to_string(octet(rng)) + "." + std::to_string(octet(rng)) + "." +
+                 std::to_string(octet(rng)) + "." + std::to_string(octet(rng)) + "/" + std::to_string(prefix);
+    text.dstIp = pick(rng) < 80 ? "*" : "10.0." + std::to_string(octet(rng)) + ".0/24";
+    text.srcPort = "*";
+    text.dstPort = pick(rng) < 50 ? std::to_string(port(rng)) : "*";
+    text.protocol = pick(rng) < 50 ? "tcp" : "*";
+    text.action = pick(rng) < 90 ? "block" : "allow";
+    CompiledRule r;
+    compileRule(text, r);
+    return r;
+}
+
+PacketMeta randomFlow(std::mt19937& rng) {
+    PacketMeta pkt;
+    pkt.src.family = pkt.dst.family = AF_INET;
+    uint32_t src = rng(), dst = rng();
+    std::memcpy(pkt.src.bytes, &src, 4);
+    std::memcpy(pkt.dst.bytes, &dst, 4);
+    pkt.protocol = (rng() & 3) ? 6 : 17;
+    pkt.srcPort = static_cast<uint16_t>(1024 + rng() % 60000);
+    pkt.dstPort = static_cast<uint16_t>((rng() & 1) ? 443 : rng());
+    return pkt;
+}
+
+// Packet sequence over `flows` flows: flow popularity is Zipf(s) and each
+// pick sends a train of `train` packets back to back.
+std::vector<const PacketMeta*> trafficMix(std::mt19937& rng, const std::vector<PacketMeta>& flows,
+                                          double s, unsigned train) {
+    std::vector<double> weights(flows.size());
+    for (size_t i = 0; i < flows.size(); ++i) weights[i] = 1.0 / std::pow(static_cast<double>(i + 1), s);
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    std::vector<const PacketMeta*> packets;
+    packets.reserve(PACKETS);
+    while (packets.size() < PACKETS) {
+        const PacketMeta* flow = &flows[pick(rng)];
+        for (unsigned i = 0; i < train && packets.size() < PACKETS; ++i) packets.push_back(flow);
+    }
+    return packets;
+}
+
+template <class F>
+double nsPerPacket(const std::vector<const PacketMeta*>& packets, F classify, long& sink) {
+    auto start = std::chrono::steady_clock::now();
+    for (const PacketMeta* pkt : packets) sink += classify(*pkt);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(ns) / packets.size();
+}
+}
+
+int main() {
+    std::mt19937 rng(42);
+    long sink = 0;
+
+    std::vector<CompiledRule> rules;
+    rules.reserve(RULES);
+    for (size_t i = 0; i < RULES; ++i) rules.push_back(randomRule(rng));
+    RuleClassifier classifier;
+    classifier.build(rules.data(), rules.size());
+
+    struct Mix {
+        const char* name;
+        size_t flows;
+        double zipf;
+        unsigned train;
+    };
+    const Mix mixes[] = {
+        {"few bulk flows", 64, 1.0, 32},
+        {"desktop", 2000, 1.1, 4},
+        {"busy gateway", 50000, 0.9, 2},
+        {"scan (no reuse)", 2000000, 0.0, 1},
+    };
+
+    std::printf("%-16s %8s %14s %14s %9s %10s %10s\n",
+                "mix", "flows", "no cache ns", "cache ns", "hit rate", "occupancy", "evictions");
+    for (const Mix& mix : mixes) {
+        std::vector<PacketMeta> flows;
+        flows.reserve(mix.flows);
+        for (size_t i = 0; i < mix.flows; ++i) flows.push_back(randomFlow(rng));
+        std::vector<const PacketMeta*> packets = trafficMix(rng, flows, mix.zipf, mix.train);
+
+        double plain = nsPerPacket(packets, [&](const PacketMeta& p) { return classifier.find(p); }, sink);
+
+        // Same path as RuleEngine::lookup.
+        FlowCache cache(CACHE_ENTRIES);
+        const uint64_t generation = 1;
+        double cached = nsPerPacket(packets, [&](const PacketMeta& p) {
+            FlowKey key = FlowKey::of(p);
+            size_t hash = key.hash();
+            int idx = cache.find(key, hash, generation);
+            if (idx == FlowCache::MISS) {
+                idx = classifier.find(p);
+                cache.insert(key, hash, generation, idx);
+            }
+            return idx;
+        }, sink);
+
+        FlowCacheStats stats = cache.stats();
+        std::printf("%-16s %8zu %14.1f %14.1f %8.1f%% %10llu %10llu\n", mix.name, mix.flows, plain, cached,
+                    100.0 * stats.hits / stats.lookups, static_cast<unsigned long long>(stats.occupancy),
+                    static_cast<unsigned long long>(stats.evictions));
+    }
+    return sink == 42 ? 2 : 0;
+}
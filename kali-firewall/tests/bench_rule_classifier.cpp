@@ -0,0 +1,97 @@
+// Lookup cost of RuleClassifier (tuple space search) vs. a linear first-match
+// scan, for 1k to 1M rules. Build with -DFIREWALL_BUILD_BENCHMARKS=ON.
+#include "compiled_rule.h"
+#include "rule_classifier.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+// Blocklist-like mix: mostly host and /24 sources, some exact ports and protocols.
+CompiledRule randomRule(std::mt19937& rng) {
+    static const int prefixes[] = {32, 32, 32, 24, 24, 16, 8};
+    RuleText text;
+    std::uniform_int_distribution<int> octet(0, 255), port(1, 65535), pick(0, 99);
+    int prefix = prefixes[pick(rng) % 7];
+    text.srcIp = std::to_string(octet(rng)) + "." + std::to_string(octet(rng)) + "." +
+                 std::to_string(octet(rng)) + "." + std::to_string(octet(rng)) + "/" + std::to_string(prefix);
+    text.dstIp = pick(rng) < 80 ? "*" : "10.0." + std::to_string(octet(rng)) + ".0/24";
+    text.srcPort = "*";
+    text.dstPort = pick(rng) < 50 ? std::to_string(port(rng)) : "*";
+    text.protocol = pick(rng) < 50 ? "tcp" : "*";
+    text.action = pick(rng) < 90 ? "block" : "allow";
+    CompiledRule r;
+    compileRule(text, r);
+    return r;
+}
+
+// Half the packets are aimed at a random rule, half are random traffic.
+PacketMeta randomPacket(std::mt19937& rng, const std::vector<CompiledRule>& rules) {
+    PacketMeta pkt;
+    pkt.src.family = pkt.dst.family = AF_INET;
+    uint32_t src = rng(), dst = rng();
+    pkt.protocol = (rng() & 1) ? 6 : 17;
+    pkt.srcPort = static_cast<uint16_t>(rng());
+    pkt.dstPort = static_cast<uint16_t>(rng());
+    if (rng() & 1) {
+        const CompiledRule& r = rules[rng() % rules.size()];
+        src = (src & ~r.srcMask[0]) | r.srcNet[0];
+        dst = (dst & ~r.dstMask[0]) | r.dstNet[0];
+        if (r.dstPortLo == r.dstPortHi) pkt.dstPort = r.dstPortLo;
+        if (r.protocol >= 0) pkt.protocol = static_cast<uint8_t>(r.protocol);
+    }
+    std::memcpy(pkt.src.bytes, &src, 4);
+    std::memcpy(pkt.dst.bytes, &dst, 4);
+    return pkt;
+}
+
+int linearFind(const std::vector<CompiledRule>& rules, const PacketMeta& pkt) {
+    for (size_t i = 0; i < rules.size(); ++i) {
+        if (rules[i].matches(pkt)) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+template <class F>
+double nsPerLookup(const std::vector<PacketMeta>& packets, size_t lookups, F find, long& sink) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sink += find(packets[i % packets.size()]);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(ns) / lookups;
+}
+}
+
+int main() {
+    std::mt19937 rng(42);
+    long sink = 0;
+    std::printf("%10s %8s %12s %14s %14s %9s\n", "rules", "tuples", "build ms", "linear ns/pkt", "tss ns/pkt", "speedup");
+
+    for (size_t count : {1000, 10000, 100000, 1000000}) {
+        std::vector<CompiledRule> rules;
+        rules.reserve(count);
+        for (size_t i = 0; i < count; ++i) rules.push_back(randomRule(rng));
+
+        std::vector<PacketMeta> packets;
+        for (int i = 0; i < 4096; ++i) packets.push_back(randomPacket(rng, rules));
+
+        RuleClassifier classifier;
+        auto buildStart = std::chrono::steady_clock::now();
+        classifier.build(rules.data(), rules.size());
+        double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+
+        for (const PacketMeta& pkt : packets) {
+            if (classifier.find(pkt) != linearFind(rules, pkt)) {
+                std::fprintf(stderr, "Mismatch against linear scan at %zu rules\n", count);
+                return 1;
+            }
+        }
+
+        // Keep the linear run to roughly the same total work at every size.
+        size_t linearLookups = std::max<size_t>(200, 20000000 / count);
+        double linear = nsPerLookup(packets, linearLookups, [&](const PacketMeta& p) { return linearFind(rules, p); }, sink);
+        double tss = nsPerLookup(packets, 1000000, [&](const PacketMeta& p) { return classifier.find(p); }, sink);
+        std::printf("%10zu %8zu %12.1f %14.1f %14.1f %8.1fx\n", count, classifier.tupleCount(), buildMs, linear, tss, linear / tss);
+    }
+    return sink == 42 ? 2 : 0;
+}
@@ -0,0 +1,104 @@
+// Stream reassembly in front of DPI: signatures split across segments that
+// arrive out of order, late or around a forged teardown must still match.
+#include <assert.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "dpi_engine.h"
+
+namespace {
+constexpr size_t HEADERS = 40;
+
+// Runs one client-to-server TCP segment through shouldBlock().
+bool segment(DPIEngine& dpi, uint16_t srcPort, uint32_t seq, const std::string& payload, uint8_t flags = TH_ACK) {
+    std::vector<uint8_t> packet(HEADERS, 0);
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    PacketMeta meta;
+    meta.protocol = IPPROTO_TCP;
+    meta.srcPort = srcPort;
+    meta.dstPort = 80;
+    meta.tcpSeq = seq;
+    meta.tcpFlags = flags;
+    meta.data = packet.data();
+    meta.len = meta.wireLen = packet.size();
+    meta.payload = packet.data() + HEADERS;
+    meta.payloadLen = payload.size();
+    return dpi.shouldBlock(meta);
+}
+
+void engine(DPIEngine& dpi) {
+    assert(dpi.addSignature("split", "EVILSTRING", DPIResult::Block, false));
+    assert(dpi.addSignature("anchored", "^GET /bad", DPIResult::Block, false));
+    ReassemblyLimits limits;
+    limits.gapTimeoutMs = 50;
+    dpi.setStreamReassembly(true, limits);
+}
+}
+
+void test_in_order_split() {
+    DPIEngine dpi;
+    engine(dpi);
+    assert(!segment(dpi, 1000, 99, "", TH_SYN));
+    assert(!segment(dpi, 1000, 100, "xxEVILST"));
+    assert(segment(dpi, 1000, 108, "RINGyy"));
+}
+
+void test_out_of_order_first_segment() {
+    DPIEngine dpi;
+    engine(dpi);
+    // Joined mid-stream: the later half is the first segment seen.
+    assert(!segment(dpi, 1001, 108, "RINGyy"));
+    assert(segment(dpi, 1001, 100, "xxEVILST"));
+    // Same after a SYN, with the later half overtaking the earlier one.
+    assert(!segment(dpi, 1002, 99, "", TH_SYN));
+    assert(!segment(dpi, 1002, 108, "RINGyy"));
+    assert(segment(dpi, 1002, 100, "xxEVILST"));
+}
+
+void test_out_of_window_rst() {
+    DPIEngine dpi;
+    engine(dpi);
+    assert(!segment(dpi, 1003, 100, "xxEVILST"));
+    assert(!segment(dpi, 1003, 5000, "", TH_RST));
+    assert(segment(dpi, 1003, 108, "RINGyy"));
+}
+
+void test_anchor_after_teardown() {
+    DPIEngine dpi;
+    engine(dpi);
+    assert(!segment(dpi, 1004, 100, "GET /bad")); // Not the stream start
+    assert(!segment(dpi, 1005, 99, "", TH_SYN));
+    assert(!segment(dpi, 1005, 100, "xx"));
+    assert(!segment(dpi, 1005, 102, "", TH_RST));
+    // Whatever follows the teardown is not the start of a stream either.
+    assert(!segment(dpi, 1005, 102, "GET /bad"));
+    assert(!segment(dpi, 1006, 99, "", TH_SYN));
+    assert(segment(dpi, 1006, 100, "GET /bad"));
+}
+
+void test_late_hole_fill() {
+    DPIEngine dpi;
+    engine(dpi);
+    assert(!segment(dpi, 1007, 99, "", TH_SYN));
+    assert(!segment(dpi, 1007, 100, "xxEVI"));
+    assert(!segment(dpi, 1007, 108, "RINGzz"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    assert(!segment(dpi, 1007, 114, "qq")); // Skips the hole
+    assert(segment(dpi, 1007, 105, "LST"));
+    assert(dpi.streamStats().lateFills == 1);
+}
+
+int main() {
+    test_in_order_split();
+    test_out_of_order_first_segment();
+    test_out_of_window_rst();
+    test_anchor_after_teardown();
+    test_late_hole_fill();
+
+    printf("All tests passed!\n");
+    return 0;
+}